@@ -16,6 +16,12 @@
 #define GV_EU11 3	//1.01 eu
 #define GV_UNK -1	//any other
 
+//result of CLEO_GetSaveStatus()
+#define CLEO_SAVE_NONE		0	//nothing saved in this session
+#define CLEO_SAVE_PENDING	1	//being written to disk
+#define CLEO_SAVE_DONE		2	//the last save is written
+#define CLEO_SAVE_FAILED	3	//the last save could not be written, previous cs*.sav is left intact
+
 typedef union
 {
 	DWORD	dwParam;
@@ -55,7 +61,7 @@ struct CScriptThread
 {
 	CScriptThread	*next;					//next script in queue
 	CScriptThread	*prev;					//previous script in queue
-	char			threadName[8];			//name of thread, given by 03A4 opcode
+	char			threadName[8];			//name of thread, given by 03A4 opcode (plugins should change it with CLEO_SetScriptName)
 	BYTE			*baseIp;				//pointer to begin of script in memory
 	BYTE			*ip;					//current index pointer
 	BYTE			*stack[8];				//return stack for 0050, 0051
@@ -98,6 +104,11 @@ extern "C" {
 DWORD WINAPI CLEO_GetVersion();
 int   WINAPI CLEO_GetGameVersion();
 
+//opcodes CLEO_CORE_OPCODES_FIRST-CLEO_CORE_OPCODES_LAST are reserved for CLEO itself and should not be used by plugins
+//(registering one of them still succeeds, replacing the opcode of CLEO, for plugins made before the range was reserved)
+#define CLEO_CORE_OPCODES_FIRST 0x0B30
+#define CLEO_CORE_OPCODES_LAST 0x0B3F
+
 BOOL  WINAPI CLEO_RegisterOpcode(WORD opcode, _pOpcodeHandler callback);
 
 DWORD WINAPI CLEO_GetIntOpcodeParam(CScriptThread* thread);
@@ -110,6 +121,9 @@ LPSTR WINAPI CLEO_ReadStringOpcodeParam(CScriptThread* thread, LPSTR buf, int si
 LPSTR WINAPI CLEO_ReadStringPointerOpcodeParam(CScriptThread* thread, LPSTR buf, int size);
 void  WINAPI CLEO_WriteStringOpcodeParam(CScriptThread* thread, LPCSTR str);
 
+//reads text param without copying: returns its characters in the script code or variable (NOT null-terminated), nullptr for other params
+LPCSTR WINAPI CLEO_ReadStringViewOpcodeParam(CScriptThread* thread, DWORD *length);
+
 void  WINAPI CLEO_SetThreadCondResult(CScriptThread* thread, BOOL result);
 
 void  WINAPI CLEO_SkipOpcodeParams(CScriptThread* thread, int count);
@@ -126,6 +140,9 @@ extern SCRIPT_VAR *missionLocals;
 void WINAPI CLEO_RetrieveOpcodeParams(CScriptThread *thread, int count);
 void WINAPI CLEO_RecordOpcodeParams(CScriptThread *thread, int count);
 
+//reads count numeric params directly into buf, opcodeParams is not touched
+void WINAPI CLEO_RetrieveOpcodeParamsTo(CScriptThread *thread, int count, SCRIPT_VAR *buf);
+
 SCRIPT_VAR * WINAPI CLEO_GetPointerToScriptVariable(CScriptThread *thread);
 
 DWORD WINAPI CLEO_GetScriptTextureById(CScriptThread* thread, int id); // ret RwTexture *
@@ -140,6 +157,20 @@ void WINAPI CLEO_AddScriptDeleteDelegate(FuncScriptDeleteDelegateT func);
 
 void WINAPI CLEO_RemoveScriptDeleteDelegate(FuncScriptDeleteDelegateT func);
 
+int WINAPI CLEO_GetSaveStatus();
+
+// renames the script the way 03A4 does, so 0AAA and 0ABA find it by the new name at once
+void WINAPI CLEO_SetScriptName(CScriptThread* thread, LPCSTR name);
+
+// named data of the custom script stored in cleo saves, kept by the checksum of the script
+BOOL WINAPI CLEO_SetScriptBlob(CScriptThread* thread, LPCSTR name, const void *data, DWORD size);
+DWORD WINAPI CLEO_GetScriptBlob(CScriptThread* thread, LPCSTR name, void *buf, DWORD bufSize); // ret size of the blob, 0 if there is none
+BOOL WINAPI CLEO_DeleteScriptBlob(CScriptThread* thread, LPCSTR name);
+
+// sscanf for parsing whole buffers: the format is compiled once, common conversions are scanned directly into args (up to 34 of them)
+// text up to end has to be null-terminated at end; *text is moved past the scanned characters if the whole format has been matched
+int WINAPI CLEO_ScanBuffer(LPCSTR *text, LPCSTR end, LPCSTR format, void **args, DWORD numArgs);
+
 #ifdef __cplusplus
 }
 #endif	//__cplusplus
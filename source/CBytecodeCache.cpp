@@ -0,0 +1,157 @@
+#include "stdafx.h"
+#include "CBytecodeCache.h"
+#include "CDebug.h"
+#include "crc32.h"
+#include <thread>
+#include <atomic>
+
+namespace CLEO
+{
+    const size_t MAX_PRELOAD_THREADS = 8;
+
+    // full lowercase path and current attributes of the file, false if there is no such file
+    static bool ResolveScriptFile(const char *path, std::string& fullPath, WIN32_FILE_ATTRIBUTE_DATA& attr)
+    {
+        char buf[MAX_PATH];
+        if (!GetFullPathName(path, sizeof(buf), buf, nullptr))
+            throw std::logic_error("Invalid script file path");
+        _strlwr(buf);
+        fullPath = buf;
+        return GetFileAttributesEx(buf, GetFileExInfoStandard, &attr) && !(attr.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY);
+    }
+
+    static bool IsUpToDate(const CachedBytecode& bytecode, const WIN32_FILE_ATTRIBUTE_DATA& attr)
+    {
+        return bytecode.fileSize == attr.nFileSizeLow && !CompareFileTime(&bytecode.lastWriteTime, &attr.ftLastWriteTime);
+    }
+
+    // doesn't touch the cache, so can be run by several threads at once
+    static std::shared_ptr<CachedBytecode> ReadScriptFile(const char *fullPath, const WIN32_FILE_ATTRIBUTE_DATA& attr)
+    {
+        std::ifstream is(fullPath, std::ios::binary);
+        is.exceptions(std::ios::badbit | std::ios::failbit);
+
+        auto bytecode = std::make_shared<CachedBytecode>();
+        bytecode->fileSize = attr.nFileSizeLow;
+        bytecode->lastWriteTime = attr.ftLastWriteTime;
+        bytecode->code.resize(attr.nFileSizeLow);
+        if (attr.nFileSizeLow) is.read(reinterpret_cast<char *>(bytecode->code.data()), attr.nFileSizeLow);
+        bytecode->checksum = crc32(bytecode->code.data(), bytecode->code.size());
+
+        LARGE_INTEGER start, end;
+        QueryPerformanceCounter(&start);
+        try
+        {
+            auto index = std::make_shared<CBytecodeIndex>();
+            BuildBytecodeIndex(bytecode->code.data(), bytecode->code.size(), *index);
+            bytecode->index = index;
+        }
+        catch (std::exception& ex)
+        {
+            bytecode->error = ex.what();
+        }
+        QueryPerformanceCounter(&end);
+        bytecode->verifyTime = end.QuadPart - start.QuadPart;
+        return bytecode;
+    }
+
+    void CBytecodeCache::Store(const std::string& fullPath, const std::shared_ptr<const CachedBytecode>& bytecode)
+    {
+        entries[fullPath] = bytecode;
+        if (!bytecode->index) TRACE("Script %s is run without instruction index: %s", fullPath.c_str(), bytecode->error.c_str());
+        ++verifyStats.numScripts;
+        verifyStats.numBytes += bytecode->code.size();
+        verifyStats.time += bytecode->verifyTime;
+    }
+
+    std::shared_ptr<const CachedBytecode> CBytecodeCache::Get(const char *path)
+    {
+        std::string fullPath;
+        WIN32_FILE_ATTRIBUTE_DATA attr;
+        if (!ResolveScriptFile(path, fullPath, attr))
+            throw std::logic_error("Script file not found");
+
+        auto it = entries.find(fullPath);
+        if (it != entries.end() && it->second && IsUpToDate(*it->second, attr))
+            return it->second;
+
+        // not cached yet or modified since
+        try
+        {
+            auto bytecode = ReadScriptFile(fullPath.c_str(), attr);
+            Store(fullPath, bytecode);
+            return bytecode;
+        }
+        catch (...)
+        {
+            entries.erase(fullPath);
+            throw;
+        }
+    }
+
+    void CBytecodeCache::Preload(const std::vector<std::string>& paths)
+    {
+        struct PreloadJob
+        {
+            std::string fullPath;
+            WIN32_FILE_ATTRIBUTE_DATA attr;
+            std::shared_ptr<CachedBytecode> bytecode;
+        };
+
+        // paths are resolved here, as the workers must not depend on the current directory
+        std::vector<PreloadJob> jobs;
+        for (auto& path : paths)
+        {
+            PreloadJob job;
+            try
+            {
+                if (!ResolveScriptFile(path.c_str(), job.fullPath, job.attr)) continue;
+            }
+            catch (std::exception&)
+            {
+                continue;
+            }
+            auto it = entries.find(job.fullPath);
+            if (it != entries.end() && it->second && IsUpToDate(*it->second, job.attr)) continue;
+            jobs.push_back(std::move(job));
+        }
+        if (jobs.empty()) return;
+
+        std::atomic<size_t> nextJob(0);
+        auto worker = [&jobs, &nextJob]()
+        {
+            for (size_t i; (i = nextJob++) < jobs.size();)
+            {
+                try
+                {
+                    jobs[i].bytecode = ReadScriptFile(jobs[i].fullPath.c_str(), jobs[i].attr);
+                }
+                catch (...)
+                {
+                    // left for Get, which reports the error to the script being started
+                }
+            }
+        };
+
+        size_t numThreads = std::thread::hardware_concurrency();
+        if (numThreads > MAX_PRELOAD_THREADS) numThreads = MAX_PRELOAD_THREADS;
+        if (numThreads > jobs.size()) numThreads = jobs.size();
+
+        std::vector<std::thread> workers;
+        try
+        {
+            for (size_t i = 1; i < numThreads; ++i) workers.emplace_back(worker);
+        }
+        catch (std::exception&)
+        {
+            // go on with the threads already started
+        }
+        worker(); // calling thread takes its part too
+        for (auto& thread : workers) thread.join();
+
+        for (auto& job : jobs)
+        {
+            if (job.bytecode) Store(job.fullPath, job.bytecode);
+        }
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "CBytecodeVerifier.h"
+
+namespace CLEO
+{
+    // contents of a script file, shared by all custom scripts started from it
+    struct CachedBytecode
+    {
+        std::vector<BYTE> code;
+        DWORD checksum;
+        FILETIME lastWriteTime;
+        DWORD fileSize;
+        std::shared_ptr<const CBytecodeIndex> index;    // nullptr if the verifier failed, the code is run without the index then
+        std::string error;                              // why the verifier failed
+        LONGLONG verifyTime;                            // in performance counter ticks
+    };
+
+    struct BytecodeVerifyStats
+    {
+        size_t numScripts;
+        size_t numBytes;
+        LONGLONG time;                                  // in performance counter ticks
+    };
+
+    class CBytecodeCache
+    {
+        // full lowercase path -> file contents
+        std::unordered_map<std::string, std::shared_ptr<const CachedBytecode>> entries;
+        BytecodeVerifyStats verifyStats;
+
+        void Store(const std::string& fullPath, const std::shared_ptr<const CachedBytecode>& bytecode);
+
+    public:
+        CBytecodeCache() { ResetVerifyStats(); }
+
+        // get contents of the script file (path may be relative to the current directory), reloads it if the file has changed
+        std::shared_ptr<const CachedBytecode> Get(const char *path);
+        // read, hash and verify the files in parallel, so the following Get calls only have to check them for changes
+        void Preload(const std::vector<std::string>& paths);
+        // drops the contents, scripts keep the indices they use
+        void Clear() { entries.clear(); }
+        size_t Size() const { return entries.size(); }
+
+        // files read and verified since the last reset
+        const BytecodeVerifyStats& GetVerifyStats() const { return verifyStats; }
+        void ResetVerifyStats() { verifyStats.numScripts = verifyStats.numBytes = 0; verifyStats.time = 0; }
+    };
+}
@@ -0,0 +1,399 @@
+#include "stdafx.h"
+#include "CBytecodeVerifier.h"
+#include "CTheScripts.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace CLEO
+{
+    struct KnownOpcode
+    {
+        WORD opcode;
+        BYTE numParams;
+        BYTE flags;
+    };
+
+    // only opcodes of certain layout are listed, a wrong entry would make valid scripts rejected
+    static const KnownOpcode knownOpcodes[] =
+    {
+        { 0x0000, 0, 0 },                                                       // nop
+        { 0x0001, 1, 0 },                                                       // wait
+        { 0x0002, 1, OpcodeLayout::JUMP | OpcodeLayout::NO_FALLTHROUGH },      // jump
+        { 0x004C, 1, OpcodeLayout::JUMP },                                      // jump_if_true
+        { 0x004D, 1, OpcodeLayout::JUMP },                                      // jump_if_false
+        { 0x004E, 0, OpcodeLayout::NO_FALLTHROUGH },                            // end_thread
+        { 0x004F, 1, OpcodeLayout::VARIADIC },                                  // start_new_script
+        { 0x0050, 1, OpcodeLayout::JUMP },                                      // gosub
+        { 0x0051, 0, OpcodeLayout::NO_FALLTHROUGH },                            // return
+        { 0x00D6, 1, 0 },                                                       // if
+        { 0x03A4, 1, 0 },                                                       // script_name
+
+        { 0x0A8C, 4, 0 }, { 0x0A8D, 4, 0 }, { 0x0A8E, 3, 0 }, { 0x0A8F, 3, 0 },
+        { 0x0A90, 3, 0 }, { 0x0A91, 3, 0 }, { 0x0A92, 1, OpcodeLayout::VARIADIC },
+        { 0x0A93, 0, OpcodeLayout::NO_FALLTHROUGH }, { 0x0A94, 1, OpcodeLayout::VARIADIC },
+        { 0x0A95, 0, 0 }, { 0x0A96, 2, 0 }, { 0x0A97, 2, 0 }, { 0x0A98, 2, 0 },
+        { 0x0A99, 1, 0 }, { 0x0A9A, 3, 0 }, { 0x0A9B, 1, 0 }, { 0x0A9C, 2, 0 },
+        { 0x0A9D, 3, 0 }, { 0x0A9E, 3, 0 }, { 0x0A9F, 1, 0 }, { 0x0AA0, 1, OpcodeLayout::JUMP },
+        { 0x0AA1, 0, 0 }, { 0x0AA2, 2, 0 }, { 0x0AA3, 1, 0 }, { 0x0AA4, 3, 0 },
+        { 0x0AA5, 3, OpcodeLayout::VARIADIC }, { 0x0AA6, 4, OpcodeLayout::VARIADIC },
+        { 0x0AA7, 3, OpcodeLayout::VARIADIC }, { 0x0AA8, 4, OpcodeLayout::VARIADIC },
+        { 0x0AA9, 0, 0 }, { 0x0AAA, 2, 0 }, { 0x0AAB, 1, 0 }, { 0x0AAC, 2, 0 },
+        { 0x0AAD, 2, 0 }, { 0x0AAE, 1, 0 }, { 0x0AAF, 2, 0 }, { 0x0AB0, 1, 0 },
+        { 0x0AB1, 2, OpcodeLayout::VARIADIC | OpcodeLayout::JUMP },
+        { 0x0AB2, 1, OpcodeLayout::VARIADIC | OpcodeLayout::NO_FALLTHROUGH },
+        { 0x0AB3, 2, 0 }, { 0x0AB4, 2, 0 }, { 0x0AB5, 3, 0 }, { 0x0AB6, 3, 0 },
+        { 0x0AB7, 2, 0 }, { 0x0AB8, 2, 0 }, { 0x0AB9, 2, 0 }, { 0x0ABA, 1, 0 },
+        { 0x0ABB, 2, 0 }, { 0x0ABC, 2, 0 }, { 0x0ABD, 1, 0 }, { 0x0ABE, 1, 0 },
+        { 0x0ABF, 2, 0 }, { 0x0AC0, 2, 0 }, { 0x0AC1, 2, 0 }, { 0x0AC2, 4, 0 },
+        { 0x0AC3, 2, 0 }, { 0x0AC4, 2, 0 }, { 0x0AC5, 2, 0 }, { 0x0AC6, 2, OpcodeLayout::LABEL_REF },
+        { 0x0AC7, 2, 0 }, { 0x0AC8, 2, 0 }, { 0x0AC9, 1, 0 }, { 0x0ACA, 1, 0 },
+        { 0x0ACB, 3, 0 }, { 0x0ACC, 2, 0 }, { 0x0ACD, 2, 0 }, { 0x0ACE, 1, OpcodeLayout::VARIADIC },
+        { 0x0ACF, 3, OpcodeLayout::VARIADIC }, { 0x0AD0, 2, OpcodeLayout::VARIADIC },
+        { 0x0AD1, 2, OpcodeLayout::VARIADIC }, { 0x0AD2, 2, 0 }, { 0x0AD3, 2, OpcodeLayout::VARIADIC },
+        { 0x0AD4, 3, OpcodeLayout::VARIADIC }, { 0x0AD5, 3, 0 }, { 0x0AD6, 1, 0 }, { 0x0AD7, 3, 0 },
+        { 0x0AD8, 2, 0 }, { 0x0AD9, 2, OpcodeLayout::VARIADIC }, { 0x0ADA, 3, OpcodeLayout::VARIADIC },
+        { 0x0ADB, 2, 0 }, { 0x0ADC, 1, 0 }, { 0x0ADD, 1, 0 }, { 0x0ADE, 2, 0 },
+        { 0x0ADF, 2, 0 }, { 0x0AE0, 1, 0 }, { 0x0AE1, 7, 0 }, { 0x0AE2, 7, 0 },
+        { 0x0AE3, 6, 0 }, { 0x0AE4, 1, 0 }, { 0x0AE5, 1, 0 }, { 0x0AE6, 3, 0 },
+        { 0x0AE7, 2, 0 }, { 0x0AE8, 1, 0 }, { 0x0AE9, 1, 0 }, { 0x0AEA, 2, 0 },
+        { 0x0AEB, 2, 0 }, { 0x0AEC, 2, 0 }, { 0x0AED, 3, 0 }, { 0x0AEE, 3, 0 },
+        { 0x0AEF, 3, 0 },
+
+        { 0x0B30, 1, 0 }, { 0x0B31, 3, 0 }, { 0x0B32, 3, 0 }, { 0x0B33, 2, 0 },
+        { 0x0B34, 1, 0 }, { 0x0B35, 2, 0 }, { 0x0B36, 2, 0 },
+        { 0x0B37, 1, 0 },
+    };
+
+    class COpcodeLayoutTable
+    {
+        OpcodeLayout layouts[0x8000];
+
+    public:
+        COpcodeLayoutTable()
+        {
+            std::fill(layouts, layouts + 0x8000, OpcodeLayout{ OpcodeLayout::UNKNOWN, 0 });
+
+            // assignments, arithmetics and comparisons of variables
+            for (WORD opcode = 0x0004; opcode <= 0x0043; ++opcode) layouts[opcode] = OpcodeLayout{ 2, 0 };
+            for (WORD opcode = 0x0058; opcode <= 0x0093; ++opcode) layouts[opcode] = OpcodeLayout{ 2, 0 };
+            for (WORD opcode = 0x0094; opcode <= 0x0097; ++opcode) layouts[opcode] = OpcodeLayout{ 1, 0 };   // abs
+
+            for (auto& known : knownOpcodes) layouts[known.opcode] = OpcodeLayout{ known.numParams, known.flags };
+        }
+
+        inline OpcodeLayout& operator[](WORD opcode) { return layouts[opcode & 0x7FFF]; }
+    };
+
+    // built when the dll is loaded, before scripts are verified by the preload threads
+    static COpcodeLayoutTable opcodeLayouts;
+
+    const OpcodeLayout& GetOpcodeLayout(WORD opcode)
+    {
+        return opcodeLayouts[opcode];
+    }
+
+    void ForgetOpcodeLayout(WORD opcode)
+    {
+        opcodeLayouts[opcode] = OpcodeLayout{ OpcodeLayout::UNKNOWN, 0 };
+    }
+
+    const BytecodeInstruction *CBytecodeListing::Find(DWORD offset) const
+    {
+        auto it = std::lower_bound(instructions.begin(), instructions.end(), offset,
+            [](const BytecodeInstruction& instr, DWORD off) { return instr.offset < off; });
+        return it != instructions.end() && it->offset == offset ? &*it : nullptr;
+    }
+
+    BYTE CBytecodeIndex::GetFunctionLocals(DWORD offset) const
+    {
+        auto it = std::lower_bound(functionScopes.begin(), functionScopes.end(), offset,
+            [](const FunctionScope& scope, DWORD off) { return scope.offset < off; });
+        return it != functionScopes.end() && it->offset == offset ? it->numLocals : NUM_FUNCTION_LOCALS;
+    }
+
+    static void ThrowBytecodeError(const char *what, size_t offset)
+    {
+        char buf[128];
+        sprintf(buf, "%s at offset %u", what, static_cast<unsigned>(offset));
+        throw std::runtime_error(buf);
+    }
+
+    // length of the operand starting with the type byte, same as SkipScriptParam steps over
+    static size_t GetOperandLength(const BYTE *code, size_t size, size_t pos)
+    {
+        size_t len;
+        switch (code[pos])
+        {
+        case DT_VAR:
+        case DT_LVAR:
+        case DT_WORD:
+        case DT_VAR_TEXTLABEL:
+        case DT_LVAR_TEXTLABEL:
+        case DT_VAR_STRING:
+        case DT_LVAR_STRING:
+            len = 1 + 2;
+            break;
+        case DT_VAR_ARRAY:
+        case DT_LVAR_ARRAY:
+        case DT_VAR_TEXTLABEL_ARRAY:
+        case DT_LVAR_TEXTLABEL_ARRAY:
+        case DT_VAR_STRING_ARRAY:
+        case DT_LVAR_STRING_ARRAY:
+            len = 1 + 6;
+            break;
+        case DT_BYTE:
+            len = 1 + 1;
+            break;
+        case DT_DWORD:
+        case DT_FLOAT:
+            len = 1 + 4;
+            break;
+        case DT_VARLEN_STRING:
+            if (pos + 1 >= size) ThrowBytecodeError("Truncated operand", pos);
+            len = 1 + 1 + code[pos + 1];
+            break;
+        case DT_TEXTLABEL:
+            len = 1 + 8;
+            break;
+        case DT_STRING:
+            len = 1 + 16;
+            break;
+        default:
+            ThrowBytecodeError("Invalid operand type", pos);
+        }
+        if (len > size - pos) ThrowBytecodeError("Truncated operand", pos);
+        return len;
+    }
+
+    // value of immediate numeric operand, false for other operands
+    static bool GetImmediateValue(const BYTE *code, size_t pos, int& value)
+    {
+        switch (code[pos])
+        {
+        case DT_DWORD:
+            value = *reinterpret_cast<const int *>(code + pos + 1);
+            return true;
+        case DT_WORD:
+            value = *reinterpret_cast<const short *>(code + pos + 1);
+            return true;
+        case DT_BYTE:
+            value = static_cast<char>(code[pos + 1]);
+            return true;
+        }
+        return false;
+    }
+
+    void DecodeBytecode(const BYTE *code, size_t size, CBytecodeListing& listing)
+    {
+        enum : BYTE { UNVISITED, INSTRUCTION, INSIDE, UNKNOWN_INSTRUCTION };
+        std::vector<BYTE> marks(size, UNVISITED);
+        std::vector<size_t> pending;
+
+        listing = CBytecodeListing();
+        listing.instructions.reserve(size / 8);
+        listing.operands.reserve(size / 4);
+        if (size) pending.push_back(0);
+
+        while (!pending.empty())
+        {
+            size_t offset = pending.back();
+            pending.pop_back();
+
+            // follow the execution until it leaves the path or comes to code already decoded
+            for (;;)
+            {
+                if (offset >= size) ThrowBytecodeError("Execution runs past the end of the script", offset);
+                if (marks[offset] == INSTRUCTION || marks[offset] == UNKNOWN_INSTRUCTION) break;
+                if (marks[offset] == INSIDE) ThrowBytecodeError("Jump into the middle of instruction", offset);
+                if (size - offset < 2) ThrowBytecodeError("Truncated opcode", offset);
+
+                WORD opcode = *reinterpret_cast<const WORD *>(code + offset);
+                auto& layout = GetOpcodeLayout(opcode);
+                if (layout.numParams == OpcodeLayout::UNKNOWN)
+                {
+                    marks[offset] = UNKNOWN_INSTRUCTION;
+                    ++listing.unknownOpcodes;
+                    break;
+                }
+
+                BytecodeInstruction instr;
+                instr.offset = static_cast<DWORD>(offset);
+                instr.firstOperand = static_cast<DWORD>(listing.operands.size());
+                instr.opcode = opcode;
+                instr.numOperands = 0;
+
+                size_t pos = offset + 2;
+                for (;; ++instr.numOperands)
+                {
+                    bool extra = instr.numOperands >= layout.numParams;
+                    if (extra && !(layout.flags & OpcodeLayout::VARIADIC)) break;
+                    if (pos >= size) ThrowBytecodeError("Truncated operand", pos);
+                    if (code[pos] == DT_END)
+                    {
+                        if (!extra) ThrowBytecodeError("Missing operand", pos);
+                        ++pos;
+                        break;
+                    }
+
+                    size_t len = GetOperandLength(code, size, pos);
+                    int label;
+                    if (!instr.numOperands && layout.flags & (OpcodeLayout::JUMP | OpcodeLayout::LABEL_REF) &&
+                        GetImmediateValue(code, pos, label) && label < 0)
+                    {
+                        // negative labels are offsets in the script, others point into main.scm
+                        size_t target = static_cast<size_t>(-static_cast<long long>(label));
+                        if (target >= size) ThrowBytecodeError("Label out of the script", pos);
+                        if (layout.flags & OpcodeLayout::JUMP) pending.push_back(target);
+                    }
+
+                    listing.operands.push_back(BytecodeOperand{ static_cast<DWORD>(pos), code[pos] });
+                    pos += len;
+                }
+
+                marks[offset] = INSTRUCTION;
+                for (size_t i = offset + 1; i < pos; ++i)
+                {
+                    if (marks[i] != UNVISITED) ThrowBytecodeError("Instruction overlaps other one", offset);
+                    marks[i] = INSIDE;
+                }
+                if (pos - offset > 0xFFFF) ThrowBytecodeError("Instruction too long", offset);
+                instr.size = static_cast<WORD>(pos - offset);
+                listing.instructions.push_back(instr);
+                listing.indexedBytes += pos - offset;
+
+                if (layout.flags & OpcodeLayout::NO_FALLTHROUGH) break;
+                offset = pos;
+            }
+        }
+
+        std::sort(listing.instructions.begin(), listing.instructions.end(),
+            [](const BytecodeInstruction& a, const BytecodeInstruction& b) { return a.offset < b.offset; });
+    }
+
+    // number of first local variables the array operand may access, elemSize is in variables (0 for global arrays)
+    static size_t GetArrayLocalsExtent(const BYTE *data, size_t elemSize)
+    {
+        // offset, index variable, size, flags
+        WORD offset = *reinterpret_cast<const WORD *>(data);
+        WORD indexVar = *reinterpret_cast<const WORD *>(data + 2);
+        BYTE numElems = data[4];
+        bool globalIndex = (data[5] & 0x80) != 0;
+        size_t extent = globalIndex ? 0 : indexVar + 1;
+
+        if (elemSize)
+        {
+            if (!numElems) return NUM_FUNCTION_LOCALS; // size not declared, any element may be accessed
+            extent = (std::max)(extent, offset + numElems * elemSize);
+        }
+        return extent;
+    }
+
+    // number of first local variables the operand may access
+    static size_t GetLocalsExtent(const BYTE *code, const BytecodeOperand& operand)
+    {
+        const BYTE *data = code + operand.offset + 1;
+        switch (operand.type)
+        {
+        case DT_LVAR:
+            return *reinterpret_cast<const WORD *>(data) + 1;
+        case DT_LVAR_TEXTLABEL:
+            return *reinterpret_cast<const WORD *>(data) + 2;
+        case DT_LVAR_STRING:
+            return *reinterpret_cast<const WORD *>(data) + 4;
+        case DT_LVAR_ARRAY:
+            return GetArrayLocalsExtent(data, 1);
+        case DT_LVAR_TEXTLABEL_ARRAY:
+            return GetArrayLocalsExtent(data, 2);
+        case DT_LVAR_STRING_ARRAY:
+            return GetArrayLocalsExtent(data, 4);
+        case DT_VAR_ARRAY:
+        case DT_VAR_TEXTLABEL_ARRAY:
+        case DT_VAR_STRING_ARRAY:
+            return GetArrayLocalsExtent(data, 0);
+        }
+        return 0;
+    }
+
+    // finds how many locals every scm function called in the script uses, following its code up to 0AB2 together with gosubs it makes,
+    // so calls have to save and clear only those; calls made by the function are not followed, as they have frames of their own
+    static void ScopeFunctions(const BYTE *code, const CBytecodeListing& listing, CBytecodeIndex& index)
+    {
+        // code not decoded may take address of local variable as well, so nothing can be told about the functions
+        if (!listing.IsComplete()) return;
+
+        auto& instrs = listing.instructions;
+        std::vector<DWORD> functions;
+        for (auto& instr : instrs)
+        {
+            // with address of local variable taken (get_this_script_struct, get_var_pointer) any local may be accessed through memory
+            WORD opcode = instr.opcode & 0x7FFF;
+            if (opcode == 0x0A9F || opcode == 0x0AC7) return;
+
+            int label;
+            if (opcode == 0x0AB1 && GetImmediateValue(code, listing.operands[instr.firstOperand].offset, label) && label < 0)
+                functions.push_back(static_cast<DWORD>(-label));
+        }
+        std::sort(functions.begin(), functions.end());
+        functions.erase(std::unique(functions.begin(), functions.end()), functions.end());
+
+        std::vector<BYTE> visited(instrs.size());
+        std::vector<size_t> touched, pending;
+        for (DWORD function : functions)
+        {
+            size_t numLocals = 0;
+            pending.assign(1, function);
+
+            while (!pending.empty() && numLocals < NUM_FUNCTION_LOCALS)
+            {
+                size_t offset = pending.back();
+                pending.pop_back();
+
+                auto instr = listing.Find(static_cast<DWORD>(offset));
+                if (!instr)
+                {
+                    // goes to code of unknown layout
+                    numLocals = NUM_FUNCTION_LOCALS;
+                    break;
+                }
+                size_t i = instr - instrs.data();
+                if (visited[i]) continue;
+                visited[i] = 1;
+                touched.push_back(i);
+
+                for (WORD j = 0; j < instr->numOperands; ++j)
+                    numLocals = (std::max)(numLocals, GetLocalsExtent(code, listing.operands[instr->firstOperand + j]));
+
+                auto& layout = GetOpcodeLayout(instr->opcode);
+                if (layout.flags & OpcodeLayout::JUMP && (instr->opcode & 0x7FFF) != 0x0AB1)
+                {
+                    int label;
+                    if (!GetImmediateValue(code, listing.operands[instr->firstOperand].offset, label) || label >= 0)
+                    {
+                        // target out of the script
+                        numLocals = NUM_FUNCTION_LOCALS;
+                        break;
+                    }
+                    pending.push_back(static_cast<size_t>(-static_cast<long long>(label)));
+                }
+                if (!(layout.flags & OpcodeLayout::NO_FALLTHROUGH)) pending.push_back(offset + instr->size);
+            }
+
+            for (size_t i : touched) visited[i] = 0;
+            touched.clear();
+
+            if (numLocals < NUM_FUNCTION_LOCALS)
+                index.functionScopes.push_back(FunctionScope{ function, static_cast<BYTE>(numLocals) });
+        }
+    }
+    void BuildBytecodeIndex(const BYTE *code, size_t size, CBytecodeIndex& index)
+    {
+        CBytecodeListing listing;
+        DecodeBytecode(code, size, listing);
+
+        index = CBytecodeIndex();
+        index.indexedBytes = listing.indexedBytes;
+        index.unknownOpcodes = listing.unknownOpcodes;
+        ScopeFunctions(code, listing, index);
+        index.functionScopes.shrink_to_fit();
+    }
+}
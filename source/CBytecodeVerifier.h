@@ -0,0 +1,97 @@
+#pragma once
+#include <vector>
+
+namespace CLEO
+{
+    const BYTE NUM_FUNCTION_LOCALS = 32;    // local variables of the caller saved by scm function call
+
+    // operand layout of the opcode, as far as it is known to the verifier
+    struct OpcodeLayout
+    {
+        enum : BYTE
+        {
+            UNKNOWN = 0xFF,                 // numParams of opcodes the verifier can not step over
+        };
+
+        enum Flags : BYTE
+        {
+            VARIADIC = 1,                   // numParams operands, then any number of operands terminated by DT_END
+            JUMP = 2,                       // first operand is label the execution may go to
+            NO_FALLTHROUGH = 4,             // the execution never continues with the next instruction
+            LABEL_REF = 8,                  // first operand is label, but not of code (may point to data)
+        };
+
+        BYTE numParams;
+        BYTE flags;
+    };
+
+    const OpcodeLayout& GetOpcodeLayout(WORD opcode);
+    // makes the verifier stop at the opcode, as its handler was replaced by a plugin; must not be called while scripts are being loaded
+    void ForgetOpcodeLayout(WORD opcode);
+
+    struct BytecodeInstruction
+    {
+        DWORD offset;
+        DWORD firstOperand;                 // index into CBytecodeIndex::operands
+        WORD opcode;                        // with not-flag
+        WORD numOperands;                   // DT_END terminator of variadic opcodes is not counted
+        WORD size;                          // in bytes, with operands
+    };
+
+    struct BytecodeOperand
+    {
+        DWORD offset;                       // of the type byte
+        BYTE type;
+    };
+
+    // scm function (0AB1 target) accessing only first numLocals local variables
+    struct FunctionScope
+    {
+        DWORD offset;
+        BYTE numLocals;
+    };
+
+    // instructions of the script reachable from its beginning
+    // code after opcodes of unknown layout is not decoded, as it can not be told apart from data
+    class CBytecodeListing
+    {
+    public:
+        std::vector<BytecodeInstruction> instructions;     // sorted by offset
+        std::vector<BytecodeOperand> operands;
+        size_t indexedBytes;
+        size_t unknownOpcodes;              // places the decoding had to stop at
+
+        CBytecodeListing() : indexedBytes(0), unknownOpcodes(0) { }
+
+        // nullptr if no decoded instruction begins at the offset
+        const BytecodeInstruction *Find(DWORD offset) const;
+
+        inline bool IsComplete() const { return !unknownOpcodes; }
+    };
+
+    // what is kept of the script's listing for the time it runs
+    class CBytecodeIndex
+    {
+    public:
+        std::vector<FunctionScope> functionScopes;  // sorted by offset, functions using all locals are not listed, none if not complete
+        size_t indexedBytes;
+        size_t unknownOpcodes;
+
+        CBytecodeIndex() : indexedBytes(0), unknownOpcodes(0) { }
+
+        // number of local variables the function at the offset may access, NUM_FUNCTION_LOCALS if not known
+        BYTE GetFunctionLocals(DWORD offset) const;
+
+        inline bool IsComplete() const { return !unknownOpcodes; }
+    };
+
+    // the functions below only read the opcode layout table, which is built when the dll is loaded,
+    // so they may be run by several threads at once, as long as ForgetOpcodeLayout is not called meanwhile
+
+    // decodes the code following every path of execution from its beginning and validates operand encodings and local jump targets
+    // throws std::runtime_error describing the first error found
+    void DecodeBytecode(const BYTE *code, size_t size, CBytecodeListing& listing);
+
+    // decodes the code as above and scopes its scm functions, the listing itself is not kept
+    void BuildBytecodeIndex(const BYTE *code, size_t size, CBytecodeIndex& index);
+}
@@ -5,6 +5,10 @@
 #include "CCustomOpcodeSystem.h"
 #include "CTextManager.h"
 #include "CModelInfo.h"
+#include "ScriptParams.h"
+#include "CScmFunction.h"
+#include "CFormatCache.h"
+#include "CScanProgram.h"
 
 namespace CLEO {
 	DWORD FUNC_fopen;
@@ -122,6 +126,22 @@ namespace CLEO {
 	OpcodeResult __stdcall opcode_0AEE(CRunningScript *thread);
 	OpcodeResult __stdcall opcode_0AEF(CRunningScript *thread);
 
+	OpcodeResult __stdcall opcode_0B30(CRunningScript *thread);
+	OpcodeResult __stdcall opcode_0B31(CRunningScript *thread);
+	OpcodeResult __stdcall opcode_0B32(CRunningScript *thread);
+	OpcodeResult __stdcall opcode_0B33(CRunningScript *thread);
+	OpcodeResult __stdcall opcode_0B34(CRunningScript *thread);
+	OpcodeResult __stdcall opcode_0B35(CRunningScript *thread);
+	OpcodeResult __stdcall opcode_0B36(CRunningScript *thread);
+	OpcodeResult __stdcall opcode_0B37(CRunningScript *thread);
+
+	// opcodes of the range reserved for CLEO (CORE_OPCODES_FIRST-CORE_OPCODES_LAST), by opcode
+	CustomOpcodeHandler coreOpcodeHandlers[CORE_OPCODES_LAST - CORE_OPCODES_FIRST + 1] =
+	{
+		opcode_0B30, opcode_0B31, opcode_0B32, opcode_0B33, opcode_0B34,
+		opcode_0B35, opcode_0B36, opcode_0B37,
+	};
+
 	CustomOpcodeHandler customOpcodeHandlers[100] =
 	{
 		opcode_0A8C, opcode_0A8D, opcode_0A8E, opcode_0A8F, opcode_0A90,
@@ -160,7 +180,7 @@ namespace CLEO {
 
 	_OpcodeHandler *oldOpcodeHandlerTable;
 	_OpcodeHandler newOpcodeHandlerTable[329];
-	CustomOpcodeHandler extraOpcodeHandlers[100][300];
+	CustomOpcodeHandler extraOpcodeHandlers[0x8000];		// indexed directly by opcode
 
 	CBuildingPool		**buildingPool = nullptr;			// add for future CLEO releases
 	CVehiclePool			**vehiclePool = nullptr;
@@ -172,6 +192,7 @@ namespace CLEO {
 	inline CObjectPool& GetObjectPool() { return **objectPool; }
 
 	void(__thiscall * ProcessScript)(CRunningScript*);
+	void(__cdecl * ReinitialiseSwitchStatementData)() = nullptr;
 
 	const char * (__cdecl * GetUserDirectory)();
 	void(__cdecl * ChangeToUserDir)();
@@ -187,18 +208,45 @@ namespace CLEO {
 
 	void(__cdecl * SpawnCar)(DWORD);
 
+	// crash diagnostics, kept as cheap as possible (the name and offset are only figured out when needed)
 	WORD last_opcode = 0;
 	WORD last_custom_opcode = 0;
-	char last_thread[8] = "none";
 	CRunningScript * last_script;
-	ptrdiff_t last_off = -1;
+	BYTE * last_ip = nullptr;
+
+	// called for opcodes no plugin has registered: their operands can not be skipped, so the script is held at the opcode
+	OpcodeResult UnknownOpcode(CRunningScript *thread, WORD opcode)
+	{
+		static BYTE *reported_ip = nullptr;
+		auto cs = reinterpret_cast<CCustomScript *>(thread);
+		auto ip = thread->GetBytePointer() - sizeof(WORD);
+
+		if (ip != reported_ip)
+		{
+			char str[160];
+			sprintf(str, "Unknown opcode '%04X' in script '%s' at offset %d", opcode, thread->GetName(),
+				static_cast<int>(ip - thread->GetBasePointer()));
+			Error(str);
+			reported_ip = ip;
+		}
+
+		if (cs->IsCustom() && !thread->IsMission()) GetInstance().ScriptEngine.RemoveCustomScript(cs);
+		else thread->SetIp(ip);
+		return OR_INTERRUPT;
+	}
+
+	inline OpcodeResult CallExtraOpcodeHandler(CRunningScript *thread, WORD opcode)
+	{
+		if (auto handler = extraOpcodeHandlers[opcode]) return handler(thread);
+		return UnknownOpcode(thread, opcode);
+	}
 
 	// opcode handler for opcodes, defined by user with cleo api
 	OpcodeResult __fastcall extraOpcodeHandler(CRunningScript *thread, int dummy, unsigned short opcode)
 	{
 		last_custom_opcode = opcode;
 		last_script = thread;
-		return extraOpcodeHandlers[opcode % 100][opcode / 100 - 28](thread);
+		return CallExtraOpcodeHandler(thread, opcode);
 	}
 
 	// opcode handler for custom opcodes
@@ -209,36 +257,47 @@ namespace CLEO {
 		return customOpcodeHandlers[opcode - 0x0A8C](thread);
 	}
 
-	char ScriptExecutionLoop()
+	// vanilla opcodes go to the game's handlers, the CLEO ones are called directly
+	inline OpcodeResult DispatchOpcode(CCustomScript *thread, WORD opcode)
 	{
-		CCustomScript *thread;
-		OpcodeResult res;
+		thread->SetNotFlag((opcode & 0x8000) != 0);
+		opcode &= 0x7FFF;
+		last_opcode = opcode;
 
-		_asm mov thread, esi
+		if (opcode >= 0x0A8C)
+		{
+			last_custom_opcode = opcode;
+			if (opcode >= 0x0AF0) return CallExtraOpcodeHandler(thread, opcode);
+			return customOpcodeHandlers[opcode - 0x0A8C](thread);
+		}
+		return newOpcodeHandlerTable[opcode / 100](thread, opcode);
+	}
 
+	// runs commands of the custom script until one of them interrupts it, in place of the game's loop in CRunningScript::Process
+	void ScriptExecutionLoop(CRunningScript *thread)
+	{
+		auto cs = reinterpret_cast<CCustomScript *>(thread);
+		OpcodeResult res;
 		last_script = thread;
 
+		// 0871/0872 keep the switch being read in globals, the game resets them before each script's commands
+		ReinitialiseSwitchStatementData();
+
 		try
 		{
 			do
 			{
-				ptrdiff_t off = thread->IsCustom() ? thread->GetBytePointer() - thread->GetBasePointer() : thread->GetBytePointer() - scmBlock;
-				WORD opcode = thread->ReadDataWord();
-				last_opcode = opcode;
-				last_off = off;
-				memcpy(last_thread, thread->GetName(), 8);
-				thread->SetNotFlag((opcode & 0x8000) != 0);
-				opcode &= 0x7FFF;
-				res = newOpcodeHandlerTable[opcode / 100](thread, opcode);
+				last_ip = thread->GetBytePointer();
+				res = DispatchOpcode(cs, thread->ReadDataWord());
 			} while (res == OR_CONTINUE);
 		}
 		catch (const char * e)
 		{
-			char str[128];
-			sprintf(str, "%s encountered while parsing opcode '%04X' in script '%s'", e, last_opcode, last_thread);
+			char str[160];
+			sprintf(str, "%s encountered while parsing opcode '%04X' in script '%s' at offset %d",
+				e, last_opcode, thread->GetName(), static_cast<int>(last_ip - thread->GetBasePointer()));
 			Error(str);
 		}
-		return 0;
 	}
 
 	void CCustomOpcodeSystem::Inject(CCodeInjector& inj)
@@ -246,6 +305,7 @@ namespace CLEO {
 		TRACE("Injecting CustomOpcodeSystem...");
 		CGameVersionManager& gvm = GetInstance().VersionManager;
 		oldOpcodeHandlerTable = gvm.TranslateMemoryAddress(MA_OPCODE_HANDLER);
+		ReinitialiseSwitchStatementData = gvm.TranslateMemoryAddress(MA_REINIT_SWITCH_STATEMENT_DATA_FUNCTION);
 
 		// add handler for custom opcodes
 		oldOpcodeHandlerTable[27] = reinterpret_cast<_OpcodeHandler>(customOpcodeHandler);
@@ -262,6 +322,12 @@ namespace CLEO {
 		// fill the rest with default handler
 		std::fill(newOpcodeHandlerTable + 28, newOpcodeHandlerTable + 329, reinterpret_cast<_OpcodeHandler>(extraOpcodeHandler));
 
+		// core opcodes out of 0A8C-0AEF range are dispatched the same way as the plugins' ones
+		for (WORD i = 0; i <= CORE_OPCODES_LAST - CORE_OPCODES_FIRST; ++i)
+		{
+			if (coreOpcodeHandlers[i]) extraOpcodeHandlers[CORE_OPCODES_FIRST + i] = coreOpcodeHandlers[i];
+		}
+
 		FUNC_fopen = gvm.TranslateMemoryAddress(MA_FOPEN_FUNCTION);
 		FUNC_fclose = gvm.TranslateMemoryAddress(MA_FCLOSE_FUNCTION);
 		FUNC_fread = gvm.TranslateMemoryAddress(MA_FREAD_FUNCTION);
@@ -296,104 +362,108 @@ namespace CLEO {
 		else {
 			RadarBlips = gvm.TranslateMemoryAddress(MA_RADAR_BLIPS);
 		}
-
-		/*if(gvm.GetGameVersion() == GV_US10)
-		{
-		inj.Nop(0x469FB0, 0x469FFB - 0x469FB0);
-		inj.ReplaceFunction(ScriptExecutionLoop, 0x469FF6);
-		inj.Nop(0x469FF2, 0x469FFB - 0x469FF2);
-		inj.ReplaceFunction(ScriptExecutionLoop, 0x469FF6);
-		}*/
 	}
 
 	inline CRunningScript& operator>>(CRunningScript& thread, DWORD& uval)
 	{
-		GetScriptParams(&thread, 1);
-		uval = opcodeParams[0].dwParam;
+		SCRIPT_VAR param;
+		ReadScriptParams(&thread, &param, 1);
+		uval = param.dwParam;
 		return thread;
 	}
 
 	inline CRunningScript& operator<<(CRunningScript& thread, DWORD uval)
 	{
-		opcodeParams[0].dwParam = uval;
-		SetScriptParams(&thread, 1);
+		SCRIPT_VAR param;
+		param.dwParam = uval;
+		WriteScriptParam(&thread, param);
 		return thread;
 	}
 
 	inline CRunningScript& operator>>(CRunningScript& thread, int& nval)
 	{
-		GetScriptParams(&thread, 1);
-		nval = opcodeParams[0].nParam;
+		SCRIPT_VAR param;
+		ReadScriptParams(&thread, &param, 1);
+		nval = param.nParam;
 		return thread;
 	}
 
 	inline CRunningScript& operator<<(CRunningScript& thread, int nval)
 	{
-		opcodeParams[0].nParam = nval;
-		SetScriptParams(&thread, 1);
+		SCRIPT_VAR param;
+		param.nParam = nval;
+		WriteScriptParam(&thread, param);
 		return thread;
 	}
 
 	inline CRunningScript& operator>>(CRunningScript& thread, float& fval)
 	{
-		GetScriptParams(&thread, 1);
-		fval = opcodeParams[0].fParam;
+		SCRIPT_VAR param;
+		ReadScriptParams(&thread, &param, 1);
+		fval = param.fParam;
 		return thread;
 	}
 
 	inline CRunningScript& operator<<(CRunningScript& thread, float fval)
 	{
-		opcodeParams[0].fParam = fval;
-		SetScriptParams(&thread, 1);
+		SCRIPT_VAR param;
+		param.fParam = fval;
+		WriteScriptParam(&thread, param);
 		return thread;
 	}
 
 	inline CRunningScript& operator>>(CRunningScript& thread, CVector& vec)
 	{
-		GetScriptParams(&thread, 3);
-		vec.x = opcodeParams[0].fParam;
-		vec.y = opcodeParams[1].fParam;
-		vec.z = opcodeParams[2].fParam;
+		SCRIPT_VAR params[3];
+		ReadScriptParams(&thread, params, 3);
+		vec.x = params[0].fParam;
+		vec.y = params[1].fParam;
+		vec.z = params[2].fParam;
 		return thread;
 	}
 
 	inline CRunningScript& operator<<(CRunningScript& thread, const CVector& vec)
 	{
-		opcodeParams[0].fParam = vec.x;
-		opcodeParams[1].fParam = vec.y;
-		opcodeParams[2].fParam = vec.z;
-		SetScriptParams(&thread, 3);
+		SCRIPT_VAR params[3];
+		params[0].fParam = vec.x;
+		params[1].fParam = vec.y;
+		params[2].fParam = vec.z;
+		WriteScriptParams(&thread, params, 3);
 		return thread;
 	}
 
 	template<typename T>
 	inline CRunningScript& operator>>(CRunningScript& thread, T *& pval)
 	{
-		GetScriptParams(&thread, 1);
-		pval = reinterpret_cast<T *>(opcodeParams[0].pParam);
+		SCRIPT_VAR param;
+		ReadScriptParams(&thread, &param, 1);
+		pval = reinterpret_cast<T *>(param.pParam);
 		return thread;
 	}
 
 	template<typename T>
 	inline CRunningScript& operator<<(CRunningScript& thread, T *pval)
 	{
-		opcodeParams[0].pParam = (void *)(pval);
-		SetScriptParams(&thread, 1);
+		SCRIPT_VAR param;
+		param.pParam = (void *)(pval);
+		WriteScriptParam(&thread, param);
 		return thread;
 	}
 
 	inline CRunningScript& operator>>(CRunningScript& thread, memory_pointer& pval)
 	{
-		GetScriptParams(&thread, 1);
-		pval = opcodeParams[0].pParam;
+		SCRIPT_VAR param;
+		ReadScriptParams(&thread, &param, 1);
+		pval = param.pParam;
 		return thread;
 	}
 
 	template<typename T>
 	inline CRunningScript& operator<<(CRunningScript& thread, memory_pointer pval)
 	{
-		opcodeParams[0].pParam = pval;
-		SetScriptParams(&thread, 1);
+		SCRIPT_VAR param;
+		param.pParam = pval;
+		WriteScriptParam(&thread, param);
 		return thread;
 	}
 
@@ -407,15 +477,16 @@ namespace CLEO {
 
 		if (paramType >= DT_DWORD && paramType <= DT_LVAR_ARRAY) // process parameter as a pointer to string
 		{
-			GetScriptParams(thread, 1);
+			SCRIPT_VAR param;
+			ReadScriptParams(thread, &param, 1);
 
 			if (buf != nullptr)
 			{
-				strncpy(buf, opcodeParams[0].pcParam, size - 1);
+				strncpy(buf, param.pcParam, size - 1);
 				buf[size - 1] = '\0';
 			}
 
-			return opcodeParams[0].pcParam; // original string pointer
+			return param.pcParam; // original string pointer
 		}
 		else // process as scm string
 		{
@@ -427,170 +498,158 @@ namespace CLEO {
 				size = sizeof(result);
 			}
 
-			std::fill(buf, buf + size, '\0');
+			// the text is not terminated in the script code, copy just its characters
+			ScriptStringView text;
+			ReadScriptStringView(thread, text);
+			size_t count = min(text.length, size_t(size - 1));
+			if (count) memcpy(buf, text.data, count);
+			buf[count] = '\0';
+			return buf;
+		}
+	}
 
-			if (paramType == DT_VARLEN_STRING)
-			{
-				// prococess here as GetScriptStringParam can not obtain strings with lenght greater than 128
-				thread->IncPtr(1); // already read paramType
+	// read string parameter according to convention on strings, without copying (the characters are not null-terminated)
+	ScriptStringView readStringView(CRunningScript *thread)
+	{
+		ScriptStringView text = { nullptr, 0 };
 
-				BYTE length = *thread->GetBytePointer(); // as unsigned!
-				thread->IncPtr(1); // length
+		auto paramType = *thread->GetBytePointer();
+		if (!paramType) return text;
 
-				if (length > 0)
-				{
-					auto count = min(size, length);
-					memcpy(buf, thread->GetBytePointer(), count);
+		if (paramType >= DT_DWORD && paramType <= DT_LVAR_ARRAY) // process parameter as a pointer to string
+		{
+			SCRIPT_VAR param;
+			ReadScriptParams(thread, &param, 1);
+			text.data = param.pcParam;
+			text.length = text.data ? strlen(text.data) : 0;
+		}
+		else ReadScriptStringView(thread, text);
 
-					thread->IncPtr(length); // read text
-				}
-			}
-			else
-			{
-				GetScriptStringParam(thread, buf, size);
-			}
+		return text;
+	}
 
-			return buf;
-		}
+	// format strings of formatting and scanning opcodes, compiled once
+	static CFormatCache formatCache;
+	static CScanCache scanCache;
+
+	// copy of format text for the C runtime, limited the same way the format has always been read
+	static char *terminateFormat(const ScriptStringView& fmt, char *buf, size_t size)
+	{
+		size_t count = min(fmt.length, size - 1);
+		if (count) memcpy(buf, fmt.data, count);
+		buf[count] = '\0';
+		return buf;
 	}
 
 	// perform 'sprintf'-operation for parameters, passed through SCM
-	int format(CRunningScript *thread, char *str, size_t len, const char *format)
+	int format(CRunningScript *thread, char *str, size_t len, const ScriptStringView& fmt)
 	{
 		unsigned int written = 0;
-		const char *iter = format;
-		char bufa[256], fmtbufa[64], *fmta;
+		char bufa[256], fmtbufa[64];
 
-		while (*iter)
+		auto append = [&](const char *text, size_t count)
 		{
-			while (*iter && *iter != '%')
+			for (size_t i = 0; i < count; ++i)
 			{
-				if (written++ >= len)
-					return -1;
-				*str++ = *iter++;
+				if (written++ >= len) return false;
+				*str++ = text[i];
 			}
-			if (*iter == '%')
+			return true;
+		};
+		auto readParam = [&]()
+		{
+			ReadScriptParams(thread, opcodeParams, 1);
+			return opcodeParams[0];
+		};
+
+		auto& program = formatCache.Get(fmt.data ? fmt.data : "", min(fmt.length, size_t(MAX_STR_LEN - 1)));
+		for (auto& token : program.tokens)
+		{
+			const char *text = program.GetText(token);
+			int count;
+
+			if (token.kind == FormatToken::LITERAL)
 			{
-				if (iter[1] == '%')
+				if (!append(text, token.textLength)) return -1;
+				continue;
+			}
+
+			if (token.flags & FormatToken::DYNAMIC)
+			{
+				// width or precision from parameters, the star values are read before the value itself
+				if (token.kind == FormatToken::STRING || token.kind == FormatToken::CHAR || token.kind == FormatToken::POINTER)
 				{
-					if (written++ >= len)
-						return -1;
-					*str++ = '%'; /* "%%"->'%' */
-					iter += 2;
-					continue;
+					for (BYTE i = 0; i < token.numStars; ++i) readParam();
 				}
-
-				//get flags and width specifier
-				fmta = fmtbufa;
-				*fmta++ = *iter++;
-				while (*iter == '0' ||
-					   *iter == '+' ||
-					   *iter == '-' ||
-					   *iter == ' ' ||
-					   *iter == '*' ||
-					   *iter == '#')
+				else
 				{
-					if (*iter == '*')
-					{
-						char *buffiter = bufa;
-						//get width
-						GetScriptParams(thread, 1);
-						_itoa(opcodeParams[0].dwParam, buffiter, 10);
-						while (*buffiter)
-							*fmta++ = *buffiter++;
-					}
-					else
-						*fmta++ = *iter;
-					iter++;
+					BuildDynamicFormat(text, fmtbufa, [&]() { return readParam().nParam; });
+					text = fmtbufa;
 				}
+			}
+
+			switch (token.kind)
+			{
+			case FormatToken::STRING:
+			{
+				static const char none[] = "(null)";
+				const char *astr = readString(thread);
+				if (!astr) astr = none;
+				if (!append(astr, strlen(astr))) return -1;
+				break;
+			}
+
+			case FormatToken::CHAR:
+			{
+				if (written >= len)
+					return -1;
+				char c = (char)readParam().nParam;
+				append(&c, 1);
+				break;
+			}
 
-				//get immidiate width value
-				while (isdigit(*iter))
-					*fmta++ = *iter++;
+			case FormatToken::POINTER:
+			{
+				DWORD value = readParam().dwParam;
+				for (int i = 0; i < 8; ++i) bufa[i] = "0123456789ABCDEF"[value >> (28 - i * 4) & 0xF];
+				if (!append(bufa, 8)) return -1;
+				break;
+			}
 
-				//get precision
-				if (*iter == '.')
+			case FormatToken::INTEGER:
+			{
+				auto param = readParam();
+				count = FormatInteger(bufa, token, param.dwParam);
+				if (count < 0)
 				{
-					*fmta++ = *iter++;
-					if (*iter == '*')
-					{
-						char *buffiter = bufa;
-						GetScriptParams(thread, 1);
-						_itoa(opcodeParams[0].dwParam, buffiter, 10);
-						while (*buffiter)
-							*fmta++ = *buffiter++;
-					}
-					else
-						while (isdigit(*iter))
-							*fmta++ = *iter++;
+					sprintf(bufa, text, param.pParam);
+					count = static_cast<int>(strlen(bufa));
 				}
-				//get size
-				if (*iter == 'h' || *iter == 'l')
-					*fmta++ = *iter++;
+				if (!append(bufa, count)) return -1;
+				break;
+			}
 
-				switch (*iter)
-				{
-				case 's':
+			case FormatToken::REAL:
+			{
+				auto param = readParam();
+				count = FormatReal(bufa, token, param.fParam);
+				if (count < 0)
 				{
-					static const char none[] = "(null)";
-					const char *astr = readString(thread);
-					const char *striter = astr ? astr : none;
-					while (*striter)
-					{
-						if (written++ >= len)
-							return -1;
-						*str++ = *striter++;
-					}
-					iter++;
-					break;
+					sprintf(bufa, text, param.fParam);
+					count = static_cast<int>(strlen(bufa));
 				}
+				if (!append(bufa, count)) return -1;
+				break;
+			}
 
-				case 'c':
-					if (written++ >= len)
-						return -1;
-					GetScriptParams(thread, 1);
-					*str++ = (char)opcodeParams[0].nParam;
-					iter++;
-					break;
+			case FormatToken::GENERIC:
+				sprintf(bufa, text, readParam().pParam);
+				if (!append(bufa, strlen(bufa))) return -1;
+				break;
 
-				default:
-				{
-					/* For non wc types, use system sprintf and append to wide char output */
-					/* FIXME: for unrecognised types, should ignore % when printing */
-					char *bufaiter = bufa;
-					if (*iter == 'p' || *iter == 'P')
-					{
-						GetScriptParams(thread, 1);
-						sprintf(bufaiter, "%08X", opcodeParams[0].dwParam);
-					}
-					else
-					{
-						*fmta++ = *iter;
-						*fmta = '\0';
-						if (*iter == 'a' || *iter == 'A' ||
-							*iter == 'e' || *iter == 'E' ||
-							*iter == 'f' || *iter == 'F' ||
-							*iter == 'g' || *iter == 'G')
-						{
-							GetScriptParams(thread, 1);
-							sprintf(bufaiter, fmtbufa, opcodeParams[0].fParam);
-						}
-						else
-						{
-							GetScriptParams(thread, 1);
-							sprintf(bufaiter, fmtbufa, opcodeParams[0].pParam);
-						}
-					}
-					while (*bufaiter)
-					{
-						if (written++ >= len)
-							return -1;
-						*str++ = *bufaiter++;
-					}
-					iter++;
-					break;
-				}
-				}
+			case FormatToken::INCOMPLETE:
+				readParam();
+				break;
 			}
 		}
 		if (written >= len)
@@ -763,53 +822,71 @@ namespace CLEO {
 	{
 		return is_legacy_handle(hFile) ? legacy_fwrite(buf, size, 1, convert_handle_to_file(hFile)) : fwrite(buf, size, 1, convert_handle_to_file(hFile));
 	}
-	inline void flush_file(DWORD dwHandle)
+	void flush_file(DWORD dwHandle)
 	{
 		if (is_legacy_handle(dwHandle)) legacy_fflush(convert_handle_to_file(dwHandle));
 		else fflush(convert_handle_to_file(dwHandle));
 	}
 
-	/*inline void __impl_RetrieveScriptParam(SCRIPT_VAR*) { }
-	template<typename ..Params> inline void __impl_RetrieveScriptParam(SCRIPT_VAR *, unsigned&, Params&...);
-	template<typename Params> inline void __impl_RetrieveScriptParam(SCRIPT_VAR *, int&, Params&...);
-	template<typename Params> inline void __impl_RetrieveScriptParam(SCRIPT_VAR *, float&, Params&...);
-	template<typename ThisParam, typename Params> inline void __impl_RetrieveScriptParam(SCRIPT_VAR *, ThisParam *&, Params&...);
+	const size_t MANUAL_FLUSH_BUFFER_SIZE = 0x10000;
 
-	template<typename Params>
-	inline void __impl_RetrieveScriptParam(SCRIPT_VAR *var, unsigned& thisParam, Params&... restParams)
+	// parses flush mode after ';' of 0A9A mode, cutting it off the mode
+	FileFlushMode read_flush_mode(char *mode, FileFlushMode defaultMode)
 	{
-	thisParam = var->dwParam;
-	__impl_RetrieveScriptParam(var + 1, restParams...);
+		char *suffix = strchr(mode, ';');
+		if (!suffix) return defaultMode;
+		*suffix++ = '\0';
+		if (!_stricmp(suffix, "immediate")) return FLUSH_IMMEDIATE;
+		if (!_stricmp(suffix, "line")) return FLUSH_LINE;
+		if (!_stricmp(suffix, "block")) return FLUSH_BLOCK;
+		if (!_stricmp(suffix, "manual")) return FLUSH_MANUAL;
+		TRACE("Unknown flush mode '%s' of file, using default", suffix);
+		return defaultMode;
 	}
 
-	template<typename... Params>
-	inline void __impl_RetrieveScriptParam(SCRIPT_VAR *var, int& thisParam, Params&... restParams)
+	// whether data just written to the file has to be flushed; files not opened by 0A9A always are
+	bool flush_after_write(DWORD hFile, const void *data, size_t size)
 	{
-	thisParam = var->nParam;
-	__impl_RetrieveScriptParam(var + 1, restParams...);
+		auto& files = GetInstance().OpcodeSystem.m_hFiles;
+		auto it = files.find(hFile);
+		if (it == files.end()) return true;
+		switch (it->second.flushMode)
+		{
+		case FLUSH_IMMEDIATE: return true;
+		case FLUSH_LINE: return memchr(data, '\n', size) != nullptr;
+		default: return false;
+		}
 	}
 
-	template<typename... Params>
-	inline void __impl_RetrieveScriptParam(SCRIPT_VAR *var, float& thisParam, Params&... restParams)
+	void FlushScriptFiles(CRunningScript *thread)
 	{
-	thisParam = var->fParam;
-	__impl_RetrieveScriptParam(var + 1, restParams...);
+		for (auto& file : GetInstance().OpcodeSystem.m_hFiles)
+		{
+			if (file.second.owner != thread) continue;
+			if (file.second.flushMode != FLUSH_IMMEDIATE)
+			{
+				flush_file(file.first);
+				file.second.flushMode = FLUSH_IMMEDIATE; // nobody is left to flush it, so writes by other scripts go out at once
+			}
+			file.second.owner = nullptr; // the file stays open, but memory of the script may be reused
+		}
 	}
 
+	// read numeric parameters directly into typed variables
+	inline void __impl_RetrieveScriptParam(CRunningScript *) { }
+
 	template<typename ThisParam, typename... Params>
-	inline void __impl_RetrieveScriptParam(SCRIPT_VAR *var, ThisParam *& thisParam, Params&... restParams)
+	inline void __impl_RetrieveScriptParam(CRunningScript *thread, ThisParam& thisParam, Params&... restParams)
 	{
-	thisParam = reinterpret_cast<ThisParam *>(var->pParam);
-	__impl_RetrieveScriptParam(var + 1, restParams...);
+		*thread >> thisParam;
+		__impl_RetrieveScriptParam(thread, restParams...);
 	}
 
-
 	template<typename... Params>
-	inline void RetrieveScriptParams(CCustomScript *thread, Params&... params)
+	inline void RetrieveScriptParams(CRunningScript *thread, Params&... params)
 	{
-	GetScriptParams(thread, sizeof...(params));
-	__impl_RetrieveScriptParam(opcodeParams, params...);
-	}*/
+		__impl_RetrieveScriptParam(thread, params...);
+	}
 
 	inline void ThreadJump(CRunningScript *thread, int off)
 	{
@@ -818,102 +895,75 @@ namespace CLEO {
 
 	inline void SkipUnusedParameters(CRunningScript *thread)
 	{
-		while (*thread->GetBytePointer()) GetScriptParams(thread, 1);	// skip parameters
+		while (*thread->GetBytePointer()) SkipScriptParam(thread);	// skip parameters
 		thread->ReadDataByte();
 	}
 
-	struct ScmFunction
+	// call stacks of the scripts being in scm functions, the script keeps index + 1 of its stack (see GetScmFunction)
+	// released stacks keep their memory for the next scripts; the store is never destroyed, as scripts are deleted during static destruction too
+	struct ScmCallStackStore
 	{
-		unsigned short prevScmFunctionId, thisScmFunctionId;
-		BYTE *retnAddress;
-		SCRIPT_VAR savedTls[32];
-		std::list<std::string> stringParams; // texts with this scope lifetime
-		bool savedCondResult;
-		eLogicalOperation savedLogicalOp;
-		bool savedNotFlag;
-		static const size_t store_size = 0x400;
-		static ScmFunction *Store[store_size];
-		static size_t allocationPlace;			// contains an index of last allocated object
-
-		void *operator new(size_t size)
-		{
-			size_t start_search = allocationPlace;
-			while (Store[allocationPlace])	// find first unused position in store
-			{
-				if (++allocationPlace >= store_size) allocationPlace = 0;		// end of store reached
-				if (allocationPlace == start_search) throw std::bad_alloc();	// the store is filled up
-			}
-			ScmFunction *obj = reinterpret_cast<ScmFunction *>(::operator new(size));
-			Store[allocationPlace] = obj;
-			return obj;
-		}
-
-		void operator delete(void *mem)
-		{
-			Store[reinterpret_cast<ScmFunction *>(mem)->thisScmFunctionId] = nullptr;
-			::operator delete(mem);
-		}
+		std::vector<std::unique_ptr<ScmCallStack>> stacks;
+		std::vector<WORD> released;
+	};
 
-		ScmFunction(CRunningScript *thread) :
-			prevScmFunctionId(reinterpret_cast<CCustomScript*>(thread)->GetScmFunction())
-		{
-			auto cs = reinterpret_cast<CCustomScript*>(thread);
+	static ScmCallStackStore& GetScmCallStackStore()
+	{
+		static auto store = new ScmCallStackStore;
+		return *store;
+	}
 
-			// create snapshot of current scope
-			auto scope = cs->IsMission() ? missionLocals : cs->LocalVar;
-			std::copy(scope, scope + 32, savedTls);
-			savedCondResult = cs->bCondResult;
-			savedLogicalOp = cs->LogicalOp;
-			savedNotFlag = cs->NotFlag;
+	// nullptr if the script is not in any scm function
+	static ScmCallStack *FindScmCallStack(CRunningScript *thread)
+	{
+		auto& store = GetScmCallStackStore();
+		WORD id = reinterpret_cast<CCustomScript*>(thread)->GetScmFunction();
+		if (!id || id > store.stacks.size()) return nullptr;
+		auto stack = store.stacks[id - 1].get();
+		return stack->owner == thread ? stack : nullptr;	// the id may be left from the former script of the same memory
+	}
 
-			cs->bCondResult = false;
-			cs->LogicalOp = eLogicalOperation::NONE;
-			cs->NotFlag = false;
+	static ScmCallStack& AcquireScmCallStack(CRunningScript *thread)
+	{
+		if (auto stack = FindScmCallStack(thread)) return *stack;
 
-			cs->SetScmFunction(thisScmFunctionId = allocationPlace);
+		auto& store = GetScmCallStackStore();
+		WORD id;
+		if (!store.released.empty())
+		{
+			id = store.released.back();
+			store.released.pop_back();
 		}
-
-		void Return(CRunningScript *thread)
+		else
 		{
-			// restore parent scope's local variables
-			auto cs = reinterpret_cast<CCustomScript*>(thread);
-			std::copy(savedTls, savedTls + 32, cs->IsMission() ? missionLocals : cs->LocalVar);
-
-			// process conditional result of just ended function in parent scope
-			bool condResult = cs->bCondResult;
-			if (savedNotFlag) condResult = !condResult;
-
-			if (savedLogicalOp >= eLogicalOperation::AND_2 && savedLogicalOp < eLogicalOperation::AND_END)
-			{
-				cs->bCondResult = savedCondResult && condResult;
-				cs->LogicalOp = --savedLogicalOp;
-			}
-			else if(savedLogicalOp >= eLogicalOperation::OR_2 && savedLogicalOp < eLogicalOperation::OR_END)
-			{
-				cs->bCondResult = savedCondResult || condResult;
-				cs->LogicalOp = --savedLogicalOp;
-			}
-			else // eLogicalOperation::NONE
-			{
-				cs->bCondResult = condResult;
-				cs->LogicalOp = savedLogicalOp;
-			}
-
-			cs->SetIp(retnAddress);
-			cs->SetScmFunction(prevScmFunctionId);
+			if (store.stacks.size() >= 0xFFFF) throw std::bad_alloc();
+			store.stacks.emplace_back(new ScmCallStack);
+			id = static_cast<WORD>(store.stacks.size());
 		}
-	};
 
-	ScmFunction *ScmFunction::Store[store_size] = { /* default initializer - nullptr */ };
-	size_t ScmFunction::allocationPlace = 0;
+		auto stack = store.stacks[id - 1].get();
+		stack->owner = thread;
+		reinterpret_cast<CCustomScript*>(thread)->SetScmFunction(id);
+		return *stack;
+	}
 
-	void ResetScmFunctionStore()
+	void ReleaseScmCallStack(CRunningScript *thread)
 	{
-		for each(ScmFunction *scmFunc in ScmFunction::Store)
+		if (auto stack = FindScmCallStack(thread))
 		{
-			if (scmFunc) delete scmFunc;
+			auto& store = GetScmCallStackStore();
+			WORD id = reinterpret_cast<CCustomScript*>(thread)->GetScmFunction();
+			stack->Clear();
+			store.released.push_back(id);
 		}
-		ScmFunction::allocationPlace = 0;
+		reinterpret_cast<CCustomScript*>(thread)->SetScmFunction(0);
+	}
+
+	void ResetScmFunctionStore()
+	{
+		auto& store = GetScmCallStackStore();
+		store.stacks.clear();
+		store.released.clear();
 	}
 
 	/************************************************************************/
@@ -923,7 +973,7 @@ namespace CLEO {
 	//0A8C=4,write_memory %1d% size %2d% value %3d% virtual_protect %4d%
 	OpcodeResult __stdcall opcode_0A8C(CRunningScript *thread)
 	{
-		GetScriptParams(thread, 4);
+		ReadScriptParams(thread, opcodeParams, 4);
 		void *Address = opcodeParams[0].pParam;
 		DWORD size = opcodeParams[1].dwParam;
 		DWORD value = opcodeParams[2].dwParam;
@@ -946,7 +996,7 @@ namespace CLEO {
 	//0A8D=4,%4d% = read_memory %1d% size %2d% virtual_protect %3d%
 	OpcodeResult __stdcall opcode_0A8D(CRunningScript *thread)
 	{
-		GetScriptParams(thread, 3);
+		ReadScriptParams(thread, opcodeParams, 3);
 		//DWORD value;
 		void *Address = opcodeParams[0].pParam;
 		DWORD size = opcodeParams[1].dwParam;
@@ -969,43 +1019,43 @@ namespace CLEO {
 			TRACE("[0A8D] Unallowed size %u", size);
 		}
 
-		SetScriptParams(thread, 1);
+		WriteScriptParams(thread, opcodeParams, 1);
 		return OR_CONTINUE;
 	}
 
 	//0A8E=3,%3d% = %1d% + %2d% ; int
 	OpcodeResult __stdcall opcode_0A8E(CRunningScript *thread)
 	{
-		GetScriptParams(thread, 2);
+		ReadScriptParams(thread, opcodeParams, 2);
 		opcodeParams[0].nParam += opcodeParams[1].nParam;
-		SetScriptParams(thread, 1);
+		WriteScriptParams(thread, opcodeParams, 1);
 		return OR_CONTINUE;
 	}
 
 	//0A8F=3,%3d% = %1d% - %2d% ; int
 	OpcodeResult __stdcall opcode_0A8F(CRunningScript *thread)
 	{
-		GetScriptParams(thread, 2);
+		ReadScriptParams(thread, opcodeParams, 2);
 		opcodeParams[0].nParam -= opcodeParams[1].nParam;
-		SetScriptParams(thread, 1);
+		WriteScriptParams(thread, opcodeParams, 1);
 		return OR_CONTINUE;
 	}
 
 	//0A90=3,%3d% = %1d% * %2d% ; int
 	OpcodeResult __stdcall opcode_0A90(CRunningScript *thread)
 	{
-		GetScriptParams(thread, 2);
+		ReadScriptParams(thread, opcodeParams, 2);
 		opcodeParams[0].nParam *= opcodeParams[1].nParam;
-		SetScriptParams(thread, 1);
+		WriteScriptParams(thread, opcodeParams, 1);
 		return OR_CONTINUE;
 	}
 
 	//0A91=3,%3d% = %1d% / %2d% ; int
 	OpcodeResult __stdcall opcode_0A91(CRunningScript *thread)
 	{
-		GetScriptParams(thread, 2);
+		ReadScriptParams(thread, opcodeParams, 2);
 		opcodeParams[0].nParam /= opcodeParams[1].nParam;
-		SetScriptParams(thread, 1);
+		WriteScriptParams(thread, opcodeParams, 1);
 		return OR_CONTINUE;
 	}
 
@@ -1128,8 +1178,11 @@ namespace CLEO {
 		{
 			// string param
 			char buf[MAX_PATH];
-			std::fill(buf, buf + sizeof(buf), '\0');
-			GetScriptStringParam(thread, buf, (BYTE)sizeof(buf));
+			ScriptStringView path;
+			ReadScriptStringView(thread, path);
+			size_t count = min(path.length, sizeof(buf) - 1);
+			if (count) memcpy(buf, path.data, count);
+			buf[count] = '\0';
 			_chdir(buf);
 		}
 		return OR_CONTINUE;
@@ -1156,17 +1209,25 @@ namespace CLEO {
 				char strParam[4];
 			} param;
 			*thread >> param.uParam;
-			strcpy(mode, param.strParam);
+			memcpy(mode, param.strParam, sizeof(param.strParam));
+			mode[sizeof(param.strParam)] = '\0';
 		}
 		else
 		{
 			// string param
-			GetScriptStringParam(thread, mode, sizeof(mode));
+			ReadScriptStringParam(thread, mode, sizeof(mode));
 		}
 
+		// writes of CLEO 4 scripts are buffered unless asked otherwise, CLEO 3 ones have always been flushed at once
+		// files opened for update are not, as reading right after a write needs the data flushed first
+		bool buffered = cs->IsCustom() && cs->GetCompatibility() >= CLEO_VER_4_MIN && !strchr(mode, '+');
+		auto flushMode = read_flush_mode(mode, buffered ? FLUSH_BLOCK : FLUSH_IMMEDIATE);
+
 		if (auto hfile = open_file(fname, mode, bLegacyMode))
 		{
-			GetInstance().OpcodeSystem.m_hFiles.insert(hfile);
+			if (flushMode == FLUSH_MANUAL && !is_legacy_handle(hfile))
+				setvbuf(convert_handle_to_file(hfile), nullptr, _IOFBF, MANUAL_FLUSH_BUFFER_SIZE);
+			GetInstance().OpcodeSystem.m_hFiles[hfile] = ScriptFile{ thread, flushMode };
 
 			*thread << hfile;
 			SetScriptCondResult(thread, true);
@@ -1212,7 +1273,7 @@ namespace CLEO {
 		DWORD size;
 		void *buf;
 		*thread >> hFile >> size;
-		buf = GetScriptParamPointer(thread);
+		buf = ReadScriptParamPointer(thread);
 		if (convert_handle_to_file(hFile)) read_file(buf, size, 1, hFile);
 		return OR_CONTINUE;
 	}
@@ -1224,11 +1285,11 @@ namespace CLEO {
 		DWORD size;
 		const void *buf;
 		*thread >> hFile >> size;
-		buf = GetScriptParamPointer(thread);
+		buf = ReadScriptParamPointer(thread);
 		if (convert_handle_to_file(hFile))
 		{
 			write_file(buf, size, 1, hFile);
-			flush_file(hFile);
+			if (flush_after_write(hFile, buf, size)) flush_file(hFile);
 		}
 		return OR_CONTINUE;
 	}
@@ -1300,7 +1361,7 @@ namespace CLEO {
 		void(*func)();
 		DWORD numParams;
 		DWORD stackAlign;
-		*thread >> func >> numParams >> stackAlign;
+		RetrieveScriptParams(thread, func, numParams, stackAlign);
 		if (numParams > (sizeof(arguments) / sizeof(SCRIPT_VAR))) numParams = sizeof(arguments) / sizeof(SCRIPT_VAR);
 		stackAlign *= 4;
 		SCRIPT_VAR	*arguments_end = arguments + numParams;
@@ -1324,7 +1385,7 @@ namespace CLEO {
 			case DT_LVAR_STRING:
 			case DT_VAR_TEXTLABEL:
 			case DT_LVAR_TEXTLABEL:
-				arg->pParam = GetScriptParamPointer(thread);
+				arg->pParam = ReadScriptParamPointer(thread);
 				break;
 			case DT_VARLEN_STRING:
 			case DT_TEXTLABEL:
@@ -1360,7 +1421,7 @@ namespace CLEO {
 		void *struc;
 		DWORD numParams;
 		DWORD stackAlign;
-		*thread >> func >> struc >> numParams >> stackAlign;
+		RetrieveScriptParams(thread, func, struc, numParams, stackAlign);
 		if (numParams > (sizeof(arguments) / sizeof(SCRIPT_VAR))) numParams = sizeof(arguments) / sizeof(SCRIPT_VAR);
 		stackAlign *= 4;
 		SCRIPT_VAR *arguments_end = arguments + numParams;
@@ -1384,7 +1445,7 @@ namespace CLEO {
 			case DT_LVAR_STRING:
 			case DT_VAR_TEXTLABEL:
 			case DT_LVAR_TEXTLABEL:
-				arg->pParam = GetScriptParamPointer(thread);
+				arg->pParam = ReadScriptParamPointer(thread);
 				break;
 			case DT_VARLEN_STRING:
 			case DT_TEXTLABEL:
@@ -1420,7 +1481,7 @@ namespace CLEO {
 		void(*func)();
 		DWORD numParams;
 		DWORD stackAlign;
-		*thread >> func >> numParams >> stackAlign;
+		RetrieveScriptParams(thread, func, numParams, stackAlign);
 		if (numParams > (sizeof(arguments) / sizeof(SCRIPT_VAR))) numParams = sizeof(arguments) / sizeof(SCRIPT_VAR);
 		stackAlign *= 4;
 		SCRIPT_VAR	*	arguments_end = arguments + numParams;
@@ -1443,7 +1504,7 @@ namespace CLEO {
 			case DT_LVAR_STRING:
 			case DT_VAR_TEXTLABEL:
 			case DT_LVAR_TEXTLABEL:
-				arg->pParam = GetScriptParamPointer(thread);
+				arg->pParam = ReadScriptParamPointer(thread);
 				break;
 			case DT_VARLEN_STRING:
 			case DT_TEXTLABEL:
@@ -1484,7 +1545,7 @@ namespace CLEO {
 		void *struc;
 		DWORD numParams;
 		DWORD stackAlign;
-		*thread >> func >> struc >> numParams >> stackAlign;
+		RetrieveScriptParams(thread, func, struc, numParams, stackAlign);
 		if (numParams > (sizeof(arguments) / sizeof(SCRIPT_VAR))) numParams = sizeof(arguments) / sizeof(SCRIPT_VAR);
 		stackAlign *= 4;
 		SCRIPT_VAR	*arguments_end = arguments + numParams;
@@ -1508,7 +1569,7 @@ namespace CLEO {
 			case DT_LVAR_STRING:
 			case DT_VAR_TEXTLABEL:
 			case DT_LVAR_TEXTLABEL:
-				arg->pParam = GetScriptParamPointer(thread);
+				arg->pParam = ReadScriptParamPointer(thread);
 				break;
 			case DT_VARLEN_STRING:
 			case DT_TEXTLABEL:
@@ -1634,88 +1695,30 @@ namespace CLEO {
 
 		*thread >> label >> nParams;
 
-		ScmFunction* scmFunc = new ScmFunction(thread);
-		
-		static SCRIPT_VAR arguments[32];
-		SCRIPT_VAR* locals = thread->IsMission() ? missionLocals : thread->GetVarPtr();
-		SCRIPT_VAR* localsEnd = locals + 32;
-		SCRIPT_VAR* storedLocals = scmFunc->savedTls;
-
-		// collect arguments
-		for (DWORD i = 0; i < min(nParams, 32); i++)
-		{
-			SCRIPT_VAR* arg = arguments + i;
-				
-			switch (*thread->GetBytePointer())
-			{
-			case DT_FLOAT:
-			case DT_DWORD:
-			case DT_WORD:
-			case DT_BYTE:
-			case DT_VAR:
-			case DT_LVAR:
-			case DT_VAR_ARRAY:
-			case DT_LVAR_ARRAY:
-				*thread >> arg->dwParam;
-				break;
-
-			case DT_VAR_STRING:
-			case DT_LVAR_STRING:
-			case DT_VAR_TEXTLABEL:
-			case DT_LVAR_TEXTLABEL:
-				arg->pParam = GetScriptParamPointer(thread);
-				if (arg->pParam >= locals && arg->pParam < localsEnd) // correct scoped variable's pointer
-				{
-					arg->dwParam -= (DWORD)locals;
-					arg->dwParam += (DWORD)storedLocals;
-				}
-				break;
-
-			case DT_STRING:
-			case DT_TEXTLABEL:
-			case DT_VARLEN_STRING:
-				scmFunc->stringParams.emplace_back(readString(thread)); // those texts exists in script code, but without terminator character. Copy is necessary
-				arg->pcParam = (char*)scmFunc->stringParams.back().c_str();
-				break;
-			}
-		}
-
-		// skip unused args
-		if (nParams > 32) 
-			GetScriptParams(thread, nParams - 32);
-
-		// all areguments read
-		scmFunc->retnAddress = thread->GetBytePointer();
-
-		// pass arguments as new scope local variables
-		memcpy(locals, arguments, nParams * sizeof(SCRIPT_VAR));
-
-		// initialize rest of new scope local variables
+		// locals used by the function, as found by the verifier
 		auto cs = reinterpret_cast<CCustomScript*>(thread);
-		if (cs->IsCustom() && cs->GetCompatibility() >= CLEO_VER_4_MIN) // CLEO 3 did not initialised local variables
-		{
-			for (DWORD i = nParams; i < 32; i++)
-			{
-				cs->SetIntVar(i, 0); // fill with zeros
-			}
-		}
+		DWORD numLocals = NUM_FUNCTION_LOCALS;
+		if (cs->IsCustom() && label < 0 && cs->GetCodeIndex()) numLocals = cs->GetCodeIndex()->GetFunctionLocals(-label);
 
-		// jump to label
-		ThreadJump(thread, label);
+		// CLEO 3 did not initialise local variables
+		bool clearLocals = cs->IsCustom() && cs->GetCompatibility() >= CLEO_VER_4_MIN;
+		CallScmFunction(thread, AcquireScmCallStack(thread), label, nParams, numLocals, clearLocals);
 		return OR_CONTINUE;
 	}
 
 	//0AB2=-1,ret
 	OpcodeResult __stdcall opcode_0AB2(CRunningScript *thread)
 	{
-		ScmFunction *scmFunc = ScmFunction::Store[reinterpret_cast<CCustomScript*>(thread)->GetScmFunction()];
-		DWORD nRetParams;
-		*thread >> nRetParams;
-		if (nRetParams) GetScriptParams(thread, nRetParams);
-		scmFunc->Return(thread);
-		if (nRetParams) SetScriptParams(thread, nRetParams);
-		SkipUnusedParameters(thread);
-		delete scmFunc;
+		auto stack = FindScmCallStack(thread);
+		if (!stack || stack->Empty())
+		{
+			TRACE("[0AB2] Return without scm function call in script '%s'", thread->GetName());
+			SkipUnusedParameters(thread);
+			return OR_CONTINUE;
+		}
+
+		ReturnFromScmFunction(thread, *stack);
+		if (stack->Empty()) ReleaseScmCallStack(thread);
 		return OR_CONTINUE;
 	}
 
@@ -1725,7 +1728,9 @@ namespace CLEO {
 		DWORD	varId,
 			value;
 		*thread >> varId >> value;
-		GetInstance().ScriptEngine.CleoVariables[varId].dwParam = value;
+		auto& engine = GetInstance().ScriptEngine;
+		if (varId < NUM_CLEO_VARIABLES) engine.CleoVariables[varId].dwParam = value;
+		else engine.GlobalVars.Ids.Set(varId, value);
 		return OR_CONTINUE;
 	}
 
@@ -1734,7 +1739,8 @@ namespace CLEO {
 	{
 		DWORD varId;
 		*thread >> varId;
-		*thread << GetInstance().ScriptEngine.CleoVariables[varId].dwParam;
+		auto& engine = GetInstance().ScriptEngine;
+		*thread << (varId < NUM_CLEO_VARIABLES ? engine.CleoVariables[varId].dwParam : engine.GlobalVars.Ids.Get(varId));
 		return OR_CONTINUE;
 	}
 
@@ -1787,7 +1793,7 @@ namespace CLEO {
 		}
 		else
 		{
-			GetScriptParams(thread, 3);
+			ReadScriptParams(thread, opcodeParams, 3);
 			SetScriptCondResult(thread, false);
 		}
 
@@ -1952,7 +1958,7 @@ namespace CLEO {
 	//0AC7=2,%2d% = var %1d% offset
 	OpcodeResult __stdcall opcode_0AC7(CRunningScript *thread)
 	{
-		*thread << GetScriptParamPointer(thread);
+		*thread << ReadScriptParamPointer(thread);
 		return OR_CONTINUE;
 	}
 
@@ -2023,9 +2029,8 @@ namespace CLEO {
 	//0ACE=-1,show_formatted_text_box %1d%
 	OpcodeResult __stdcall opcode_0ACE(CRunningScript *thread)
 	{
-		char fmt[MAX_STR_LEN];
 		char text[MAX_STR_LEN];
-		readString(thread, fmt, sizeof(fmt));
+		auto fmt = readStringView(thread);
 		format(thread, text, sizeof(text), fmt);
 		PrintHelp(text);
 		SkipUnusedParameters(thread);
@@ -2035,9 +2040,9 @@ namespace CLEO {
 	//0ACF=-1,show_formatted_styled_text %1d% time %2d% style %3d%
 	OpcodeResult __stdcall opcode_0ACF(CRunningScript *thread)
 	{
-		char fmt[MAX_STR_LEN]; char text[MAX_STR_LEN];
+		char text[MAX_STR_LEN];
 		DWORD time, style;
-		readString(thread, fmt, sizeof(fmt));
+		auto fmt = readStringView(thread);
 		*thread >> time >> style;
 		format(thread, text, sizeof(text), fmt);
 		PrintBig(text, time, style);
@@ -2048,9 +2053,9 @@ namespace CLEO {
 	//0AD0=-1,show_formatted_text_lowpriority %1d% time %2d%
 	OpcodeResult __stdcall opcode_0AD0(CRunningScript *thread)
 	{
-		char fmt[MAX_STR_LEN]; char text[MAX_STR_LEN];
+		char text[MAX_STR_LEN];
 		DWORD time;
-		readString(thread, fmt, sizeof(fmt));
+		auto fmt = readStringView(thread);
 		*thread >> time;
 		format(thread, text, sizeof(text), fmt);
 		Print(text, time);
@@ -2061,9 +2066,9 @@ namespace CLEO {
 	//0AD1=-1,show_formatted_text_highpriority %1d% time %2d%
 	OpcodeResult __stdcall opcode_0AD1(CRunningScript *thread)
 	{
-		char fmt[MAX_STR_LEN]; char text[MAX_STR_LEN];
+		char text[MAX_STR_LEN];
 		DWORD time;
-		readString(thread, fmt, sizeof(fmt));
+		auto fmt = readStringView(thread);
 		*thread >> time;
 		format(thread, text, sizeof(text), fmt);
 		PrintNow(text, time);
@@ -2095,12 +2100,12 @@ namespace CLEO {
 	//0AD3=-1,string %1d% format %2d% ...
 	OpcodeResult __stdcall opcode_0AD3(CRunningScript *thread)
 	{
-		char fmt[MAX_STR_LEN], *dst;
+		char *dst;
 
 		if (*thread->GetBytePointer() >= 1 && *thread->GetBytePointer() <= 8) *thread >> dst;
-		else dst = &GetScriptParamPointer(thread)->cParam;
+		else dst = &ReadScriptParamPointer(thread)->cParam;
 
-		readString(thread, fmt, sizeof(fmt));
+		auto fmt = readStringView(thread);
 		format(thread, dst, -1, fmt);
 		SkipUnusedParameters(thread);
 		return OR_CONTINUE;
@@ -2109,12 +2114,11 @@ namespace CLEO {
 	//0AD4=-1,%3d% = scan_string %1d% format %2d%  //IF and SET
 	OpcodeResult __stdcall opcode_0AD4(CRunningScript *thread)
 	{
-		char fmt[MAX_STR_LEN], *format, *src;
-		src = readString(thread);
-		format = readString(thread, fmt, sizeof(fmt));
+		char *src = readString(thread);
+		auto fmt = readStringView(thread);
 
 		size_t cExParams = 0;
-		int *result = (int *)GetScriptParamPointer(thread);
+		int *result = (int *)ReadScriptParamPointer(thread);
 		SCRIPT_VAR *ExParams[35];
 
 		// read extra params
@@ -2122,12 +2126,34 @@ namespace CLEO {
 		{
 			if (*thread->GetBytePointer())
 			{
-				ExParams[i] = GetScriptParamPointer(thread);
+				ExParams[i] = ReadScriptParamPointer(thread);
 				cExParams++;
 			}
 			else ExParams[i] = nullptr;
 		}
 		thread->IncPtr();
+
+		auto& program = scanCache.Get(fmt.data ? fmt.data : "", min(fmt.length, size_t(MAX_STR_LEN - 1)));
+		int scanned = CScanProgram::UNDECIDED;
+		if (src && program.CanScan(cExParams))
+		{
+			// ambiguous input is scanned again by sscanf, so the source (with its terminator) must not be overwritten by the first pass
+			size_t length = strlen(src);
+			if (!program.MayWrite(reinterpret_cast<void *const *>(ExParams), length, src, src + length + 1))
+			{
+				const char *input = src;
+				scanned = program.Scan(input, input + length, reinterpret_cast<void *const *>(ExParams));
+			}
+		}
+		if (scanned != CScanProgram::UNDECIDED)
+		{
+			*result = scanned;
+			SetScriptCondResult(thread, cExParams == *result);
+			return OR_CONTINUE;
+		}
+
+		char format[MAX_STR_LEN];
+		terminateFormat(fmt, format, sizeof(format));
 		*result = sscanf(src, format,
 						 /* extra parameters (will be aligned automatically, but the limit of 35 elements maximum exists) */
 						 ExParams[0], ExParams[1], ExParams[2], ExParams[3], ExParams[4], ExParams[5],
@@ -2146,7 +2172,7 @@ namespace CLEO {
 	{
 		DWORD hFile;
 		int seek, origin;
-		*thread >> hFile >> seek >> origin;
+		RetrieveScriptParams(thread, hFile, seek, origin);
 		if (convert_handle_to_file(hFile)) SetScriptCondResult(thread, fseek(convert_handle_to_file(hFile), seek, origin) == 0);
 		else SetScriptCondResult(thread, false);
 		return OR_CONTINUE;
@@ -2172,7 +2198,7 @@ namespace CLEO {
 		DWORD size;
 		*thread >> hFile;
 		if (*thread->GetBytePointer() >= 1 && *thread->GetBytePointer() <= 8) *thread >> buf;
-		else buf = (char *)GetScriptParamPointer(thread);
+		else buf = (char *)ReadScriptParamPointer(thread);
 		*thread >> size;
 		if (convert_handle_to_file(hFile)) SetScriptCondResult(thread, fgets(buf, size, convert_handle_to_file(hFile)) == buf);
 		else SetScriptCondResult(thread, false);
@@ -2186,8 +2212,9 @@ namespace CLEO {
 		*thread >> hFile;
 		if (FILE * file = convert_handle_to_file(hFile))
 		{
-			SetScriptCondResult(thread, fputs(readString(thread), file) > 0);
-			fflush(file);
+			const char *text = readString(thread);
+			SetScriptCondResult(thread, fputs(text, file) > 0);
+			if (flush_after_write(hFile, text, strlen(text))) fflush(file);
 		}
 		else {
 			SetScriptCondResult(thread, false);
@@ -2198,15 +2225,15 @@ namespace CLEO {
 	//0AD9=-1,write_formated_text %2d% to_file %1d%
 	OpcodeResult __stdcall opcode_0AD9(CRunningScript *thread)
 	{
-		char fmt[MAX_STR_LEN]; char text[MAX_STR_LEN];
+		char text[MAX_STR_LEN];
 		DWORD hFile;
 		*thread >> hFile;
-		readString(thread, fmt, sizeof(fmt));
+		auto fmt = readStringView(thread);
 		format(thread, text, sizeof(text), fmt);
 		if (FILE * file = convert_handle_to_file(hFile))
 		{
 			fputs(text, file);
-			fflush(file);
+			if (flush_after_write(hFile, text, strlen(text))) fflush(file);
 		}
 		SkipUnusedParameters(thread);
 		return OR_CONTINUE;
@@ -2217,19 +2244,36 @@ namespace CLEO {
 	{
 		DWORD hFile;
 		*thread >> hFile;
-		char *fmt = readString(thread);
-		int *result = (int *)GetScriptParamPointer(thread);
-
+		auto fmt = readStringView(thread);
+		int *result = (int *)ReadScriptParamPointer(thread);
 
 		size_t cExParams = 0;
 		SCRIPT_VAR *ExParams[35];
 		// read extra params
-		while (*thread->GetBytePointer()) ExParams[cExParams++] = GetScriptParamPointer(thread);
+		while (*thread->GetBytePointer())
+		{
+			auto param = ReadScriptParamPointer(thread);
+			if (cExParams < 35) ExParams[cExParams] = param;
+			cExParams++;
+		}
 		thread->IncPtr();
 
-		if (FILE *file = convert_handle_to_file(hFile))
+		auto& program = scanCache.Get(fmt.data ? fmt.data : "", min(fmt.length, size_t(MAX_STR_LEN - 1)));
+		FILE *file = convert_handle_to_file(hFile);
+		int scanned = CScanProgram::UNDECIDED;
+		if (file && !is_legacy_handle(hFile) && program.CanScan(min(cExParams, size_t(35))))
 		{
-			*result = fscanf(file, fmt,
+			// locked once for the whole scan, characters are read without locking
+			_lock_file(file);
+			scanned = program.Scan(file, reinterpret_cast<void *const *>(ExParams));
+			_unlock_file(file);
+		}
+		if (scanned != CScanProgram::UNDECIDED) *result = scanned;
+		else if (file)
+		{
+			char format[MAX_STR_LEN];
+			terminateFormat(fmt, format, sizeof(format));
+			*result = fscanf(file, format,
 							 /* extra parameters (will be aligned automatically, but the limit of 35 elements maximum exists) */
 							 ExParams[0], ExParams[1], ExParams[2], ExParams[3], ExParams[4], ExParams[5],
 							 ExParams[6], ExParams[7], ExParams[8], ExParams[9], ExParams[10], ExParams[11],
@@ -2258,7 +2302,7 @@ namespace CLEO {
 			model = reinterpret_cast<CVehicleModelInfo*>(Models[mi]);
 		}
 		if (*thread->GetBytePointer() >= 1 && *thread->GetBytePointer() <= 8) *thread >> buf;
-		else buf = (char *)GetScriptParamPointer(thread);
+		else buf = (char *)ReadScriptParamPointer(thread);
 		memcpy(buf, model->m_szGameName, 8);
 		return OR_CONTINUE;
 	}
@@ -2295,7 +2339,7 @@ namespace CLEO {
 		if (*thread->GetBytePointer() >= 1 && *thread->GetBytePointer() <= 8)
 			*thread << GetInstance().TextManager.Get(gxt);
 		else
-			strcpy((char *)GetScriptParamPointer(thread), GetInstance().TextManager.Get(gxt));
+			strcpy((char *)ReadScriptParamPointer(thread), GetInstance().TextManager.Get(gxt));
 		return OR_CONTINUE;
 	}
 
@@ -2326,7 +2370,7 @@ namespace CLEO {
 		DWORD next, pass_deads;
 		static DWORD stat_last_found = 0;
 		auto& pool = GetPedPool();
-		*thread >> center >> radius >> next >> pass_deads;
+		RetrieveScriptParams(thread, center, radius, next, pass_deads);
 
 		DWORD& last_found = reinterpret_cast<CCustomScript *>(thread)->IsCustom() ?
 			reinterpret_cast<CCustomScript *>(thread)->GetLastSearchPed() :
@@ -2369,7 +2413,7 @@ namespace CLEO {
 		static DWORD stat_last_found = 0;
 
 		auto& pool = GetVehiclePool();
-		*thread >> center >> radius >> next >> pass_wrecked;
+		RetrieveScriptParams(thread, center, radius, next, pass_wrecked);
 
 		DWORD& last_found = reinterpret_cast<CCustomScript*>(thread)->IsCustom() ?
 			reinterpret_cast<CCustomScript *>(thread)->GetLastSearchVehicle() :
@@ -2410,7 +2454,7 @@ namespace CLEO {
 		DWORD next;
 		static DWORD stat_last_found = 0;
 		auto& pool = GetObjectPool();
-		*thread >> center >> radius >> next;
+		RetrieveScriptParams(thread, center, radius, next);
 
 		auto cs = reinterpret_cast<CCustomScript *>(thread);
 		DWORD& last_found = cs->IsCustom() ? cs->GetLastSearchObject() : stat_last_found;
@@ -2476,7 +2520,7 @@ namespace CLEO {
 			case DT_LVAR_STRING:
 			case DT_VAR_STRING_ARRAY:
 			case DT_LVAR_STRING_ARRAY:
-				str = (char*)GetScriptParamPointer(thread);
+				str = (char*)ReadScriptParamPointer(thread);
 				memcpy(str, ffd.cFileName, 16);
 				str[15] = '\0';
 				break;
@@ -2484,7 +2528,7 @@ namespace CLEO {
 			case DT_LVAR_TEXTLABEL:
 			case DT_VAR_TEXTLABEL_ARRAY:
 			case DT_LVAR_TEXTLABEL_ARRAY:
-				str = (char*)GetScriptParamPointer(thread);
+				str = (char*)ReadScriptParamPointer(thread);
 				memcpy(str, ffd.cFileName, 8);
 				str[7] = '\0';
 				break;
@@ -2520,7 +2564,7 @@ namespace CLEO {
 			case DT_LVAR_STRING:
 			case DT_VAR_STRING_ARRAY:
 			case DT_LVAR_STRING_ARRAY:
-				str = (char*)GetScriptParamPointer(thread);
+				str = (char*)ReadScriptParamPointer(thread);
 				memcpy(str, ffd.cFileName, 16);
 				str[15] = '\0';
 				break;
@@ -2528,7 +2572,7 @@ namespace CLEO {
 			case DT_LVAR_TEXTLABEL:
 			case DT_VAR_TEXTLABEL_ARRAY:
 			case DT_LVAR_TEXTLABEL_ARRAY:
-				str = (char*)GetScriptParamPointer(thread);
+				str = (char*)ReadScriptParamPointer(thread);
 				memcpy(str, ffd.cFileName, 8);
 				str[7] = '\0';
 				break;
@@ -2556,13 +2600,13 @@ namespace CLEO {
 		return OR_CONTINUE;
 	}
 
-	//0AE9=0,pop_float
+	//0AE9=1,%1d% = pop_float
 	OpcodeResult __stdcall opcode_0AE9(CRunningScript *thread)
 	{
 		float result;
 		_asm fstp result
 		opcodeParams[0].fParam = result;
-		SetScriptParams(thread, 1);
+		WriteScriptParams(thread, opcodeParams, 1);
 		return OR_CONTINUE;
 	}
 
@@ -2604,7 +2648,7 @@ namespace CLEO {
 		if (*thread->GetBytePointer() >= 1 && *thread->GetBytePointer() <= 8)
 			*thread >> result;
 		else
-			result = &GetScriptParamPointer(thread)->cParam;
+			result = &ReadScriptParamPointer(thread)->cParam;
 		sprintf(result, format, val);
 		return OR_CONTINUE;
 	}
@@ -2626,6 +2670,87 @@ namespace CLEO {
 		*thread << (float)(log(arg) / log(base));
 		return OR_CONTINUE;
 	}
+
+	//0B30=1,%1d% = cleo_save_status
+	OpcodeResult __stdcall opcode_0B30(CRunningScript *thread)
+	{
+		*thread << static_cast<int>(GetInstance().ScriptEngine.SaveWriter.GetStatus());
+		return OR_CONTINUE;
+	}
+
+	//0B31=3,set_script_blob %1d% data %2d% size %3d%
+	OpcodeResult __stdcall opcode_0B31(CRunningScript *thread)
+	{
+		std::string name = readString(thread);
+		DWORD data, size;
+		*thread >> data >> size;
+		auto cs = reinterpret_cast<CCustomScript *>(thread);
+		SetScriptCondResult(thread, cs->IsCustom() &&
+			GetInstance().ScriptEngine.ScriptBlobs.Set(cs->GetChecksum(), name.c_str(), reinterpret_cast<const void *>(data), size));
+		return OR_CONTINUE;
+	}
+
+	//0B32=3,get_script_blob %1d% to %2d% max_size %3d%
+	OpcodeResult __stdcall opcode_0B32(CRunningScript *thread)
+	{
+		std::string name = readString(thread);
+		DWORD buf, bufSize;
+		*thread >> buf >> bufSize;
+		auto cs = reinterpret_cast<CCustomScript *>(thread);
+		auto blob = cs->IsCustom() ? GetInstance().ScriptEngine.ScriptBlobs.Get(cs->GetChecksum(), name.c_str()) : nullptr;
+		if (blob && buf) memcpy(reinterpret_cast<void *>(buf), blob->data(), min(static_cast<size_t>(bufSize), blob->size()));
+		SetScriptCondResult(thread, blob != nullptr);
+		return OR_CONTINUE;
+	}
+
+	//0B33=2,%2d% = script_blob %1d% size
+	OpcodeResult __stdcall opcode_0B33(CRunningScript *thread)
+	{
+		std::string name = readString(thread);
+		auto cs = reinterpret_cast<CCustomScript *>(thread);
+		auto blob = cs->IsCustom() ? GetInstance().ScriptEngine.ScriptBlobs.Get(cs->GetChecksum(), name.c_str()) : nullptr;
+		*thread << static_cast<DWORD>(blob ? blob->size() : 0);
+		SetScriptCondResult(thread, blob != nullptr);
+		return OR_CONTINUE;
+	}
+
+	//0B34=1,delete_script_blob %1d%
+	OpcodeResult __stdcall opcode_0B34(CRunningScript *thread)
+	{
+		const char *name = readString(thread);
+		auto cs = reinterpret_cast<CCustomScript *>(thread);
+		SetScriptCondResult(thread, cs->IsCustom() && GetInstance().ScriptEngine.ScriptBlobs.Remove(cs->GetChecksum(), name));
+		return OR_CONTINUE;
+	}
+
+	//0B35=2,var_named %1d% = %2d%
+	OpcodeResult __stdcall opcode_0B35(CRunningScript *thread)
+	{
+		std::string name = readString(thread);
+		DWORD value;
+		*thread >> value;
+		GetInstance().ScriptEngine.GlobalVars.Names.Set(name, value);
+		return OR_CONTINUE;
+	}
+
+	//0B36=2,%2d% = var_named %1d%
+	OpcodeResult __stdcall opcode_0B36(CRunningScript *thread)
+	{
+		std::string name = readString(thread);
+		auto value = GetInstance().ScriptEngine.GlobalVars.Names.Find(name);
+		*thread << (value ? *value : 0);
+		SetScriptCondResult(thread, value != nullptr);
+		return OR_CONTINUE;
+	}
+
+	//0B37=1,flush_file %1d%
+	OpcodeResult __stdcall opcode_0B37(CRunningScript *thread)
+	{
+		DWORD hFile;
+		*thread >> hFile;
+		if (convert_handle_to_file(hFile)) flush_file(hFile);
+		return OR_CONTINUE;
+	}
 }
 
 
@@ -2645,6 +2770,7 @@ extern "C"
 	void WINAPI CLEO_SetFloatOpcodeParam(CRunningScript* thread, float value);
 	LPSTR WINAPI CLEO_ReadStringOpcodeParam(CRunningScript* thread, char *buf, int size);
 	LPSTR WINAPI CLEO_ReadStringPointerOpcodeParam(CRunningScript* thread, char *buf, int size);
+	LPCSTR WINAPI CLEO_ReadStringViewOpcodeParam(CRunningScript* thread, DWORD *length);
 	void WINAPI CLEO_WriteStringOpcodeParam(CRunningScript* thread, LPCSTR str);
 	void WINAPI CLEO_SetThreadCondResult(CRunningScript* thread, BOOL result);
 	void WINAPI CLEO_SkipOpcodeParams(CRunningScript* thread, int count);
@@ -2652,6 +2778,7 @@ extern "C"
 	int WINAPI CLEO_GetOperandType(CRunningScript* thread);
 	void WINAPI CLEO_RetrieveOpcodeParams(CRunningScript *thread, int count);
 	void WINAPI CLEO_RecordOpcodeParams(CRunningScript *thread, int count);
+	void WINAPI CLEO_RetrieveOpcodeParamsTo(CRunningScript *thread, int count, SCRIPT_VAR *buf);
 	SCRIPT_VAR * WINAPI CLEO_GetPointerToScriptVariable(CRunningScript* thread);
 	RwTexture * WINAPI CLEO_GetScriptTextureById(CRunningScript* thread, int id);
 	HSTREAM WINAPI CLEO_GetInternalAudioStream(CRunningScript* thread, CAudioStream *stream);
@@ -2667,10 +2794,18 @@ extern "C"
 		if ((opcode > 0x7FFF) || (opcode < 0x0AF0))
 			return FALSE;
 
-		CustomOpcodeHandler& dst = extraOpcodeHandlers[opcode % 100][opcode / 100 - 28];
+		CustomOpcodeHandler& dst = extraOpcodeHandlers[opcode];
 
 		if (*dst)
 		{
+			// plugins made before the range was reserved for CLEO keep their opcodes, CLEO's one is given up
+			if (opcode >= CORE_OPCODES_FIRST && opcode <= CORE_OPCODES_LAST && dst == coreOpcodeHandlers[opcode - CORE_OPCODES_FIRST])
+			{
+				TRACE("Warning! Opcode %04X of CLEO is replaced by a plugin, scripts using it will call the plugin", opcode);
+				ForgetOpcodeLayout(opcode);
+				dst = callback;
+				return TRUE;
+			}
 			Error("Warning! CLEO couldn't register opcode handler.");
 			return FALSE;
 		}
@@ -2710,9 +2845,12 @@ extern "C"
 	{
 		static char internal_buf[MAX_STR_LEN];
 		if (!buf) { buf = internal_buf; size = MAX_STR_LEN; }
-		if (!size) size = MAX_STR_LEN;
-		std::fill(buf, buf + size, '\0');
-		GetScriptStringParam(thread, buf, size);
+		if (size <= 0) size = MAX_STR_LEN;
+		ScriptStringView text;
+		ReadScriptStringView(thread, text);
+		size_t count = min(text.length, size_t(size - 1));
+		if (count) memcpy(buf, text.data, count);
+		buf[count] = '\0';
 		return buf;
 	}
 
@@ -2720,14 +2858,20 @@ extern "C"
 	{
 		static char internal_buf[MAX_STR_LEN];
 		if (!buf) { buf = internal_buf; size = MAX_STR_LEN; }
-		if (!size) size = MAX_STR_LEN;
-		std::fill(buf, buf + size, '\0');
+		if (size <= 0 || size > MAX_STR_LEN) size = MAX_STR_LEN;
 		return readString(thread, buf, size);
 	}
 
+	LPCSTR WINAPI CLEO_ReadStringViewOpcodeParam(CRunningScript* thread, DWORD *length)
+	{
+		auto text = readStringView(thread);
+		if (length) *length = static_cast<DWORD>(text.length);
+		return text.data;
+	}
+
 	void WINAPI CLEO_WriteStringOpcodeParam(CRunningScript* thread, LPCSTR str)
 	{
-		auto dst = (char *)GetScriptParamPointer(thread);
+		auto dst = (char *)ReadScriptParamPointer(thread);
 		memcpy(dst, str, 16);
 		dst[15] = '\0';
 	}
@@ -2739,46 +2883,7 @@ extern "C"
 
 	void WINAPI CLEO_SkipOpcodeParams(CRunningScript* thread, int count)
 	{
-		int len;
-		for (int i = 0; i < count; i++)
-		{
-			switch (thread->ReadDataType())
-			{
-			case DT_VAR:
-			case DT_LVAR:
-			case DT_VAR_STRING:
-			case DT_LVAR_STRING:
-			case DT_VAR_TEXTLABEL:
-			case DT_LVAR_TEXTLABEL:
-				thread->IncPtr(2);
-				break;
-			case DT_VAR_ARRAY:
-			case DT_LVAR_ARRAY:
-				thread->IncPtr(6);
-				break;
-			case DT_BYTE:
-				thread->IncPtr();
-				break;
-			case DT_WORD:
-				thread->IncPtr(2);
-				break;
-			case DT_DWORD:
-			case DT_FLOAT:
-				thread->IncPtr(4);
-				break;
-			case DT_VARLEN_STRING:
-				len = thread->ReadDataByte();
-				thread->IncPtr(len);
-				break;
-
-			case DT_TEXTLABEL:
-				thread->IncPtr(8);
-				break;
-			case DT_STRING:
-				thread->IncPtr(16);
-				break;
-			}
-		}
+		for (int i = 0; i < count; i++) SkipScriptParam(thread);
 	}
 
 	void WINAPI CLEO_ThreadJumpAtLabelPtr(CRunningScript* thread, int labelPtr)
@@ -2793,27 +2898,28 @@ extern "C"
 
 	void WINAPI CLEO_RetrieveOpcodeParams(CRunningScript *thread, int count)
 	{
-		GetScriptParams(thread, count);
+		ReadScriptParams(thread, opcodeParams, count);
 	}
 
 	void WINAPI CLEO_RecordOpcodeParams(CRunningScript *thread, int count)
 	{
-		SetScriptParams(thread, count);
+		WriteScriptParams(thread, opcodeParams, count);
+	}
+
+	void WINAPI CLEO_RetrieveOpcodeParamsTo(CRunningScript *thread, int count, SCRIPT_VAR *buf)
+	{
+		ReadScriptParams(thread, buf, count);
 	}
 
 	SCRIPT_VAR * WINAPI CLEO_GetPointerToScriptVariable(CRunningScript* thread)
 	{
-		return GetScriptParamPointer(thread);
+		return ReadScriptParamPointer(thread);
 	}
 
 	RwTexture * WINAPI CLEO_GetScriptTextureById(CRunningScript* thread, int id)
 	{
 		CCustomScript* customScript = reinterpret_cast<CCustomScript*>(thread);
-		// We need to store-restore to update the texture list, not optimized, but this will not be used every frame anyway
-		customScript->StoreScriptTextures();
-		RwTexture *texture = customScript->GetScriptTextureById(id - 1);
-		customScript->RestoreScriptTextures();
-		return texture;
+		return customScript->GetScriptTextureById(id - 1);
 	}
 
 	HSTREAM WINAPI CLEO_GetInternalAudioStream(CRunningScript* thread, CAudioStream *stream)
@@ -2867,4 +2973,34 @@ extern "C"
 		scriptDeleteDelegate -= func;
 	}
 
+	// sscanf of text of a buffer being parsed record by record, with the format compiled once (the same way as 0AD4)
+	int WINAPI CLEO_ScanBuffer(LPCSTR *text, LPCSTR end, LPCSTR format, void **args, DWORD numArgs)
+	{
+		if (numArgs > 34) return 0;
+
+		auto& program = scanCache.Get(format, strlen(format));
+		if (program.CanScan(numArgs) && !program.MayWrite(args, end - *text, *text, end + 1))
+		{
+			int scanned = program.Scan(*text, end, args);
+			if (scanned != CScanProgram::UNDECIDED) return scanned;
+		}
+
+		// the scanned characters are counted with %n appended to the format, it is not reached if the format did not match
+		std::string countedFormat(format);
+		countedFormat += "%n";
+		int consumed = -1;
+		void *params[35] = { nullptr };
+		std::copy(args, args + numArgs, params);
+		params[numArgs] = &consumed;
+
+		int result = sscanf(*text, countedFormat.c_str(),
+							params[0], params[1], params[2], params[3], params[4], params[5], params[6],
+							params[7], params[8], params[9], params[10], params[11], params[12], params[13],
+							params[14], params[15], params[16], params[17], params[18], params[19], params[20],
+							params[21], params[22], params[23], params[24], params[25], params[26], params[27],
+							params[28], params[29], params[30], params[31], params[32], params[33], params[34]);
+		if (consumed >= 0) *text += consumed;
+		return result;
+	}
+
 }
\ No newline at end of file
@@ -2,11 +2,15 @@
 #include "CCodeInjector.h"
 #include "CDebug.h"
 #include <direct.h>
+#include <map>
 #include <set>
 
 namespace CLEO
 {
     const size_t MAX_STR_LEN = 0xff; // max length of string type parameter
+    // opcodes reserved for CLEO itself out of 0A8C-0AEF (same as CLEO_CORE_OPCODES_FIRST/LAST of the SDK)
+    const WORD CORE_OPCODES_FIRST = 0x0B30;
+    const WORD CORE_OPCODES_LAST = 0x0B3F;
     enum OpcodeResult : char
     {
         OR_CONTINUE = 0,
@@ -15,8 +19,27 @@ namespace CLEO
 
     typedef OpcodeResult(__stdcall * CustomOpcodeHandler)(CRunningScript*);
     void ResetScmFunctionStore();
+    void ReleaseScmCallStack(CRunningScript *thread);
     bool is_legacy_handle(DWORD dwHandle);
     FILE * convert_handle_to_file(DWORD dwHandle);
+    void flush_file(DWORD dwHandle);
+    void FlushScriptFiles(CRunningScript *thread);
+
+    // when data written to files opened by 0A9A is flushed, selected by ';' suffix of the mode
+    enum FileFlushMode : BYTE
+    {
+        FLUSH_IMMEDIATE,                    // after every write (default for CLEO 3 scripts, main.scm and files opened for update)
+        FLUSH_LINE,                         // after writes containing a new line
+        FLUSH_BLOCK,                        // when the buffer is full (default for CLEO 4 scripts)
+        FLUSH_MANUAL,                       // when the larger buffer is full or by 0B37
+    };
+
+    // file opened by 0A9A; buffered data is flushed by 0B37, when closed, when its script ends (the file is flushed at once from then on), and on clean up
+    struct ScriptFile
+    {
+        CRunningScript *owner;
+        FileFlushMode flushMode;
+    };
 
     class CCustomOpcodeSystem : public VInjectible
     {
@@ -30,7 +53,7 @@ namespace CLEO
         friend OpcodeResult __stdcall opcode_0AE8(CRunningScript *pScript);
 
     public:
-        std::set<DWORD> m_hFiles;
+        std::map<DWORD, ScriptFile> m_hFiles;
         std::set<HMODULE> m_hNativeLibs;
         std::set<HANDLE> m_hFileSearches;
         std::set<void *> m_pAllocations;
@@ -46,8 +69,9 @@ namespace CLEO
             // clean up after opcode_0A9A
             for (auto i = m_hFiles.begin(); i != m_hFiles.end(); ++i)
             {
-                if (!is_legacy_handle(*i))
-                    fclose(convert_handle_to_file(*i));
+                if (!is_legacy_handle(i->first))
+                    fclose(convert_handle_to_file(i->first));
+                else flush_file(i->first); // left open, but nothing stays in its buffer
             }
             m_hFiles.clear();
 
@@ -70,9 +94,11 @@ namespace CLEO
         virtual void Inject(CCodeInjector& inj);
         ~CCustomOpcodeSystem()
         {
-            //TRACE("Last opcode executed %04X at %s:%d", last_opcode, last_thread, last_off);
+            //TRACE("Last opcode executed %04X at %s", last_opcode, last_script->GetName());
         }
     };
 
     extern void(__thiscall * ProcessScript)(CRunningScript*);
+    extern void(__cdecl * ReinitialiseSwitchStatementData)();   // nullptr for versions its address is not known for
+    void ScriptExecutionLoop(CRunningScript *thread);
 }
@@ -0,0 +1,254 @@
+#include "stdafx.h"
+#include "CFormatCache.h"
+
+namespace CLEO
+{
+    void CFormatProgram::Compile(const char *format, size_t length)
+    {
+        tokens.clear();
+        text.clear();
+
+        std::string source(format, length);
+        const char *iter = source.c_str();
+        bool inLiteral = false;
+
+        auto appendLiteral = [&](char c)
+        {
+            if (!inLiteral)
+            {
+                tokens.push_back(FormatToken{ FormatToken::LITERAL, 0, 0, 0, 0, FormatToken::NO_PRECISION, static_cast<WORD>(text.size()), 0 });
+                inLiteral = true;
+            }
+            text += c;
+            ++tokens.back().textLength;
+        };
+
+        while (*iter)
+        {
+            if (*iter != '%')
+            {
+                appendLiteral(*iter++);
+                continue;
+            }
+            if (iter[1] == '%')
+            {
+                appendLiteral('%');
+                iter += 2;
+                continue;
+            }
+
+            FormatToken token = { FormatToken::GENERIC, 0, 0, 0, 0, FormatToken::NO_PRECISION, 0, 0 };
+            const char *spec = iter++;
+
+            // flags
+            for (; *iter == '0' || *iter == '+' || *iter == '-' || *iter == ' ' || *iter == '*' || *iter == '#'; ++iter)
+            {
+                switch (*iter)
+                {
+                case '*': ++token.numStars; token.flags |= FormatToken::DYNAMIC; break;
+                case '-': token.flags |= FormatToken::LEFT; break;
+                case '0': token.flags |= FormatToken::ZERO; break;
+                default: token.flags |= FormatToken::OTHER; break;
+                }
+            }
+
+            // width
+            unsigned width = 0;
+            for (; *iter >= '0' && *iter <= '9'; ++iter) if (width < 0xFFFF) width = width * 10 + (*iter - '0');
+            token.width = static_cast<WORD>(width < 0xFFFF ? width : 0xFFFF);
+
+            // precision, '*' is not stepped over (and so becomes the conversion), as it always was
+            if (*iter == '.')
+            {
+                ++iter;
+                if (*iter == '*')
+                {
+                    ++token.numStars;
+                    token.flags |= FormatToken::DYNAMIC;
+                }
+                else
+                {
+                    unsigned precision = 0;
+                    for (; *iter >= '0' && *iter <= '9'; ++iter) if (precision < 0xFF) precision = precision * 10 + (*iter - '0');
+                    token.precision = static_cast<BYTE>(precision < FormatToken::NO_PRECISION ? precision : FormatToken::NO_PRECISION - 1);
+                }
+            }
+
+            // size
+            if (*iter == 'h' || *iter == 'l')
+            {
+                if (*iter == 'h') token.flags |= FormatToken::OTHER;
+                ++iter;
+            }
+
+            inLiteral = false;
+            token.conversion = *iter;
+            switch (token.conversion)
+            {
+            case '\0':
+                token.kind = FormatToken::INCOMPLETE;
+                tokens.push_back(token);
+                return;
+            case 's':
+                token.kind = FormatToken::STRING;
+                break;
+            case 'c':
+                token.kind = FormatToken::CHAR;
+                break;
+            case 'p': case 'P':
+                token.kind = FormatToken::POINTER;
+                break;
+            case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+                token.kind = FormatToken::INTEGER;
+                break;
+            case 'a': case 'A': case 'e': case 'E': case 'f': case 'F': case 'g': case 'G':
+                token.kind = FormatToken::REAL;
+                break;
+            }
+            ++iter;
+
+            token.textOffset = static_cast<WORD>(text.size());
+            token.textLength = static_cast<WORD>(iter - spec);
+            text.append(spec, iter);
+            text += '\0';
+            tokens.push_back(token);
+        }
+    }
+
+    static const WORD MAX_NATIVE_WIDTH = 64;
+
+    // pads the text of length len in buf to the width of the token, zeros go after the sign
+    static int Pad(char *buf, int len, bool negative, const FormatToken& token)
+    {
+        if (token.width <= len) return len;
+
+        int pad = token.width - len;
+        if (token.flags & FormatToken::LEFT) memset(buf + len, ' ', pad);
+        else
+        {
+            int fixed = (token.flags & FormatToken::ZERO) && negative ? 1 : 0;
+            memmove(buf + fixed + pad, buf + fixed, len - fixed);
+            memset(buf + fixed, (token.flags & FormatToken::ZERO) ? '0' : ' ', pad);
+        }
+        return token.width;
+    }
+
+    int FormatInteger(char *buf, const FormatToken& token, DWORD value)
+    {
+        if (token.flags & (FormatToken::OTHER | FormatToken::DYNAMIC) || token.precision != FormatToken::NO_PRECISION ||
+            token.width > MAX_NATIVE_WIDTH) return -1;
+
+        const char *digits = "0123456789abcdef";
+        unsigned base = 10;
+        bool negative = false;
+        switch (token.conversion)
+        {
+        case 'd':
+        case 'i':
+            if (static_cast<int>(value) < 0)
+            {
+                negative = true;
+                value = 0u - value;
+            }
+            break;
+        case 'x': base = 16; break;
+        case 'X': base = 16; digits = "0123456789ABCDEF"; break;
+        case 'o': base = 8; break;
+        }
+
+        char tmp[16], *end = tmp + sizeof(tmp), *p = end;
+        do
+        {
+            *--p = digits[value % base];
+            value /= base;
+        } while (value);
+
+        int len = 0;
+        if (negative) buf[len++] = '-';
+        memcpy(buf + len, p, end - p);
+        len += static_cast<int>(end - p);
+        return Pad(buf, len, negative, token);
+    }
+
+    // %f of float is printed exactly: the value is mantissa * 2^exp, its fraction is expanded digit by digit
+    int FormatReal(char *buf, const FormatToken& token, float value)
+    {
+        if (token.conversion != 'f' && token.conversion != 'F') return -1;
+        if (token.flags & (FormatToken::OTHER | FormatToken::DYNAMIC) || token.width > MAX_NATIVE_WIDTH) return -1;
+        int precision = token.precision == FormatToken::NO_PRECISION ? 6 : token.precision;
+        if (precision > 9) return -1;
+
+        DWORD bits;
+        memcpy(&bits, &value, sizeof(bits));
+        bool negative = (bits >> 31) != 0;
+        int exponent = (bits >> 23) & 0xFF;
+        unsigned long long mantissa = bits & 0x7FFFFF;
+        if (exponent == 0xFF) return -1; // inf, nan
+        if (exponent) mantissa |= 0x800000;
+        int shift = exponent ? 150 - exponent : 149; // value = mantissa / 2^shift
+
+        unsigned long long integer, fraction = 0;
+        if (shift <= 0)
+        {
+            if (shift < -39) return -1; // too long to fit 64 bits
+            integer = mantissa << -shift;
+            shift = 0;
+        }
+        else if (shift < 60)
+        {
+            integer = mantissa >> shift;
+            fraction = mantissa & ((1ull << shift) - 1);
+        }
+        else
+        {
+            // less than 2^-36, printed as zero even with the highest precision
+            integer = 0;
+            shift = 0;
+        }
+
+        char frac[10];
+        for (int i = 0; i < precision; ++i)
+        {
+            if (shift)
+            {
+                fraction *= 10;
+                frac[i] = '0' + static_cast<char>(fraction >> shift);
+                fraction &= (1ull << shift) - 1;
+            }
+            else frac[i] = '0';
+        }
+
+        // round half to even is left for the C runtime, as its versions differ in that
+        if (shift)
+        {
+            unsigned long long half = 1ull << (shift - 1);
+            if (fraction == half) return -1;
+            if (fraction > half)
+            {
+                int i = precision - 1;
+                for (; i >= 0 && frac[i] == '9'; --i) frac[i] = '0';
+                if (i >= 0) ++frac[i];
+                else ++integer;
+            }
+        }
+
+        char tmp[24], *end = tmp + sizeof(tmp), *p = end;
+        do
+        {
+            *--p = '0' + static_cast<char>(integer % 10);
+            integer /= 10;
+        } while (integer);
+
+        int len = 0;
+        if (negative) buf[len++] = '-';
+        memcpy(buf + len, p, end - p);
+        len += static_cast<int>(end - p);
+        if (precision)
+        {
+            buf[len++] = '.';
+            memcpy(buf + len, frac, precision);
+            len += precision;
+        }
+        return Pad(buf, len, negative, token);
+    }
+}
@@ -0,0 +1,125 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace CLEO
+{
+    // single piece of format string of formatting opcodes (0AD3, 0ACE-0AD1, 0AD9)
+    struct FormatToken
+    {
+        enum Kind : BYTE
+        {
+            LITERAL,                        // text copied as it is
+            STRING,                         // %s, flags, width and precision are ignored
+            CHAR,                           // %c, flags, width and precision are ignored
+            POINTER,                        // %p, always printed as %08X
+            INTEGER,                        // %d %i %u %x %X %o
+            REAL,                           // %a %e %f %g (and uppercase)
+            GENERIC,                        // any other conversion, printed with sprintf
+            INCOMPLETE,                     // % at the end of the format, consumes parameter and ends the output
+        };
+
+        enum Flags : BYTE
+        {
+            LEFT = 1,                       // '-'
+            ZERO = 2,                       // '0'
+            OTHER = 4,                      // '+', ' ', '#', 'h' or precision of integer, printed with sprintf
+            DYNAMIC = 8,                    // '*' in the spec, sprintf format has to be built for each call
+        };
+
+        static const BYTE NO_PRECISION = 0xFF;
+
+        Kind kind;
+        BYTE flags;
+        BYTE numStars;                      // parameters read for '*' before the value
+        char conversion;
+        WORD width;
+        BYTE precision;
+        WORD textOffset, textLength;        // in CFormatProgram::text: characters of literal or whole spec (null-terminated) of conversion
+    };
+
+    // format string parsed once, the same way CLEO::format has always parsed it
+    class CFormatProgram
+    {
+    public:
+        std::vector<FormatToken> tokens;
+        std::string text;
+
+        void Compile(const char *format, size_t length);
+
+        inline const char *GetText(const FormatToken& token) const { return text.c_str() + token.textOffset; }
+    };
+
+    // renderers of integer and float conversions without sprintf, byte-identical to it
+    // return the length of the output, or -1 if the conversion has to be printed with sprintf
+    int FormatInteger(char *buf, const FormatToken& token, DWORD value);
+    int FormatReal(char *buf, const FormatToken& token, float value);
+
+    // rebuilds sprintf format of spec with '*', reading the values with the callback (same as CLEO::format has always done)
+    template<typename ReadStar>
+    void BuildDynamicFormat(const char *spec, char *out, ReadStar readStar)
+    {
+        *out++ = *spec++;
+        for (; *spec == '0' || *spec == '+' || *spec == '-' || *spec == ' ' || *spec == '*' || *spec == '#'; ++spec)
+        {
+            if (*spec == '*')
+            {
+                _itoa(readStar(), out, 10);
+                out += strlen(out);
+            }
+            else *out++ = *spec;
+        }
+        while (*spec >= '0' && *spec <= '9') *out++ = *spec++;
+        if (*spec == '.')
+        {
+            *out++ = *spec++;
+            if (*spec == '*')
+            {
+                // the star is kept as the conversion, as it always was
+                _itoa(readStar(), out, 10);
+                out += strlen(out);
+            }
+            else while (*spec >= '0' && *spec <= '9') *out++ = *spec++;
+        }
+        while (*spec) *out++ = *spec++;
+        *out = '\0';
+    }
+
+    // compiled formats by address of the format text, checked against its copy so texts of variables may change
+    template<typename Program>
+    class CCompiledFormatCache
+    {
+        struct Entry
+        {
+            std::string source;
+            Program program;
+        };
+
+        std::unordered_map<const char *, Entry> entries;
+
+    public:
+        static const size_t MAX_ENTRIES = 512;
+
+        // the program is valid until the next call
+        const Program& Get(const char *format, size_t length)
+        {
+            auto it = entries.find(format);
+            if (it != entries.end() && it->second.source.size() == length && !memcmp(it->second.source.data(), format, length))
+                return it->second.program;
+
+            // texts of allocated memory may come from ever new addresses, so the cache is limited
+            if (it == entries.end() && entries.size() >= MAX_ENTRIES) entries.clear();
+
+            auto& entry = entries[format];
+            entry.source.assign(format, length);
+            entry.program.Compile(format, length);
+            return entry.program;
+        }
+
+        void Clear() { entries.clear(); }
+        size_t Count() const { return entries.size(); }
+    };
+
+    typedef CCompiledFormatCache<CFormatProgram> CFormatCache;
+}
@@ -93,6 +93,19 @@ namespace CLEO
             SetLetterColor(RGBA(/*0xE1, 0xE1, 0xE1, 0xFF*/0xAD, 0xCE, 0xC4, 0xFF));
             TextDraw(CGameMenu_ScaleX(MenuManager, 6.0f), CGameMenu_ScaleY(MenuManager, 436.0f), cleo_text.str().c_str());
         }
+
+        auto save_status = GetInstance().ScriptEngine.SaveWriter.GetStatus();
+        if (save_status == SAVE_STATUS_PENDING || save_status == SAVE_STATUS_FAILED)
+        {
+            SetTextAlign(1);
+            SetLetterSize(CGameMenu_ScaleX(MenuManager, 0.18f), CGameMenu_ScaleY(MenuManager, 0.34f));
+            if (save_status == SAVE_STATUS_PENDING)
+                SetLetterColor(RGBA(0xAD, 0xCE, 0xC4, 0xFF));
+            else
+                SetLetterColor(RGBA(0xE0, 0x60, 0x60, 0xFF));
+            TextDraw(CGameMenu_ScaleX(MenuManager, 6.0f), CGameMenu_ScaleY(MenuManager, 444.0f),
+                save_status == SAVE_STATUS_PENDING ? "Saving CLEO state..." : "CLEO state could not be saved!");
+        }
     }
 
     void CGameMenu::Inject(CCodeInjector& inj)
@@ -71,6 +71,7 @@ namespace CLEO
         { 0x005D18F0,	memory_und, 0x005D18F0, 0x005D20D0, 0x005EE017 },		// MA_CALL_LOAD_SCM_DATA,
         { 0x004667DB,	memory_und, 0x004667DB, 0x0046685B, 0x0046BEFD },		// MA_OPCODE_004E,
         { 0x0046A21B,	memory_und,	0x0046A21B, 0x0046AE9B, 0x0046F9A8 },		// MA_CALL_PROCESS_SCRIPT
+        { 0x00470370,	memory_und,	0x00470370, memory_und, memory_und },		// MA_REINIT_SWITCH_STATEMENT_DATA_FUNCTION
         { 0x00A94B68,	memory_und, 0x00A94B68,	0x00A971E8, 0x00B09C80 },		// MA_SCRIPT_SPRITE_ARRAY
         { 0x00464980,	memory_und, 0x00464980, 0x00465600, 0x0046A130 },		// MA_DRAW_SCRIPT_SPRITES
         { 0x0058C092,	memory_und, 0x0058C092, 0x0058D462, 0x0059A3F2 },		// MA_CALL_DRAW_SCRIPT_SPRITES
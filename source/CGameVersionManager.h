@@ -83,6 +83,7 @@ namespace CLEO
         MA_CALL_LOAD_SCM_DATA,
         MA_OPCODE_004E,
         MA_CALL_PROCESS_SCRIPT,
+        MA_REINIT_SWITCH_STATEMENT_DATA_FUNCTION,
         MA_SCRIPT_SPRITE_ARRAY,
         MA_DRAW_SCRIPT_SPRITES,
         MA_CALL_DRAW_SCRIPT_SPRITES,
@@ -0,0 +1,71 @@
+#include "stdafx.h"
+#include "CGlobalVarStore.h"
+#include "CSaveFile.h"
+#include <algorithm>
+
+namespace CLEO
+{
+    template<typename T> static void WriteBinary(std::vector<BYTE>& buf, const T& value)
+    {
+        auto ptr = reinterpret_cast<const BYTE *>(&value);
+        buf.insert(buf.end(), ptr, ptr + sizeof(T));
+    }
+
+    std::vector<BYTE> CGlobalVarStore::Serialize() const
+    {
+        std::vector<std::pair<DWORD, DWORD>> ids;
+        std::vector<std::pair<const std::string *, DWORD>> names;
+        ids.reserve(Ids.Size());
+        names.reserve(Names.Size());
+        Ids.ForEach([&ids](DWORD id, DWORD value) { ids.emplace_back(id, value); });
+        Names.ForEach([&names](const std::string& name, DWORD value) { names.emplace_back(&name, value); });
+        std::sort(ids.begin(), ids.end());
+        std::sort(names.begin(), names.end(), [](const std::pair<const std::string *, DWORD>& a, const std::pair<const std::string *, DWORD>& b) {
+            return *a.first < *b.first;
+        });
+
+        std::vector<BYTE> buf;
+        buf.reserve(sizeof(DWORD) + ids.size() * 2 * sizeof(DWORD) + names.size() * (1 + 16 + sizeof(DWORD)));
+        WriteBinary(buf, static_cast<DWORD>(ids.size()));
+        for (auto& entry : ids)
+        {
+            WriteBinary(buf, entry.first);
+            WriteBinary(buf, entry.second);
+        }
+        for (auto& entry : names)
+        {
+            buf.push_back(static_cast<BYTE>(entry.first->size()));
+            buf.insert(buf.end(), entry.first->begin(), entry.first->end());
+            WriteBinary(buf, entry.second);
+        }
+        return buf;
+    }
+
+    void CGlobalVarStore::Deserialize(const BYTE *data, size_t size)
+    {
+        Clear();
+        CSaveDataReader reader(data, size);
+
+        DWORD numIds;
+        reader.Read(numIds);
+        if (numIds > reader.Remaining() / (2 * sizeof(DWORD))) throw std::runtime_error("Unexpected end of saved data");
+        while (numIds--)
+        {
+            DWORD id, value;
+            reader.Read(id);
+            reader.Read(value);
+            Ids.Set(id, value);
+        }
+
+        while (reader.Remaining())
+        {
+            BYTE nameLen;
+            char name[MAX_NAME_LEN];
+            DWORD value;
+            reader.Read(nameLen);
+            reader.Read(name, nameLen);
+            reader.Read(value);
+            Names.Set(std::string(name, nameLen), value);
+        }
+    }
+}
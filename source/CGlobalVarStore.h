@@ -0,0 +1,167 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <functional>
+
+namespace CLEO
+{
+    // open addressing hash table of DWORD values with linear probing
+    // values are 0 by default, and only non-default values are kept in the table
+    template<typename Key, typename Hash, typename Equal = std::equal_to<Key>>
+    class CVarTable
+    {
+        struct Slot
+        {
+            Key key;
+            DWORD value;
+            bool used;
+        };
+
+        std::vector<Slot> slots;    // size is 0 or power of 2
+        size_t count;
+
+        inline size_t Home(const Key& key) const { return Hash()(key) & (slots.size() - 1); }
+
+        // index of the slot holding the key or the free slot it would be put in
+        size_t Lookup(const Key& key) const
+        {
+            size_t mask = slots.size() - 1;
+            size_t i = Home(key);
+            while (slots[i].used && !Equal()(slots[i].key, key)) i = (i + 1) & mask;
+            return i;
+        }
+
+        void Grow()
+        {
+            std::vector<Slot> old(slots.empty() ? 16 : slots.size() * 2);
+            old.swap(slots);
+            for (auto& slot : old)
+            {
+                if (!slot.used) continue;
+                auto& dst = slots[Lookup(slot.key)];
+                dst.key = std::move(slot.key);
+                dst.value = slot.value;
+                dst.used = true;
+            }
+        }
+
+        // backward shift deletion, so no tombstones are left behind
+        void Erase(size_t i)
+        {
+            size_t mask = slots.size() - 1;
+            for (size_t j = (i + 1) & mask; slots[j].used; j = (j + 1) & mask)
+            {
+                size_t home = Home(slots[j].key);
+                bool movable = i <= j ? (home <= i || home > j) : (home <= i && home > j);
+                if (movable)
+                {
+                    slots[i].key = std::move(slots[j].key);
+                    slots[i].value = slots[j].value;
+                    i = j;
+                }
+            }
+            slots[i].key = Key();
+            slots[i].used = false;
+            --count;
+        }
+
+    public:
+        CVarTable() : count(0) { }
+
+        inline size_t Size() const { return count; }
+
+        inline void Clear()
+        {
+            slots.clear();
+            count = 0;
+        }
+
+        // nullptr if the value is default
+        const DWORD *Find(const Key& key) const
+        {
+            if (!count) return nullptr;
+            auto& slot = slots[Lookup(key)];
+            return slot.used ? &slot.value : nullptr;
+        }
+
+        inline DWORD Get(const Key& key) const
+        {
+            auto value = Find(key);
+            return value ? *value : 0;
+        }
+
+        void Set(const Key& key, DWORD value)
+        {
+            if (!value)
+            {
+                if (!count) return;
+                size_t i = Lookup(key);
+                if (slots[i].used) Erase(i);
+                return;
+            }
+
+            if ((count + 1) * 4 > slots.size() * 3) Grow();     // keep the load under 3/4
+            auto& slot = slots[Lookup(key)];
+            if (!slot.used)
+            {
+                slot.key = key;
+                slot.used = true;
+                ++count;
+            }
+            slot.value = value;
+        }
+
+        template<typename F> void ForEach(F func) const
+        {
+            for (auto& slot : slots)
+                if (slot.used) func(slot.key, slot.value);
+        }
+    };
+
+    struct VarIdHash
+    {
+        inline size_t operator()(DWORD id) const
+        {
+            // murmur3 finalizer, ids of mods are often sequential or differ in high bits only
+            id ^= id >> 16;
+            id *= 0x85EBCA6B;
+            id ^= id >> 13;
+            id *= 0xC2B2AE35;
+            id ^= id >> 16;
+            return id;
+        }
+    };
+
+    struct VarNameHash
+    {
+        inline size_t operator()(const std::string& name) const
+        {
+            DWORD hash = 0x811C9DC5;    // fnv-1a
+            for (auto c : name) hash = (hash ^ static_cast<BYTE>(c)) * 0x01000193;
+            return hash;
+        }
+    };
+
+    // cleo variables beyond CScriptEngine::CleoVariables: by 32-bit id or by name (case-sensitive), kept in cleo saves
+    class CGlobalVarStore
+    {
+    public:
+        static const size_t MAX_NAME_LEN = 255;
+
+        CVarTable<DWORD, VarIdHash> Ids;
+        CVarTable<std::string, VarNameHash> Names;
+
+        inline void Clear()
+        {
+            Ids.Clear();
+            Names.Clear();
+        }
+
+        inline bool Empty() const { return !Ids.Size() && !Names.Size(); }
+
+        // number of id entries, id entries (id, value), then name entries (name length (byte), name, value)
+        // entries are sorted, so the same variables are always saved the same way
+        std::vector<BYTE> Serialize() const;
+        void Deserialize(const BYTE *data, size_t size);
+    };
+}
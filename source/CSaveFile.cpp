@@ -0,0 +1,193 @@
+#include "stdafx.h"
+#include "CSaveFile.h"
+#include "crc32.h"
+
+namespace CLEO
+{
+    const size_t SAVE_SECTION_ALIGNMENT = 8;
+
+    // packing: control byte, 0x80 | (n - 1) is a run of n zero bytes, (n - 1) is followed by n literal bytes (n <= 128)
+    // (most of cleo variables and script locals are zeros)
+    static std::vector<BYTE> PackZeroRuns(const BYTE *data, size_t size)
+    {
+        std::vector<BYTE> packed;
+        packed.reserve(size / 4);
+        size_t i = 0;
+        while (i < size)
+        {
+            size_t run = 0;
+            while (i + run < size && !data[i + run] && run < 128) ++run;
+            if (run >= 2)
+            {
+                packed.push_back(static_cast<BYTE>(0x80 | (run - 1)));
+                i += run;
+                continue;
+            }
+
+            // literals up to the next zero run
+            size_t len = 0;
+            while (i + len < size && len < 128 && (data[i + len] || (i + len + 1 < size && data[i + len + 1])))
+                ++len;
+            if (!len) len = 1;	// single zero at the end
+            packed.push_back(static_cast<BYTE>(len - 1));
+            packed.insert(packed.end(), data + i, data + i + len);
+            i += len;
+        }
+        return packed;
+    }
+
+    static void UnpackZeroRuns(const BYTE *packed, size_t packedSize, BYTE *out, size_t size)
+    {
+        const BYTE *end = packed + packedSize;
+        size_t pos = 0;
+        while (packed < end)
+        {
+            BYTE ctrl = *packed++;
+            size_t len = (ctrl & 0x7F) + 1;
+            if (len > size - pos) throw std::runtime_error("Packed section overflow");
+            if (ctrl & 0x80)
+                memset(out + pos, 0, len);
+            else
+            {
+                if (len > static_cast<size_t>(end - packed)) throw std::runtime_error("Packed section is truncated");
+                memcpy(out + pos, packed, len);
+                packed += len;
+            }
+            pos += len;
+        }
+        if (pos != size) throw std::runtime_error("Packed section size mismatch");
+    }
+
+    void CSaveFileWriter::AddSection(DWORD id, const void *data, size_t size, bool pack)
+    {
+        auto bytes = reinterpret_cast<const BYTE *>(data);
+        Section section = { id, 0, static_cast<DWORD>(size) };
+        if (pack && size)
+        {
+            section.data = PackZeroRuns(bytes, size);
+            if (section.data.size() < size) section.flags |= SAVE_SECTION_FLAG_PACKED;
+            else section.data.clear();
+        }
+        if (!(section.flags & SAVE_SECTION_FLAG_PACKED)) section.data.assign(bytes, bytes + size);
+        sections.push_back(std::move(section));
+    }
+
+    std::vector<BYTE> CSaveFileWriter::Build() const
+    {
+        auto align = [](size_t offset) { return (offset + SAVE_SECTION_ALIGNMENT - 1) & ~(SAVE_SECTION_ALIGNMENT - 1); };
+
+        std::vector<SaveSectionEntry> directory;
+        size_t offset = align(sizeof(SaveFileHeader) + sizeof(SaveSectionEntry) * sections.size());
+        for (auto& section : sections)
+        {
+            SaveSectionEntry entry = { section.id, section.flags, static_cast<DWORD>(offset), static_cast<DWORD>(section.data.size()), section.size,
+                static_cast<DWORD>(crc32(section.data.data(), section.data.size())) };
+            directory.push_back(entry);
+            offset = align(offset + section.data.size());
+        }
+
+        SaveFileHeader header = { SAVE_FILE_SIGNATURE, SAVE_FILE_VERSION, static_cast<WORD>(sections.size()),
+            static_cast<DWORD>(crc32(reinterpret_cast<const BYTE *>(directory.data()), directory.size() * sizeof(SaveSectionEntry))) };
+
+        std::vector<BYTE> file(offset, 0);
+        memcpy(file.data(), &header, sizeof(header));
+        if (!directory.empty()) memcpy(file.data() + sizeof(header), directory.data(), directory.size() * sizeof(SaveSectionEntry));
+        for (size_t i = 0; i < sections.size(); ++i)
+        {
+            if (!sections[i].data.empty()) memcpy(file.data() + directory[i].offset, sections[i].data.data(), sections[i].data.size());
+        }
+        return file;
+    }
+
+    void CSaveFileReader::Close()
+    {
+        if (view && hMapping) UnmapViewOfFile(view);
+        if (hMapping) CloseHandle(hMapping);
+        if (hFile != INVALID_HANDLE_VALUE) CloseHandle(hFile);
+        hFile = INVALID_HANDLE_VALUE;
+        hMapping = nullptr;
+        view = nullptr;
+        viewSize = 0;
+        directory.clear();
+        unpacked.clear();
+    }
+
+    bool CSaveFileReader::Open(const char *path)
+    {
+        Close();
+        hFile = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (hFile == INVALID_HANDLE_VALUE) return false;
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(hFile, &size) || size.QuadPart < static_cast<LONGLONG>(sizeof(DWORD)) || size.HighPart)
+            throw std::runtime_error("Invalid file size");
+
+        hMapping = CreateFileMapping(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!hMapping) throw std::runtime_error("Failed to map the file");
+        auto data = reinterpret_cast<const BYTE *>(MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0));
+        if (!data) throw std::runtime_error("Failed to map the file");
+
+        Parse(data, size.LowPart);
+        return true;
+    }
+
+    void CSaveFileReader::Parse(const BYTE *data, size_t size)
+    {
+        view = data;
+        viewSize = size;
+        directory.clear();
+        unpacked.clear();
+
+        CSaveDataReader reader(data, size);
+        DWORD signature;
+        reader.Read(signature);
+        legacy = signature == LEGACY_SAVE_FILE_SIGNATURE;
+        if (legacy) return;
+        if (signature != SAVE_FILE_SIGNATURE) throw std::runtime_error("Invalid file format");
+
+        SaveFileHeader header;
+        CSaveDataReader(data, size).Read(header);
+        if (header.version > SAVE_FILE_VERSION) throw std::runtime_error("Unsupported file version");
+        reader.Skip(sizeof(header) - sizeof(signature));
+
+        directory.resize(header.numSections);
+        if (header.numSections) reader.Read(directory.data(), directory.size());
+        if (crc32(reinterpret_cast<const BYTE *>(directory.data()), directory.size() * sizeof(SaveSectionEntry)) != header.directoryChecksum)
+            throw std::runtime_error("Section directory is damaged");
+
+        for (auto& entry : directory)
+        {
+            if (entry.offset > size || entry.storedSize > size - entry.offset)
+                throw std::runtime_error("Section is out of the file");
+        }
+    }
+
+    bool CSaveFileReader::GetSection(DWORD id, const BYTE *& data, size_t& size)
+    {
+        auto entry = std::find_if(directory.begin(), directory.end(), [id](const SaveSectionEntry& entry) { return entry.id == id; });
+        if (entry == directory.end()) return false;
+
+        const BYTE *stored = view + entry->offset;
+        if (crc32(stored, entry->storedSize) != entry->checksum)
+            throw std::runtime_error("Section checksum mismatch");
+
+        if (!(entry->flags & SAVE_SECTION_FLAG_PACKED))
+        {
+            if (entry->storedSize != entry->size) throw std::runtime_error("Section size mismatch");
+            data = stored;
+            size = entry->size;
+            return true;
+        }
+
+        if (entry->size / 128 > entry->storedSize) throw std::runtime_error("Section size mismatch");
+        auto& buf = unpacked[id];
+        if (buf.size() != entry->size)
+        {
+            buf.resize(entry->size);
+            UnpackZeroRuns(stored, entry->storedSize, buf.data(), buf.size());
+        }
+        data = buf.data();
+        size = buf.size();
+        return true;
+    }
+}
@@ -0,0 +1,121 @@
+#pragma once
+#include <vector>
+#include <map>
+#include <stdexcept>
+
+namespace CLEO
+{
+    // cleo save container (cs*.sav):
+    // header, section directory, then section data (each section aligned to 8 bytes, so the file can be used mapped into memory)
+    // every section has its own checksum and may be stored compressed, unknown sections are skipped by the reader
+
+    inline constexpr DWORD MakeSaveSectionId(char a, char b, char c, char d)
+    {
+        return static_cast<BYTE>(a) | static_cast<BYTE>(b) << 8 | static_cast<BYTE>(c) << 16 | static_cast<DWORD>(static_cast<BYTE>(d)) << 24;
+    }
+
+    const DWORD SAVE_FILE_SIGNATURE = 0x32345653;           // "SV42"
+    const DWORD LEGACY_SAVE_FILE_SIGNATURE = 0x31345653;    // "SV41", raw dump of the state by CLEO 4.4.4 and older
+    const WORD SAVE_FILE_VERSION = 1;
+
+    const DWORD SAVE_SECTION_FLAG_PACKED = 1;               // zero runs are packed
+
+    // sections written by CLEO
+    const DWORD SAVE_SECTION_VARIABLES = MakeSaveSectionId('V', 'A', 'R', 'S');         // CleoVariables
+    const DWORD SAVE_SECTION_THREADS = MakeSaveSectionId('T', 'H', 'R', 'D');           // record size, ThreadSavingInfo records
+    const DWORD SAVE_SECTION_STOPPED_THREADS = MakeSaveSectionId('S', 'T', 'O', 'P');   // checksums of stopped scripts
+    const DWORD SAVE_SECTION_GLOBAL_VARS = MakeSaveSectionId('G', 'V', 'A', 'R');       // CGlobalVarStore entries
+    const DWORD SAVE_SECTION_BLOBS = MakeSaveSectionId('B', 'L', 'O', 'B');             // CScriptBlobStorage records
+
+#pragma pack(push, 1)
+    struct SaveFileHeader
+    {
+        DWORD signature;
+        WORD version;
+        WORD numSections;
+        DWORD directoryChecksum;                            // crc32 of the section directory
+    };
+
+    struct SaveSectionEntry
+    {
+        DWORD id;
+        DWORD flags;
+        DWORD offset;                                       // from the beginning of the file
+        DWORD storedSize;
+        DWORD size;                                         // after unpacking
+        DWORD checksum;                                     // crc32 of the stored data
+    };
+#pragma pack(pop)
+
+    class CSaveFileWriter
+    {
+        struct Section
+        {
+            DWORD id;
+            DWORD flags;
+            DWORD size;
+            std::vector<BYTE> data;
+        };
+        std::vector<Section> sections;
+
+    public:
+        // the data is packed if it makes it smaller and pack is set
+        void AddSection(DWORD id, const void *data, size_t size, bool pack = false);
+        std::vector<BYTE> Build() const;
+    };
+
+    class CSaveFileReader
+    {
+        HANDLE hFile, hMapping;
+        const BYTE *view;
+        size_t viewSize;
+        bool legacy;
+        std::vector<SaveSectionEntry> directory;
+        std::map<DWORD, std::vector<BYTE>> unpacked;
+
+        void Close();
+
+    public:
+        CSaveFileReader() : hFile(INVALID_HANDLE_VALUE), hMapping(nullptr), view(nullptr), viewSize(0), legacy(false) { }
+        ~CSaveFileReader() { Close(); }
+
+        // maps the file into memory, false if there is no such file, throws if the file is not valid
+        bool Open(const char *path);
+        // validates the data (which must stay alive while the reader is in use)
+        void Parse(const BYTE *data, size_t size);
+
+        inline bool IsLegacy() const { return legacy; }
+        inline const BYTE *GetData() const { return view; }
+        inline size_t GetSize() const { return viewSize; }
+
+        // false if there is no such section, throws if it is damaged
+        bool GetSection(DWORD id, const BYTE *& data, size_t& size);
+    };
+
+    // bounds-checked sequential reading of the saved data
+    class CSaveDataReader
+    {
+        const BYTE *ptr, *end;
+
+    public:
+        CSaveDataReader(const BYTE *data, size_t size) : ptr(data), end(data + size) { }
+
+        inline size_t Remaining() const { return end - ptr; }
+
+        void Read(void *buf, size_t size)
+        {
+            if (size > Remaining()) throw std::runtime_error("Unexpected end of saved data");
+            memcpy(buf, ptr, size);
+            ptr += size;
+        }
+
+        template<typename T> void Read(T& value) { Read(static_cast<void *>(&value), sizeof(T)); }
+        template<typename T> void Read(T *values, size_t count) { Read(static_cast<void *>(values), sizeof(T) * count); }
+
+        void Skip(size_t size)
+        {
+            if (size > Remaining()) throw std::runtime_error("Unexpected end of saved data");
+            ptr += size;
+        }
+    };
+}
@@ -0,0 +1,100 @@
+#include "stdafx.h"
+#include "CSaveWriter.h"
+
+namespace CLEO
+{
+    CSaveWriter::~CSaveWriter()
+    {
+        // destroyed at dll detach, under the loader lock the thread can not be joined;
+        // the game has called Shutdown by then, unless it has been killed
+        if (worker.joinable()) worker.detach();
+    }
+
+    void CSaveWriter::Shutdown()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        cond.notify_all();
+        if (worker.joinable()) worker.join();
+    }
+
+    void CSaveWriter::Write(const char *path, std::vector<BYTE>&& data)
+    {
+        char fullPath[MAX_PATH];
+        if (!GetFullPathName(path, sizeof(fullPath), fullPath, nullptr))
+        {
+            lastError = ::GetLastError();
+            status = SAVE_STATUS_FAILED;
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            // the file is saved again before the previous data has been written, drop the outdated one
+            auto it = std::find_if(jobs.begin(), jobs.end(), [&fullPath](const SaveJob& job) {
+                return _stricmp(job.path.c_str(), fullPath) == 0;
+            });
+            if (it != jobs.end()) it->data = std::move(data);
+            else jobs.push_back({ fullPath, std::move(data) });
+            status = SAVE_STATUS_PENDING;
+
+            // started on first use, not from DllMain
+            if (!worker.joinable()) worker = std::thread(&CSaveWriter::WorkerLoop, this);
+        }
+        cond.notify_all();
+    }
+
+    void CSaveWriter::Wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [this] { return jobs.empty() && !busy; });
+    }
+
+    void CSaveWriter::WorkerLoop()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            cond.wait(lock, [this] { return quit || !jobs.empty(); });
+            if (jobs.empty()) return;   // quit, after everything has been written
+
+            SaveJob job = std::move(jobs.front());
+            jobs.pop_front();
+            busy = true;
+            lock.unlock();
+
+            DWORD error = WriteFileAtomic(job.path, job.data);
+
+            lock.lock();
+            busy = false;
+            lastError = error;
+            if (error != ERROR_SUCCESS) status = SAVE_STATUS_FAILED;
+            else if (jobs.empty() && status != SAVE_STATUS_FAILED) status = SAVE_STATUS_DONE;
+            if (jobs.empty()) cond.notify_all();
+        }
+    }
+
+    DWORD CSaveWriter::WriteFileAtomic(const std::string& path, const std::vector<BYTE>& data)
+    {
+        std::string tmpPath = path + ".tmp";
+        HANDLE hFile = CreateFile(tmpPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (hFile == INVALID_HANDLE_VALUE) return ::GetLastError();
+
+        DWORD error = ERROR_SUCCESS, written = 0;
+        if (!WriteFile(hFile, data.data(), static_cast<DWORD>(data.size()), &written, nullptr) || !FlushFileBuffers(hFile))
+            error = ::GetLastError();
+        else if (written != data.size())
+            error = ERROR_WRITE_FAULT;
+        CloseHandle(hFile);
+
+        // the data is on disk now, swap the files
+        if (error == ERROR_SUCCESS && !MoveFileEx(tmpPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+            error = ::GetLastError();
+
+        if (error != ERROR_SUCCESS) DeleteFile(tmpPath.c_str());
+        return error;
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+namespace CLEO
+{
+    // values are the same as CLEO_SAVE_* in the sdk
+    enum eSaveStatus
+    {
+        SAVE_STATUS_NONE,       // nothing saved in this session
+        SAVE_STATUS_PENDING,    // being written
+        SAVE_STATUS_DONE,       // the last save is on disk
+        SAVE_STATUS_FAILED,     // the last save could not be written, previous file is left intact
+    };
+
+    // writes prepared save files in a background thread;
+    // data goes to a temporary file first, which then replaces the target, so the target is never left half-written
+    class CSaveWriter
+    {
+        struct SaveJob
+        {
+            std::string path;
+            std::vector<BYTE> data;
+        };
+
+        std::thread worker;
+        std::mutex mutex;
+        std::condition_variable cond;
+        std::deque<SaveJob> jobs;
+        bool busy;
+        bool quit;
+        std::atomic<int> status;
+        std::atomic<DWORD> lastError;
+
+        void WorkerLoop();
+        static DWORD WriteFileAtomic(const std::string& path, const std::vector<BYTE>& data);
+
+    public:
+        CSaveWriter() : busy(false), quit(false), status(SAVE_STATUS_NONE), lastError(ERROR_SUCCESS) { }
+        ~CSaveWriter();
+
+        // path may be relative to the current directory, it is resolved here
+        void Write(const char *path, std::vector<BYTE>&& data);
+        // block until all the queued files are written
+        void Wait();
+        // write all the queued files and stop the thread, to be called from the game thread as the game exits
+        void Shutdown();
+        inline eSaveStatus GetStatus() const { return static_cast<eSaveStatus>(status.load()); }
+        inline DWORD GetLastSaveError() const { return lastError; }
+    };
+}
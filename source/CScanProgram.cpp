@@ -0,0 +1,393 @@
+#include "stdafx.h"
+#include "CScanProgram.h"
+
+namespace CLEO
+{
+    static inline bool IsSpace(int c)
+    {
+        return c == ' ' || (c >= '\t' && c <= '\r');
+    }
+
+    void CScanProgram::Compile(const char *format, size_t length)
+    {
+        tokens.clear();
+        text.clear();
+        numArgs = 0;
+        supported = true;
+
+        std::string source(format, length);
+        const char *iter = source.c_str();
+
+        while (*iter)
+        {
+            if (IsSpace(static_cast<BYTE>(*iter)))
+            {
+                while (IsSpace(static_cast<BYTE>(*iter))) ++iter;
+                tokens.push_back(ScanToken{ ScanToken::WHITESPACE, false, 0, 0, 0 });
+                continue;
+            }
+
+            if (*iter != '%')
+            {
+                if (tokens.empty() || tokens.back().kind != ScanToken::LITERAL)
+                    tokens.push_back(ScanToken{ ScanToken::LITERAL, false, 0, static_cast<WORD>(text.size()), 0 });
+                text += *iter++;
+                ++tokens.back().textLength;
+                continue;
+            }
+
+            ScanToken token = { ScanToken::LITERAL, false, 0, 0, 0 };
+            ++iter;
+            if (*iter == '*')
+            {
+                token.suppress = true;
+                ++iter;
+            }
+
+            unsigned width = 0;
+            for (; *iter >= '0' && *iter <= '9'; ++iter) if (width < 0xFFFF) width = width * 10 + (*iter - '0');
+            token.width = static_cast<WORD>(width < 0xFFFF ? width : 0xFFFF);
+
+            // 'l' is of the same size as int on Win32, other sizes (and %lf writing double) are left for the C runtime
+            bool longSize = *iter == 'l';
+            if (longSize) ++iter;
+
+            switch (*iter)
+            {
+            case 'd': token.kind = ScanToken::INTEGER; break;
+            case 'u': token.kind = ScanToken::UNSIGNED; break;
+            case 'x': case 'X': token.kind = ScanToken::HEX; break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                token.kind = ScanToken::REAL;
+                if (longSize) supported = false;
+                break;
+            case 's': token.kind = ScanToken::STRING; break;
+            case 'c': token.kind = ScanToken::CHARS; break;
+            case 'n': token.kind = ScanToken::COUNT; break;
+            default: supported = false; break; // %%, %[, %i, %o, %p, other sizes
+            }
+            if (!supported) return;
+            if ((token.kind == ScanToken::STRING || token.kind == ScanToken::CHARS || token.kind == ScanToken::COUNT) && longSize)
+            {
+                supported = false;  // wide characters
+                return;
+            }
+
+            ++iter;
+            if (!token.suppress) ++numArgs;
+            tokens.push_back(token);
+        }
+    }
+
+    // input of sscanf
+    class ScanStringInput
+    {
+        const char *pos, *end;
+        size_t consumed;
+
+    public:
+        ScanStringInput(const char *begin, const char *end) : pos(begin), end(end), consumed(0) { }
+        inline int Get() { ++consumed; return pos < end ? static_cast<BYTE>(*pos++) : EOF; }
+        inline void Unget(int c) { --consumed; if (c != EOF) --pos; }
+        inline size_t Consumed() const { return consumed; }
+        inline const char *Position() const { return pos; }
+    };
+
+    // input of fscanf, single character may be pushed back
+    class ScanFileInput
+    {
+        FILE *file;
+        size_t consumed;
+
+    public:
+        ScanFileInput(FILE *file) : file(file), consumed(0) { }
+        inline int Get() { ++consumed; return _getc_nolock(file); }
+        inline void Unget(int c) { --consumed; if (c != EOF) _ungetc_nolock(c, file); }
+        inline size_t Consumed() const { return consumed; }
+    };
+
+    // value of malformed number (sign without digits, '0x' without digits, exponent without digits) differs between C runtimes
+    template<typename Input>
+    class Scanner
+    {
+        const CScanProgram& program;
+        Input& input;
+        int assigned;
+        bool complete;
+
+        // input ended before the directive was done; if nothing has been assigned yet, the C runtime decides between EOF and 0
+        inline int InputFailure() const
+        {
+            return assigned ? assigned : CScanProgram::UNDECIDED;
+        }
+
+        inline int Malformed() const
+        {
+            return CScanProgram::UNDECIDED;
+        }
+
+        inline int SkipSpace()
+        {
+            int c;
+            do c = input.Get(); while (IsSpace(c));
+            return c;
+        }
+
+    public:
+        Scanner(const CScanProgram& program, Input& input) : program(program), input(input), assigned(0), complete(false) { }
+
+        // every directive of the format has been matched
+        inline bool Complete() const { return complete; }
+
+        int Run(void *const *args)
+        {
+            for (auto& token : program.tokens)
+            {
+                int c;
+                int limit = token.width ? token.width : 0x7FFFFFFF;
+                switch (token.kind)
+                {
+                case ScanToken::WHITESPACE:
+                    input.Unget(SkipSpace());
+                    continue;
+
+                case ScanToken::LITERAL:
+                {
+                    const char *chars = program.text.c_str() + token.textOffset;
+                    for (WORD i = 0; i < token.textLength; ++i)
+                    {
+                        c = input.Get();
+                        if (c == EOF) return InputFailure();
+                        if (c != static_cast<BYTE>(chars[i]))
+                        {
+                            input.Unget(c);
+                            return assigned;
+                        }
+                    }
+                    continue;
+                }
+
+                case ScanToken::COUNT:
+                    if (!token.suppress) *static_cast<int *>(*args++) = static_cast<int>(input.Consumed());
+                    continue;
+
+                case ScanToken::CHARS:
+                {
+                    if (!token.width) limit = 1;
+                    char *dst = token.suppress ? nullptr : static_cast<char *>(*args++);
+                    for (int i = 0; i < limit; ++i)
+                    {
+                        c = input.Get();
+                        if (c == EOF)
+                        {
+                            input.Unget(c);
+                            return i ? Malformed() : InputFailure();
+                        }
+                        if (dst) dst[i] = static_cast<char>(c);
+                    }
+                    if (dst) ++assigned;
+                    continue;
+                }
+
+                case ScanToken::STRING:
+                {
+                    c = SkipSpace();
+                    if (c == EOF) return InputFailure();
+                    char *dst = token.suppress ? nullptr : static_cast<char *>(*args++);
+                    for (;;)
+                    {
+                        if (dst) *dst++ = static_cast<char>(c);
+                        if (!--limit) break; // width reached, nothing more is read
+                        c = input.Get();
+                        if (c == EOF || IsSpace(c))
+                        {
+                            input.Unget(c);
+                            break;
+                        }
+                    }
+                    if (dst)
+                    {
+                        *dst = '\0';
+                        ++assigned;
+                    }
+                    continue;
+                }
+
+                default:
+                    break;
+                }
+
+                // numbers
+                c = SkipSpace();
+                if (c == EOF) return InputFailure();
+
+                char buf[64];
+                int len = 0, digits = 0;
+                auto next = [&]()
+                {
+                    if (len < 63) buf[len] = static_cast<char>(c);
+                    ++len;
+                    c = --limit ? input.Get() : EOF - 1;  // width reached, nothing more is read
+                };
+                auto done = [&]()
+                {
+                    if (c != EOF - 1) input.Unget(c);
+                };
+
+                if (c == '-' || c == '+') next();
+
+                DWORD value = 0;
+                switch (token.kind)
+                {
+                case ScanToken::INTEGER:
+                case ScanToken::UNSIGNED:
+                    for (; c >= '0' && c <= '9'; ++digits)
+                    {
+                        value = value * 10 + (c - '0');
+                        next();
+                    }
+                    done();
+                    if (!digits)
+                    {
+                        if (len) return Malformed();
+                        return assigned;
+                    }
+                    if (digits > 9) return CScanProgram::UNDECIDED; // may overflow, which C runtimes handle differently
+                    if (buf[0] == '-') value = 0u - value;
+                    if (!token.suppress)
+                    {
+                        *static_cast<DWORD *>(*args++) = value;
+                        ++assigned;
+                    }
+                    continue;
+
+                case ScanToken::HEX:
+                    if (c == '0')
+                    {
+                        next();
+                        ++digits;
+                        if (c == 'x' || c == 'X')
+                        {
+                            next();
+                            digits = 0;
+                            if (c == EOF - 1 || c == EOF || !isxdigit(c))
+                            {
+                                done();
+                                return Malformed();
+                            }
+                        }
+                    }
+                    for (; c != EOF - 1 && c != EOF && isxdigit(c); ++digits)
+                    {
+                        value = value * 16 + (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+                        next();
+                    }
+                    done();
+                    if (!digits)
+                    {
+                        if (len) return Malformed();
+                        return assigned;
+                    }
+                    if (digits > 8) return CScanProgram::UNDECIDED;
+                    if (buf[0] == '-') value = 0u - value;
+                    if (!token.suppress)
+                    {
+                        *static_cast<DWORD *>(*args++) = value;
+                        ++assigned;
+                    }
+                    continue;
+
+                default: // REAL
+                {
+                    bool leadingZero = c == '0';
+                    for (; c >= '0' && c <= '9'; ++digits) next();
+                    if (leadingZero && digits == 1 && (c == 'x' || c == 'X'))
+                    {
+                        // hex float
+                        done();
+                        return Malformed();
+                    }
+                    if (c == '.')
+                    {
+                        next();
+                        for (; c >= '0' && c <= '9'; ++digits) next();
+                    }
+                    if (!digits)
+                    {
+                        done();
+                        if (len) return Malformed(); // also inf, nan after sign
+                        if (c == 'i' || c == 'I' || c == 'n' || c == 'N') return CScanProgram::UNDECIDED;
+                        return assigned;
+                    }
+                    if (c == 'e' || c == 'E')
+                    {
+                        next();
+                        if (c == '-' || c == '+') next();
+                        int expDigits = 0;
+                        for (; c >= '0' && c <= '9'; ++expDigits) next();
+                        if (!expDigits)
+                        {
+                            done();
+                            return Malformed();
+                        }
+                    }
+                    done();
+                    if (len > 63) return CScanProgram::UNDECIDED;
+                    buf[len] = '\0';
+                    if (!token.suppress)
+                    {
+                        // the C runtime converts the same text the same way
+                        *static_cast<float *>(*args++) = strtof(buf, nullptr);
+                        ++assigned;
+                    }
+                    continue;
+                }
+                }
+            }
+            complete = true;
+            return assigned;
+        }
+    };
+
+    int CScanProgram::Scan(const char *&input, const char *end, void *const *args) const
+    {
+        ScanStringInput source(input, end);
+        Scanner<ScanStringInput> scanner(*this, source);
+        int result = scanner.Run(args);
+        if (scanner.Complete()) input = source.Position();
+        return result;
+    }
+
+    int CScanProgram::Scan(FILE *file, void *const *args) const
+    {
+        long start = _ftell_nolock(file);
+        if (start < 0) return UNDECIDED;
+
+        ScanFileInput source(file);
+        int result = Scanner<ScanFileInput>(*this, source).Run(args);
+        if (result == UNDECIDED) _fseek_nolock(file, start, SEEK_SET);
+        return result;
+    }
+
+    bool CScanProgram::MayWrite(void *const *args, size_t inputLength, const void *begin, const void *end) const
+    {
+        for (auto& token : tokens)
+        {
+            size_t size;
+            switch (token.kind)
+            {
+            case ScanToken::WHITESPACE:
+            case ScanToken::LITERAL:
+                continue;
+            case ScanToken::CHARS: size = token.width ? token.width : 1; break;
+            case ScanToken::STRING: size = (token.width && token.width < inputLength ? token.width : inputLength) + 1; break;
+            default: size = 4; break;
+            }
+            if (token.suppress) continue;
+
+            auto dst = static_cast<const char *>(*args++);
+            if (dst < static_cast<const char *>(end) && dst + size > static_cast<const char *>(begin)) return true;
+        }
+        return false;
+    }
+}
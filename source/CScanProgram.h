@@ -0,0 +1,61 @@
+#pragma once
+#include "CFormatCache.h"
+
+namespace CLEO
+{
+    // single directive of format string of scanning opcodes (0AD4, 0ADA)
+    struct ScanToken
+    {
+        enum Kind : BYTE
+        {
+            WHITESPACE,                     // skips any white space of the input
+            LITERAL,                        // characters the input has to match
+            INTEGER,                        // %d
+            UNSIGNED,                       // %u
+            HEX,                            // %x %X
+            REAL,                           // %f %e %g %a (and uppercase), float
+            STRING,                         // %s
+            CHARS,                          // %c
+            COUNT,                          // %n, characters read so far
+        };
+
+        Kind kind;
+        bool suppress;                      // '*', the value is read, but not assigned
+        WORD width;                         // 0 if not limited
+        WORD textOffset, textLength;        // in CScanProgram::text: characters of literal
+    };
+
+    // format string of sscanf and fscanf compiled to directives reading the input directly into the operands
+    // only the subset of formats behaving the same in every C runtime is supported, for the others sscanf/fscanf has to be used
+    class CScanProgram
+    {
+    public:
+        static const int UNDECIDED = -2;    // result of scan the compiled program can not tell the same way as the C runtime
+
+        std::vector<ScanToken> tokens;
+        std::string text;
+        size_t numArgs;                     // pointers of values the format needs
+        bool supported;
+
+        CScanProgram() : numArgs(0), supported(false) { }
+
+        void Compile(const char *format, size_t length);
+
+        inline bool CanScan(size_t numProvided) const { return supported && numArgs <= numProvided; }
+
+        // scans the input up to end, advancing it past the scanned characters if the whole format has been matched;
+        // returns the number of assigned values, or UNDECIDED if the input is ambiguous
+        // (the values may have been assigned, sscanf has to scan it again)
+        int Scan(const char *&input, const char *end, void *const *args) const;
+
+        // scans the file, which has to be locked by the caller; same results as the scan of text
+        // if UNDECIDED, the file is back at the position it had before (fscanf has to scan it again),
+        // files that can not tell their position are not scanned at all
+        int Scan(FILE *file, void *const *args) const;
+
+        // true if any value assigned by a scan of input of up to inputLength characters may overlap the memory
+        bool MayWrite(void *const *args, size_t inputLength, const void *begin, const void *end) const;
+    };
+
+    typedef CCompiledFormatCache<CScanProgram> CScanCache;
+}
@@ -0,0 +1,231 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include "ScriptParams.h"
+#include "CBytecodeVerifier.h"
+
+// Calls of scm functions (0AB1, 0AB2): frames keeping the state of the caller and the passing of arguments and results.
+// Depends only on the operand decoder, so the calls can be run outside of the game too.
+
+namespace CLEO
+{
+    // frame of scm function call (0AB1), keeps the state of the caller until the function returns (0AB2)
+    struct ScmFunction
+    {
+        BYTE *retnAddress;
+        SCRIPT_VAR savedTls[NUM_FUNCTION_LOCALS];
+        BYTE numLocals;                         // first locals of the scope saved in savedTls
+        bool savedCondResult;
+        eLogicalOperation savedLogicalOp;
+        bool savedNotFlag;
+        size_t stringsMark;                     // string arena position of the call stack when called
+
+        // the function may access only first numLocals local variables, the others are left as they are
+        void Enter(CRunningScript *thread, BYTE numLocals)
+        {
+            // create snapshot of current scope
+            auto scope = GetScriptLocalVarPointer(thread, 0);
+            std::copy(scope, scope + numLocals, savedTls);
+            this->numLocals = numLocals;
+            savedCondResult = thread->GetConditionResult();
+            savedLogicalOp = thread->GetLogicalOp();
+            savedNotFlag = thread->GetNotFlag();
+
+            thread->SetConditionResult(false);
+            thread->SetLogicalOp(eLogicalOperation::NONE);
+            thread->SetNotFlag(false);
+        }
+
+        void Return(CRunningScript *thread)
+        {
+            // restore parent scope's local variables
+            std::copy(savedTls, savedTls + numLocals, GetScriptLocalVarPointer(thread, 0));
+
+            // process conditional result of just ended function in parent scope
+            bool condResult = thread->GetConditionResult();
+            if (savedNotFlag) condResult = !condResult;
+
+            if (savedLogicalOp >= eLogicalOperation::AND_2 && savedLogicalOp < eLogicalOperation::AND_END)
+            {
+                thread->SetConditionResult(savedCondResult && condResult);
+                thread->SetLogicalOp(--savedLogicalOp);
+            }
+            else if (savedLogicalOp >= eLogicalOperation::OR_2 && savedLogicalOp < eLogicalOperation::OR_END)
+            {
+                thread->SetConditionResult(savedCondResult || condResult);
+                thread->SetLogicalOp(--savedLogicalOp);
+            }
+            else // eLogicalOperation::NONE
+            {
+                thread->SetConditionResult(condResult);
+                thread->SetLogicalOp(savedLogicalOp);
+            }
+
+            thread->SetIp(retnAddress);
+        }
+    };
+
+    // scm function calls of a script
+    // frames are kept in slabs, so they do not move (arguments may point into savedTls of the frame) and are reused by later calls,
+    // the same way texts passed to functions are kept in chunks of the string arena, so calls do not allocate once the stack is deep enough
+    class ScmCallStack
+    {
+        static const size_t FRAMES_PER_SLAB = 16;
+        static const size_t STRING_CHUNK_SIZE = 0x1000;
+
+        std::vector<std::unique_ptr<ScmFunction[]>> slabs;
+        std::vector<std::unique_ptr<char[]>> chunks;
+        size_t depth;
+        size_t stringsPos;                      // chunk index * STRING_CHUNK_SIZE + offset in the chunk
+
+    public:
+        CRunningScript *owner;
+
+        ScmCallStack() : depth(0), stringsPos(0), owner(nullptr) { }
+
+        inline bool Empty() const { return !depth; }
+        inline size_t Depth() const { return depth; }
+        inline ScmFunction& Top() { return slabs[(depth - 1) / FRAMES_PER_SLAB][(depth - 1) % FRAMES_PER_SLAB]; }
+
+        ScmFunction& Push()
+        {
+            if (depth / FRAMES_PER_SLAB == slabs.size())
+                slabs.emplace_back(new ScmFunction[FRAMES_PER_SLAB]);
+            ++depth;
+            auto& frame = Top();
+            frame.stringsMark = stringsPos;
+            return frame;
+        }
+
+        // texts of the frame are released too
+        void Pop()
+        {
+            stringsPos = Top().stringsMark;
+            --depth;
+        }
+
+        void Clear()
+        {
+            depth = stringsPos = 0;
+            owner = nullptr;
+        }
+
+        // copy of the text living until the current frame is popped
+        char *StoreString(const ScriptStringView& text)
+        {
+            size_t len = text.length + 1;
+            if (len > STRING_CHUNK_SIZE) len = STRING_CHUNK_SIZE;
+
+            size_t chunk = stringsPos / STRING_CHUNK_SIZE, offset = stringsPos % STRING_CHUNK_SIZE;
+            if (offset + len > STRING_CHUNK_SIZE)
+            {
+                ++chunk;
+                offset = 0;
+            }
+            if (chunk == chunks.size()) chunks.emplace_back(new char[STRING_CHUNK_SIZE]);
+
+            char *copy = &chunks[chunk][offset];
+            if (len > 1) memcpy(copy, text.data, len - 1);
+            copy[len - 1] = '\0';
+            stringsPos = chunk * STRING_CHUNK_SIZE + offset + len;
+            return copy;
+        }
+    };
+
+    // rest of 0AB1 after its label and number of params: collects the arguments, saves first numLocals locals of the caller
+    // (more if a text passed by variable lies beyond them) and jumps to the function; clearLocals zeroes the locals not taken by arguments
+    inline void CallScmFunction(CRunningScript *thread, ScmCallStack& stack, int label, DWORD nParams, DWORD numLocals, bool clearLocals)
+    {
+        DWORD nArgs = (std::min)(nParams, static_cast<DWORD>(NUM_FUNCTION_LOCALS));
+        numLocals = (std::max)(numLocals, nArgs);
+        auto& scmFunc = stack.Push();
+
+        SCRIPT_VAR arguments[NUM_FUNCTION_LOCALS];
+        SCRIPT_VAR *locals = GetScriptLocalVarPointer(thread, 0);
+        SCRIPT_VAR *localsEnd = locals + NUM_FUNCTION_LOCALS;
+
+        // collect arguments
+        for (DWORD i = 0; i < nArgs; i++)
+        {
+            SCRIPT_VAR *arg = arguments + i;
+            BYTE type = *thread->GetBytePointer();
+
+            switch (type)
+            {
+            case DT_FLOAT:
+            case DT_DWORD:
+            case DT_WORD:
+            case DT_BYTE:
+            case DT_VAR:
+            case DT_LVAR:
+            case DT_VAR_ARRAY:
+            case DT_LVAR_ARRAY:
+                ReadScriptParams(thread, arg, 1);
+                break;
+
+            case DT_VAR_STRING:
+            case DT_LVAR_STRING:
+            case DT_VAR_TEXTLABEL:
+            case DT_LVAR_TEXTLABEL:
+            {
+                auto var = ReadScriptParamPointer(thread);
+                arg->pParam = var;
+                if (var >= locals && var < localsEnd) // correct scoped variable's pointer
+                {
+                    // the whole text has to be in the snapshot
+                    DWORD index = static_cast<DWORD>(var - locals);
+                    DWORD textSize = (type == DT_VAR_STRING || type == DT_LVAR_STRING) ? 4 : 2;
+                    numLocals = (std::min)((std::max)(numLocals, index + textSize), static_cast<DWORD>(NUM_FUNCTION_LOCALS));
+                    arg->pParam = scmFunc.savedTls + index;
+                }
+                break;
+            }
+
+            case DT_STRING:
+            case DT_TEXTLABEL:
+            case DT_VARLEN_STRING:
+            {
+                // those texts exist in script code, but without terminator character, copy is necessary
+                ScriptStringView text;
+                ReadScriptStringView(thread, text);
+                arg->pcParam = stack.StoreString(text);
+                break;
+            }
+            }
+        }
+
+        // skip unused args
+        for (DWORD i = nArgs; i < nParams; i++) SkipScriptParam(thread);
+
+        // all arguments read
+        scmFunc.Enter(thread, static_cast<BYTE>(numLocals));
+        scmFunc.retnAddress = thread->GetBytePointer();
+
+        // pass arguments as new scope local variables
+        memcpy(locals, arguments, nArgs * sizeof(SCRIPT_VAR));
+        if (clearLocals)
+        {
+            for (DWORD i = nArgs; i < numLocals; i++) locals[i].dwParam = 0;
+        }
+
+        // jump to label
+        thread->SetIp(label < 0 ? thread->GetBasePointer() - label : scmBlock + label);
+    }
+
+    // 0AB2 of the function on top of the stack: returns to the caller, storing the results into the variables given by its 0AB1
+    inline void ReturnFromScmFunction(CRunningScript *thread, ScmCallStack& stack)
+    {
+        SCRIPT_VAR results[NUM_FUNCTION_LOCALS], nRetParams;
+        ReadScriptParams(thread, &nRetParams, 1);
+        int count = static_cast<int>((std::min)(nRetParams.dwParam, static_cast<DWORD>(NUM_FUNCTION_LOCALS)));
+        ReadScriptParams(thread, results, count);
+
+        stack.Top().Return(thread);
+        WriteScriptParams(thread, results, count);
+
+        // skip the rest of 0AB1's operands
+        while (*thread->GetBytePointer()) SkipScriptParam(thread);
+        thread->IncPtr();
+        stack.Pop();
+    }
+}
@@ -0,0 +1,86 @@
+#include "stdafx.h"
+#include "CScriptBlobStorage.h"
+#include "CSaveFile.h"
+
+namespace CLEO
+{
+    void CScriptBlobStorage::BuildRecord(DWORD hash, const std::string& name, Blob& blob)
+    {
+        auto& record = blob.record;
+        DWORD size = static_cast<DWORD>(blob.data.size());
+        BYTE nameLen = static_cast<BYTE>(name.size());
+
+        record.clear();
+        record.reserve(sizeof(hash) + sizeof(nameLen) + nameLen + sizeof(size) + size);
+        record.insert(record.end(), reinterpret_cast<const BYTE *>(&hash), reinterpret_cast<const BYTE *>(&hash + 1));
+        record.push_back(nameLen);
+        record.insert(record.end(), name.begin(), name.end());
+        record.insert(record.end(), reinterpret_cast<const BYTE *>(&size), reinterpret_cast<const BYTE *>(&size + 1));
+        record.insert(record.end(), blob.data.begin(), blob.data.end());
+    }
+
+    bool CScriptBlobStorage::Set(DWORD hash, const char *name, const void *data, size_t size)
+    {
+        if (!name || strlen(name) > MAX_NAME_LEN || (size && !data)) return false;
+
+        auto bytes = reinterpret_cast<const BYTE *>(data);
+        auto& blob = blobs[std::make_pair(hash, std::string(name))];
+        if (blob.data.size() == size && (!size || !memcmp(blob.data.data(), bytes, size)) && !blob.record.empty())
+            return true; // unchanged, keep the record
+
+        blob.data.assign(bytes, bytes + size);
+        blob.record.clear();
+        return true;
+    }
+
+    const std::vector<BYTE> *CScriptBlobStorage::Get(DWORD hash, const char *name) const
+    {
+        if (!name) return nullptr;
+        auto it = blobs.find(std::make_pair(hash, std::string(name)));
+        return it != blobs.end() ? &it->second.data : nullptr;
+    }
+
+    bool CScriptBlobStorage::Remove(DWORD hash, const char *name)
+    {
+        return name && blobs.erase(std::make_pair(hash, std::string(name))) != 0;
+    }
+
+    std::vector<BYTE> CScriptBlobStorage::Serialize()
+    {
+        size_t total = 0;
+        for (auto& entry : blobs)
+        {
+            if (entry.second.record.empty()) BuildRecord(entry.first.first, entry.first.second, entry.second);
+            total += entry.second.record.size();
+        }
+
+        std::vector<BYTE> buf;
+        buf.reserve(total);
+        for (auto& entry : blobs) buf.insert(buf.end(), entry.second.record.begin(), entry.second.record.end());
+        return buf;
+    }
+
+    void CScriptBlobStorage::Deserialize(const BYTE *data, size_t size)
+    {
+        blobs.clear();
+        CSaveDataReader reader(data, size);
+        while (reader.Remaining())
+        {
+            DWORD hash, dataSize;
+            BYTE nameLen;
+            char name[MAX_NAME_LEN + 1];
+
+            reader.Read(hash);
+            reader.Read(nameLen);
+            reader.Read(name, nameLen);
+            name[nameLen] = '\0';
+            reader.Read(dataSize);
+            if (dataSize > reader.Remaining()) throw std::runtime_error("Unexpected end of saved data");
+
+            auto& blob = blobs[std::make_pair(hash, std::string(name, nameLen))];
+            blob.data.resize(dataSize);
+            if (dataSize) reader.Read(blob.data.data(), dataSize);
+            BuildRecord(hash, std::string(name, nameLen), blob);
+        }
+    }
+}
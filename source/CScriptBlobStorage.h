@@ -0,0 +1,35 @@
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+
+namespace CLEO
+{
+    // named binary data of custom scripts, kept in cleo saves by the checksum of the script (SAVE_SECTION_BLOBS)
+    class CScriptBlobStorage
+    {
+        struct Blob
+        {
+            std::vector<BYTE> data;
+            std::vector<BYTE> record;   // serialized form, rebuilt only if the data has changed since
+        };
+
+        // ordered, so the same blobs are always saved the same way
+        std::map<std::pair<DWORD, std::string>, Blob> blobs;
+
+        static void BuildRecord(DWORD hash, const std::string& name, Blob& blob);
+
+    public:
+        static const size_t MAX_NAME_LEN = 255;
+
+        bool Set(DWORD hash, const char *name, const void *data, size_t size);
+        const std::vector<BYTE> *Get(DWORD hash, const char *name) const;
+        bool Remove(DWORD hash, const char *name);
+        void Clear() { blobs.clear(); }
+        size_t Count() const { return blobs.size(); }
+
+        // record per blob: hash, name length (byte), name, data size, data
+        std::vector<BYTE> Serialize();
+        void Deserialize(const BYTE *data, size_t size);
+    };
+}
@@ -1,5 +1,6 @@
 #include "stdafx.h"
 #include "cleo.h"
+#include "CSaveFile.h"
 
 namespace CLEO
 {
@@ -310,9 +311,10 @@ namespace CLEO
         unsigned n_stopped_threads;
     };
 
-    const unsigned CleoSafeHeader::sign = 0x31345653;
+    const unsigned CleoSafeHeader::sign = LEGACY_SAVE_FILE_SIGNATURE;
 
-    struct ThreadSavingInfo
+    // saved thread as it was written by CLEO 4.4.4 and older (raw dump of the structure)
+    struct LegacyThreadSavingInfo
     {
         unsigned long hash;
         SCRIPT_VAR tls[32];
@@ -323,10 +325,25 @@ namespace CLEO
         bool notFlag;
         ptrdiff_t ip_diff;
         char threadName[8];
+    };
+
+#pragma pack(push, 1)
+    // record of SAVE_SECTION_THREADS, all fields are of fixed size, new fields can only be appended
+    struct ThreadSavingInfo
+    {
+        DWORD hash;
+        DWORD ip_offset;
+        DWORD sleepTime;
+        DWORD timers[2];
+        WORD logicalOp;
+        BYTE condResult;
+        BYTE notFlag;
+        char threadName[8];
+        SCRIPT_VAR tls[32];
 
         ThreadSavingInfo(CCustomScript *cs) :
-            hash(cs->dwChecksum), condResult(cs->bCondResult),
-            logicalOp(cs->LogicalOp), notFlag(cs->NotFlag != false), ip_diff(cs->CurrentIP - reinterpret_cast<BYTE*>(cs->BaseIP))
+            hash(cs->dwChecksum), ip_offset(cs->CurrentIP - reinterpret_cast<BYTE*>(cs->BaseIP)),
+            logicalOp(cs->LogicalOp), condResult(cs->bCondResult), notFlag(cs->NotFlag != false)
         {
             sleepTime = cs->WakeTime >= *GameTimer ? 0 : cs->WakeTime - *GameTimer;
             std::copy(cs->LocalVar, cs->LocalVar + 32, tls);
@@ -334,47 +351,46 @@ namespace CLEO
             std::copy(cs->Name, cs->Name + 8, threadName);
         }
 
+        ThreadSavingInfo(const LegacyThreadSavingInfo& info) :
+            hash(info.hash), ip_offset(info.ip_diff), sleepTime(info.sleepTime),
+            logicalOp(info.logicalOp), condResult(info.condResult), notFlag(info.notFlag)
+        {
+            std::copy(info.tls, info.tls + 32, tls);
+            std::copy(info.timers, info.timers + 2, timers);
+            std::copy(info.threadName, info.threadName + 8, threadName);
+        }
+
         void Apply(CCustomScript *cs)
         {
             cs->dwChecksum = hash;
             std::copy(tls, tls + 32, cs->LocalVar);
             std::copy(timers, timers + 2, cs->Timers);
-            cs->bCondResult = condResult;
+            cs->bCondResult = condResult != 0;
             cs->WakeTime = *GameTimer + sleepTime;
-            cs->LogicalOp = logicalOp;
-            cs->NotFlag = notFlag;
-            cs->CurrentIP = reinterpret_cast<BYTE*>(cs->BaseIP) + ip_diff;
+            cs->LogicalOp = static_cast<eLogicalOperation>(logicalOp);
+            cs->NotFlag = notFlag != 0;
+            cs->CurrentIP = reinterpret_cast<BYTE*>(cs->BaseIP) + ip_offset;
             std::copy(threadName, threadName + 8, cs->Name);
             cs->bSaveEnabled = true;
         }
 
         ThreadSavingInfo() { }
     };
+#pragma pack(pop)
 
-    SCRIPT_VAR CScriptEngine::CleoVariables[0x400];
+    SCRIPT_VAR CScriptEngine::CleoVariables[NUM_CLEO_VARIABLES];
 
     template<typename T>
-    void inline ReadBinary(std::istream& s, T& buf)
+    void inline WriteBinary(std::vector<BYTE>& buf, const T*data, size_t size)
     {
-        s.read(reinterpret_cast<char *>(&buf), sizeof(T));
+        auto bytes = reinterpret_cast<const BYTE *>(data);
+        buf.insert(buf.end(), bytes, bytes + sizeof(T) * size);
     }
 
     template<typename T>
-    void inline ReadBinary(std::istream& s, T *buf, size_t size)
+    void inline WriteBinary(std::vector<BYTE>& buf, const T& data)
     {
-        s.read(reinterpret_cast<char *>(buf), sizeof(T) * size);
-    }
-
-    template<typename T>
-    void inline WriteBinary(std::ostream& s, const T& data)
-    {
-        s.write(reinterpret_cast<const char *>(&data), sizeof(T));
-    }
-
-    template<typename T>
-    void inline WriteBinary(std::ostream& s, const T*data, size_t size)
-    {
-        s.write(reinterpret_cast<const char *>(data), sizeof(T) * size);
+        WriteBinary(buf, &data, 1);
     }
 
     void __fastcall HOOK_ProcessScript(CCustomScript * pScript, int)
@@ -391,7 +407,7 @@ namespace CLEO
         return bBeforeFade ? DrawScriptStuff_H(bBeforeFade) : DrawScriptStuff(bBeforeFade);
     }
 
-#define NUM_STORED_SPRITES 128
+#define NUM_STORED_SPRITES NUM_SCRIPT_TEXTURES
 #define NUM_STORED_DRAWS 128
 #define NUM_STORED_TEXTS 96
 #define DRAW_DATA_SIZE 60
@@ -445,8 +461,47 @@ namespace CLEO
         if (auto script = GetCustomMission())
             script->Draw(bBeforeFade);
     }
+    bool CCustomScript::IsProcessedByGame()
+    {
+        // the game's Process also handles cutscene skips, death/arrest checks (done for scripts with mission cleanup) and failing of missions
+        return bIsMission || bUseMissionCleanup || SceneSkipIP;
+    }
+
+    bool CCustomScript::IsDormant()
+    {
+        // the game would only do the wake time check for such script
+        return !IsProcessedByGame() && WakeTime > *GameTimer;
+    }
+
+    void CCustomScript::RunCommands()
+    {
+        // without the switch data reset the game's loop has to be used, 0871/0872 would see the switch of the previous script
+        if (IsProcessedByGame() || !ReinitialiseSwitchStatementData) ProcessScript(this);
+        else if (WakeTime <= *GameTimer) ScriptExecutionLoop(this);
+    }
     void CCustomScript::Process()
     {
+        if (IsDormant())
+        {
+            // no need to swap anything in, just drop per-frame draws the same way it is done below
+            if (UseTextCommands)
+            {
+                script_draws.clear();
+                script_texts.clear();
+                NumDraws = NumTexts = 0;
+                if (UseTextCommands == 1)
+                    UseTextCommands = 0;
+            }
+            return;
+        }
+
+        if (script_draws.empty() && script_texts.empty() && !UseTextCommands)
+        {
+            ProcessWithoutDrawState();
+            CheckNameChange();
+            return;
+        }
+
         RestoreScriptSpecifics();
 
         bool bNeedDefaults = false;
@@ -460,9 +515,55 @@ namespace CLEO
                 *useTextCommands = 0;
         }
 		
-		ProcessScript(this);
+		RunCommands();
 
         StoreScriptSpecifics();
+        CheckNameChange();
+    }
+    void CCustomScript::CheckNameChange()
+    {
+        // the script may have been renamed (03A4) or ended during this run
+        auto& engine = GetInstance().ScriptEngine;
+        if (GetScriptNameKey(Name) != NameKey && engine.CustomScripts.contains(this))
+        {
+            engine.UnindexScriptName(this);
+            engine.IndexScriptName(this);
+        }
+    }
+    void CCustomScript::ProcessWithoutDrawState()
+    {
+        // the script has nothing to show, so run it on top of SCM draws and texts
+        // and only take away what it has added (if anything), instead of swapping both arrays
+        WORD scmDraws = *numScriptDraws, scmTexts = *numScriptTexts;
+        BYTE scmUseTextCommands = *useTextCommands;
+
+        // next free entries may be altered by text style opcodes, without adding anything
+        BYTE pendingDraw[DRAW_DATA_SIZE], pendingText[TEXT_DATA_SIZE];
+        BYTE *drawSlot = scmDraws < NUM_STORED_DRAWS ? &scriptDraws[scmDraws * DRAW_DATA_SIZE] : nullptr;
+        BYTE *textSlot = scmTexts < NUM_STORED_TEXTS ? &scriptTexts[scmTexts * TEXT_DATA_SIZE] : nullptr;
+        if (drawSlot) memcpy(pendingDraw, drawSlot, DRAW_DATA_SIZE);
+        if (textSlot) memcpy(pendingText, textSlot, TEXT_DATA_SIZE);
+        *useTextCommands = 0;
+
+        RestoreScriptTextures();
+        RunCommands();
+        StoreScriptTextures();
+
+        if (*numScriptDraws > scmDraws || *numScriptTexts > scmTexts || *useTextCommands)
+        {
+            // the script has started drawing, keep its entries from now on
+            NumDraws = max(*numScriptDraws, scmDraws) - scmDraws;
+            NumTexts = max(*numScriptTexts, scmTexts) - scmTexts;
+            if (NumDraws) script_draws.assign(scriptDraws + scmDraws * DRAW_DATA_SIZE, scriptDraws + (scmDraws + NumDraws) * DRAW_DATA_SIZE);
+            if (NumTexts) script_texts.assign(scriptTexts + scmTexts * TEXT_DATA_SIZE, scriptTexts + (scmTexts + NumTexts) * TEXT_DATA_SIZE);
+            UseTextCommands = *useTextCommands;
+        }
+
+        if (drawSlot) memcpy(drawSlot, pendingDraw, DRAW_DATA_SIZE);
+        if (textSlot) memcpy(textSlot, pendingText, TEXT_DATA_SIZE);
+        *numScriptDraws = scmDraws;
+        *numScriptTexts = scmTexts;
+        *useTextCommands = scmUseTextCommands;
     }
     void CCustomScript::Draw(char bBeforeFade)
     {
@@ -533,39 +634,23 @@ namespace CLEO
     void CCustomScript::StoreScriptTextures()
     {
         // store this scripts textures + restore SCM textures + make sure this scripts textures arent cleared by another
-        if (script_textures.size())
-            script_textures.clear();
-        for (int i = 0; i<NUM_STORED_SPRITES; ++i)
-        {
-            script_textures.push_back(*(RwTexture**)&scriptSprites[i]);
-            scriptSprites[i] = storedSprites[i];
-        }
-
-        //std::copy(scriptSprites, scriptSprites + NUM_STORED_SPRITES, storedSprites);
+        memcpy(script_textures, scriptSprites, sizeof(script_textures));
+        memcpy(scriptSprites, storedSprites, sizeof(storedSprites));
+        bTexturesRestored = false;
     }
     void CCustomScript::RestoreScriptTextures()
     {
-        int n = 0;
-
         // store SCM textures
-        for (int i = 0; i<NUM_STORED_SPRITES; ++i)
-        {
-            storedSprites[i] = scriptSprites[i];
-        }
-        //std::copy(scriptSprites, scriptSprites + NUM_STORED_SPRITES, storedSprites);
+        memcpy(storedSprites, scriptSprites, sizeof(storedSprites));
 
-        // ensure SCM textures arent cleared - except by the SCM
-        if (!script_textures.size())
-            std::fill((RwTexture**)scriptSprites, (RwTexture**)scriptSprites + NUM_STORED_SPRITES, nullptr);
-        else
-        {
-            // restore textures for this script
-            for (auto i = script_textures.begin(); i != script_textures.end(); ++i, ++n)
-            {
-                if (n >= NUM_STORED_SPRITES) break;
-                *(RwTexture**)(&scriptSprites[n]) = *i;
-            }
-        }
+        // restore textures for this script (SCM textures arent cleared - except by the SCM)
+        memcpy(scriptSprites, script_textures, sizeof(script_textures));
+        bTexturesRestored = true;
+    }
+    RwTexture* CCustomScript::GetScriptTextureById(unsigned int id)
+    {
+        if (id >= NUM_SCRIPT_TEXTURES) return nullptr;
+        return bTexturesRestored ? *(RwTexture**)&scriptSprites[id] : script_textures[id];
     }
     void CCustomScript::StoreScriptSpecifics()
     {
@@ -667,6 +752,75 @@ namespace CLEO
     unsigned long *stopped_info;
     std::unique_ptr<ThreadSavingInfo[]> safe_info_utilizer;
     std::unique_ptr<unsigned long[]> stopped_info_utilizer;
+    std::unordered_map<unsigned long, ThreadSavingInfo *> safe_info_index;     // first saved thread with the hash
+
+    // cs*.sav of CLEO 4.4.4 and older: header, variables, then saved and stopped threads
+    static void LoadLegacySave(CSaveFileReader& file)
+    {
+        CSaveDataReader reader(file.GetData(), file.GetSize());
+        reader.Read(safe_header);
+        if (safe_header.n_saved_threads > reader.Remaining() / sizeof(LegacyThreadSavingInfo) ||
+            safe_header.n_stopped_threads > reader.Remaining() / sizeof(unsigned long))
+            throw std::runtime_error("Unexpected end of saved data");
+
+        safe_info = new ThreadSavingInfo[safe_header.n_saved_threads];
+        safe_info_utilizer.reset(safe_info);
+        stopped_info = new unsigned long[safe_header.n_stopped_threads];
+        stopped_info_utilizer.reset(stopped_info);
+        reader.Read(CScriptEngine::CleoVariables, NUM_CLEO_VARIABLES);
+        for (size_t i = 0; i < safe_header.n_saved_threads; ++i)
+        {
+            LegacyThreadSavingInfo info;
+            reader.Read(info);
+            safe_info[i] = ThreadSavingInfo(info);
+        }
+        reader.Read(stopped_info, safe_header.n_stopped_threads);
+    }
+
+    static void LoadSave(CSaveFileReader& file, CGlobalVarStore& vars, CScriptBlobStorage& blobs)
+    {
+        const BYTE *data;
+        size_t size;
+
+        memset(CScriptEngine::CleoVariables, 0, sizeof(CScriptEngine::CleoVariables));
+        if (file.GetSection(SAVE_SECTION_VARIABLES, data, size))
+            memcpy(CScriptEngine::CleoVariables, data, min(size, sizeof(CScriptEngine::CleoVariables)));
+
+        safe_header.n_saved_threads = 0;
+        if (file.GetSection(SAVE_SECTION_THREADS, data, size))
+        {
+            CSaveDataReader reader(data, size);
+            DWORD recordSize;
+            reader.Read(recordSize);
+            if (!recordSize) throw std::runtime_error("Invalid thread record size");
+
+            // records of other size are written by other versions, missing fields are zeroed, unknown skipped
+            safe_header.n_saved_threads = reader.Remaining() / recordSize;
+            safe_info = new ThreadSavingInfo[safe_header.n_saved_threads];
+            safe_info_utilizer.reset(safe_info);
+            for (size_t i = 0; i < safe_header.n_saved_threads; ++i)
+            {
+                memset(&safe_info[i], 0, sizeof(ThreadSavingInfo));
+                reader.Read(static_cast<void *>(&safe_info[i]), min(recordSize, sizeof(ThreadSavingInfo)));
+                if (recordSize > sizeof(ThreadSavingInfo)) reader.Skip(recordSize - sizeof(ThreadSavingInfo));
+            }
+        }
+
+        safe_header.n_stopped_threads = 0;
+        if (file.GetSection(SAVE_SECTION_STOPPED_THREADS, data, size))
+        {
+            safe_header.n_stopped_threads = size / sizeof(DWORD);
+            stopped_info = new unsigned long[safe_header.n_stopped_threads];
+            stopped_info_utilizer.reset(stopped_info);
+            CSaveDataReader(data, size).Read(stopped_info, safe_header.n_stopped_threads);
+        }
+
+        if (file.GetSection(SAVE_SECTION_GLOBAL_VARS, data, size))
+            vars.Deserialize(data, size);
+
+        if (file.GetSection(SAVE_SECTION_BLOBS, data, size))
+            blobs.Deserialize(data, size);
+    }
 
     void CScriptEngine::LoadCustomScripts(bool load_mode)
     {
@@ -680,28 +834,31 @@ namespace CLEO
 
         safe_info = nullptr;
         stopped_info = nullptr;
+        safe_info_index.clear();
         safe_header.n_saved_threads = safe_header.n_stopped_threads = 0;
+        GlobalVars.Clear();
+        ScriptBlobs.Clear();
 
         if (load_mode)
         {
+            // the save may still be being written
+            SaveWriter.Wait();
+
             // load cleo saving file
             try
             {
                 TRACE("Loading cleo safe %s", safe_name);
-                std::ifstream ss(safe_name, std::ios::binary);
-                if (ss.is_open())
+                CSaveFileReader file;
+                if (file.Open(safe_name))
                 {
-                    ss.exceptions(std::ios::eofbit | std::ios::badbit | std::ios::failbit);
-                    ReadBinary(ss, safe_header);
-                    if (safe_header.signature != CleoSafeHeader::sign)
-                        throw std::runtime_error("Invalid file format");
-                    safe_info = new ThreadSavingInfo[safe_header.n_saved_threads];
-                    safe_info_utilizer.reset(safe_info);
-                    stopped_info = new unsigned long[safe_header.n_stopped_threads];
-                    stopped_info_utilizer.reset(stopped_info);
-                    ReadBinary(ss, CleoVariables, 0x400);
-                    ReadBinary(ss, safe_info, safe_header.n_saved_threads);
-                    ReadBinary(ss, stopped_info, safe_header.n_stopped_threads);
+                    if (file.IsLegacy()) LoadLegacySave(file);
+                    else LoadSave(file, GlobalVars, ScriptBlobs);
+
+                    // index the lists, so scripts can be looked up in them at once
+                    safe_info_index.reserve(safe_header.n_saved_threads);
+                    for (size_t i = 0; i < safe_header.n_saved_threads; ++i)
+                        safe_info_index.emplace(safe_info[i].hash, &safe_info[i]);
+                    std::sort(stopped_info, stopped_info + safe_header.n_stopped_threads);
                     for (size_t i = 0; i < safe_header.n_stopped_threads; ++i)
                         InactiveScriptHashes.insert(stopped_info[i]);
                     TRACE("Finished. Loaded %u cleo variables, %u saved threads info, %u stopped threads info",
@@ -716,6 +873,9 @@ namespace CLEO
             {
                 TRACE("Loading of cleo safe %s failed: %s", safe_name, ex.what());
                 safe_header.n_saved_threads = safe_header.n_stopped_threads = 0;
+                safe_info_index.clear();
+                GlobalVars.Clear();
+                ScriptBlobs.Clear();
                 memset(CleoVariables, 0, sizeof(CleoVariables));
             }
         }
@@ -730,17 +890,58 @@ namespace CLEO
 
         TRACE("Searching for cleo scripts");
 
-        FilesWalk(cs_mask, [this](const char *filename) {
-            LoadScript(filename);
+        // single scan of the directory, scripts are started in groups: *.cs, *.cs4, *.cs3, by name within a group
+        static const char *groupExtensions[] = { ".cs", ".cs4", ".cs3" };
+        std::vector<std::string> groups[3];
+        FilesWalk(cs_files_mask, [&groups](const char *filename) {
+            auto ext = strrchr(filename, '.');
+            for (int i = 0; ext && i < 3; ++i)
+            {
+                if (_stricmp(ext, groupExtensions[i]) == 0)
+                {
+                    groups[i].push_back(filename);
+                    break;
+                }
+            }
         });
-        FilesWalk(cs4_mask, [this](const char *filename) {
-            auto cs = LoadScript(filename);
+
+        std::vector<std::string> files;
+        for (auto& group : groups)
+        {
+            std::sort(group.begin(), group.end(), [](const std::string& a, const std::string& b) {
+                return _stricmp(a.c_str(), b.c_str()) < 0;
+            });
+            files.insert(files.end(), group.begin(), group.end());
+        }
+
+        // file reading, hashing and verification is done by worker threads, scripts are registered here in the game thread
+        BytecodeCache.ResetVerifyStats();
+        BytecodeCache.Preload(files);
+
+        for (auto& filename : groups[0]) LoadScript(filename.c_str());
+        for (auto& filename : groups[1])
+        {
+            auto cs = LoadScript(filename.c_str());
             if (cs) cs->SetCompatibility(CLEO_VER_4);
-        });
-        FilesWalk(cs3_mask, [this](const char *filename) {
-            auto cs = LoadScript(filename);
+        }
+        for (auto& filename : groups[2])
+        {
+            auto cs = LoadScript(filename.c_str());
             if (cs) cs->SetCompatibility(CLEO_VER_3);
-        });
+        }
+
+        auto& stats = BytecodeCache.GetVerifyStats();
+        if (stats.numScripts)
+        {
+            LARGE_INTEGER freq;
+            QueryPerformanceFrequency(&freq);
+            double seconds = static_cast<double>(stats.time) / freq.QuadPart;
+            TRACE("Verified %u scripts (%u bytes) in %.3f ms, %.1f MB/s", stats.numScripts, stats.numBytes,
+                seconds * 1000.0, seconds > 0.0 ? stats.numBytes / seconds / (1024.0 * 1024.0) : 0.0);
+        }
+
+        // the scripts have copied their code, only files started later by 0A92 and 0A94 are worth keeping
+        BytecodeCache.Clear();
 
         _chdir(cwd);
     }
@@ -756,33 +957,21 @@ namespace CLEO
             return nullptr;
         }
 
-        // check whether the script is in stop-list
-        if (stopped_info)
+        // check whether the script is in stop-list (sorted when loaded)
+        if (stopped_info && std::binary_search(stopped_info, stopped_info + safe_header.n_stopped_threads, cs->dwChecksum))
         {
-            for (size_t i = 0; i < safe_header.n_stopped_threads; ++i)
-            {
-                if (stopped_info[i] == cs->dwChecksum)
-                {
-                    TRACE("Custom script %s found in the stop-list", szFilePath);
-                    InactiveScriptHashes.insert(stopped_info[i]);
-                    delete cs;
-                    return nullptr;
-                }
-            }
+            TRACE("Custom script %s found in the stop-list", szFilePath);
+            InactiveScriptHashes.insert(cs->dwChecksum);
+            delete cs;
+            return nullptr;
         }
 
         // check whether the script is in safe-list
-        if (safe_info)
+        auto saved = safe_info_index.find(cs->dwChecksum);
+        if (saved != safe_info_index.end())
         {
-            for (size_t i = 0; i < safe_header.n_saved_threads; ++i)
-            {
-                if (safe_info[i].hash == cs->dwChecksum)
-                {
-                    TRACE("Custom script %s found in the safe-list", szFilePath);
-                    safe_info[i].Apply(cs);
-                    break;
-                }
-            }
+            TRACE("Custom script %s found in the safe-list", szFilePath);
+            saved->second->Apply(cs);
         }
 
         AddCustomScript(cs);
@@ -793,14 +982,12 @@ namespace CLEO
     {
         try
         {
-            std::list<CCustomScript *> savedThreads;
+            std::vector<CCustomScript *> savedThreads;
             std::for_each(CustomScripts.begin(), CustomScripts.end(), [this, &savedThreads](CCustomScript *cs) {
                 if (cs->bSaveEnabled)
                     savedThreads.push_back(cs);
             });
 
-            CleoSafeHeader header = { CleoSafeHeader::sign, savedThreads.size(), InactiveScriptHashes.size() };
-
             // steam offset is different, so get it manually for now
             CGameVersionManager& gvm = GetInstance().VersionManager;
             int nSlot = gvm.GetGameVersion() != GV_STEAM ? *(BYTE*)&MenuManager->m_nSelectedSaveGame : *((BYTE*)MenuManager + 0x15B);
@@ -809,33 +996,37 @@ namespace CLEO
             sprintf(safe_name, "./cleo/cleo_saves/cs%d.sav", nSlot);
             TRACE("Saving script engine state to the file %s", safe_name);
 
-            CreateDirectory("cleo", NULL);
-            CreateDirectory("cleo/cleo_saves", NULL);
-            std::ofstream ss(safe_name, std::ios::binary);
-            if (ss.is_open())
-            {
-                ss.exceptions(std::ios::failbit | std::ios::badbit);
+            // snapshot the state here, the file is written by SaveWriter's thread
+            CSaveFileWriter file;
+            file.AddSection(SAVE_SECTION_VARIABLES, CleoVariables, sizeof(CleoVariables), true);
 
-                WriteBinary(ss, header);
-                WriteBinary(ss, CleoVariables, 0x400);
-
-                std::for_each(savedThreads.begin(), savedThreads.end(), [&savedThreads, &ss](CCustomScript *cs)
-                {
-                    ThreadSavingInfo savingInfo(cs);
-                    WriteBinary(ss, savingInfo);
-                });
+            std::vector<BYTE> threads;
+            WriteBinary(threads, static_cast<DWORD>(sizeof(ThreadSavingInfo)));
+            std::for_each(savedThreads.begin(), savedThreads.end(), [&threads](CCustomScript *cs)
+            {
+                ThreadSavingInfo savingInfo(cs);
+                WriteBinary(threads, savingInfo);
+            });
+            file.AddSection(SAVE_SECTION_THREADS, threads.data(), threads.size(), true);
 
-                std::for_each(InactiveScriptHashes.begin(), InactiveScriptHashes.end(), [&ss](unsigned long hash) {
-                    WriteBinary(ss, hash);
-                });
+            std::vector<DWORD> stopped(InactiveScriptHashes.begin(), InactiveScriptHashes.end());
+            file.AddSection(SAVE_SECTION_STOPPED_THREADS, stopped.data(), stopped.size() * sizeof(DWORD));
 
-                TRACE("Done. Saved %u cleo variables, %u saved threads, %u stopped threads",
-                    0x400, header.n_saved_threads, header.n_stopped_threads);
-            }
-            else
+            if (!GlobalVars.Empty())
             {
-                TRACE("Failed to write save file '%s'!", safe_name);
+                auto vars = GlobalVars.Serialize();
+                file.AddSection(SAVE_SECTION_GLOBAL_VARS, vars.data(), vars.size(), true);
             }
+
+            auto blobs = ScriptBlobs.Serialize();
+            if (!blobs.empty()) file.AddSection(SAVE_SECTION_BLOBS, blobs.data(), blobs.size(), true);
+
+            CreateDirectory("cleo", NULL);
+            CreateDirectory("cleo/cleo_saves", NULL);
+            SaveWriter.Write(safe_name, file.Build());
+
+            TRACE("Done. Queued %u cleo variables, %u saved threads, %u stopped threads, %u script blobs",
+                0x400, savedThreads.size(), stopped.size(), ScriptBlobs.Count());
         }
         catch (std::exception& ex)
         {
@@ -845,28 +1036,63 @@ namespace CLEO
 
     CRunningScript *CScriptEngine::FindScriptNamed(const char *name)
     {
+        // game scripts are not tracked by CLEO; the first letter rules out most of them, the key is only built for the rest
+        if (strlen(name) > 8) return nullptr;
+        auto key = GetScriptNameKey(name);
+        auto first = static_cast<BYTE>(key);
         for (auto script = *activeThreadQueue; script; script = script->GetNext())
         {
-            if (_stricmp(name, script->GetName()) == 0)
+            if (static_cast<BYTE>(tolower(static_cast<BYTE>(script->GetName()[0]))) != first) continue;
+            if (GetScriptNameKey(script->GetName()) == key)
                 return script;
         }
         return nullptr;
     }
     CCustomScript *CScriptEngine::FindCustomScriptNamed(const char *name)
     {
+        if (strlen(name) > 8) return nullptr;
+        auto key = GetScriptNameKey(name);
+
         if (CustomMission)
         {
-            if (_stricmp(name, CustomMission->Name) == 0) return CustomMission;
+            if (GetScriptNameKey(CustomMission->Name) == key) return CustomMission;
         }
 
-        for (auto it = CustomScripts.begin(); it != CustomScripts.end(); ++it)
+        auto it = CustomScriptsByName.find(key);
+        return it != CustomScriptsByName.end() ? it->second.front() : nullptr;
+    }
+
+    void CScriptEngine::RenameScript(CRunningScript *thread, const char *name)
+    {
+        auto cs = reinterpret_cast<CCustomScript *>(thread);
+        strncpy(cs->Name, name, sizeof(cs->Name) - 1);
+        cs->Name[sizeof(cs->Name) - 1] = '\0';
+
+        // other scripts would find it by the old name until its next run otherwise
+        if (cs->IsCustom()) cs->CheckNameChange();
+    }
+
+    void CScriptEngine::IndexScriptName(CCustomScript *cs)
+    {
+        cs->NameKey = GetScriptNameKey(cs->Name);
+        auto& scripts = CustomScriptsByName[cs->NameKey];
+
+        // keep the order of CustomScripts, so the lookup returns the same script as the walk over the list did
+        auto pos = scripts.end();
+        for (auto next = cs->nextCustom; next && pos == scripts.end(); next = next->nextCustom)
         {
-            auto cs = *it;
-            if (_stricmp(name, cs->Name) == 0)
-                return cs;
+            if (next->NameKey == cs->NameKey) pos = std::find(scripts.begin(), scripts.end(), next);
         }
+        scripts.insert(pos, cs);
+    }
 
-        return nullptr;
+    void CScriptEngine::UnindexScriptName(CCustomScript *cs)
+    {
+        auto it = CustomScriptsByName.find(cs->NameKey);
+        if (it == CustomScriptsByName.end()) return;
+        auto& scripts = it->second;
+        scripts.erase(std::remove(scripts.begin(), scripts.end(), cs), scripts.end());
+        if (scripts.empty()) CustomScriptsByName.erase(it);
     }
 
     void CScriptEngine::AddCustomScript(CCustomScript *cs)
@@ -880,6 +1106,7 @@ namespace CLEO
         {
             TRACE("Registering custom script named %s", cs->Name);
             CustomScripts.push_back(cs);
+            IndexScriptName(cs);
         }
         AddScriptToQueue(cs, activeThreadQueue);
         cs->SetActive(true);
@@ -889,9 +1116,12 @@ namespace CLEO
     {
 		if (cs->parentThread)
 		{
-			cs->BaseIP = 0; // don't delete BaseIP if child thread
+			cs->parentThread->childThreads.remove(cs);
 		}
-		for (auto childThread : cs->childThreads)
+		// children unlink themselves from the list, so walk a detached copy
+		auto childThreads = std::move(cs->childThreads);
+		cs->childThreads.clear();
+		for (auto childThread : childThreads)
 		{
 			CScriptEngine::RemoveCustomScript(childThread);
 		}
@@ -914,11 +1144,13 @@ namespace CLEO
             else
             {
                 TRACE("Unregistering custom script named %s", cs->Name);
-                ScriptsWaitingForDelete.push_back(cs);
             }
+            // the hash is all what is needed to keep a saved script stopped
+            ScriptsWaitingForDelete.push_back(cs);
 
             //TRACE("Psyke!");
 
+            UnindexScriptName(cs);
             CustomScripts.remove(cs);
             RemoveScriptFromQueue(cs, activeThreadQueue);
             cs->SetActive(false);
@@ -933,7 +1165,10 @@ namespace CLEO
     void CScriptEngine::RemoveAllCustomScripts(void)
     {
         InactiveScriptHashes.clear();
-        std::for_each(CustomScripts.begin(), CustomScripts.end(), [this](CCustomScript *cs) {
+        for (auto it = CustomScripts.begin(); it != CustomScripts.end();)
+        {
+            auto cs = *it;
+            ++it;	// before the script is deleted
             TRACE("Unregistering custom script named %s", cs->Name);
             RemoveScriptFromQueue(cs, activeThreadQueue);
             //AddScriptToQueue(cs, inactiveThreadQueue);
@@ -942,8 +1177,9 @@ namespace CLEO
             //TRACE("Psyke!!");
             cs->SetActive(false);
             delete cs;
-        });
+        }
         CustomScripts.clear();
+        CustomScriptsByName.clear();
         std::for_each(ScriptsWaitingForDelete.begin(), ScriptsWaitingForDelete.end(), [this](CCustomScript *cs) {
             TRACE("Deleting inactive script named %s", cs->Name);
             delete cs;
@@ -960,6 +1196,19 @@ namespace CLEO
         }
     }
 
+    // called once per frame, outside of the game's script loop,
+    // so none of the ended scripts can be referenced by the queue walk anymore
+    void CScriptEngine::DeleteInactiveScripts()
+    {
+        if (ScriptsWaitingForDelete.empty()) return;
+        std::for_each(ScriptsWaitingForDelete.begin(), ScriptsWaitingForDelete.end(), [this](CCustomScript *cs) {
+            TRACE("Deleting inactive script named %s", cs->Name);
+            delete cs;
+        });
+        ScriptsWaitingForDelete.clear();
+        TRACE("Custom scripts alive: %d, pooled: %d", LiveScriptsCount(), PooledScriptsCount());
+    }
+
     void CScriptEngine::UnregisterAllScripts()
     {
         TRACE("Unregistering all custom scripts");
@@ -978,23 +1227,46 @@ namespace CLEO
         });
     }
 
+    void *CCustomScript::Pool[MAX_POOLED_SCRIPTS];
+    size_t CCustomScript::NumPooled = 0;
+    size_t CCustomScript::NumLive = 0;
+
+    void *CCustomScript::operator new(size_t size)
+    {
+        void *mem;
+        if (NumPooled) mem = Pool[--NumPooled];
+        else mem = ::operator new(size);
+        ++NumLive;
+        return mem;
+    }
+
+    void CCustomScript::operator delete(void *mem)
+    {
+        --NumLive;
+        if (NumPooled < MAX_POOLED_SCRIPTS) Pool[NumPooled++] = mem;
+        else ::operator delete(mem);
+    }
+
 	// TODO: Consider split into 2 classes: CCustomExternalScript, CCustomChildScript
     CCustomScript::CCustomScript(const char *szFileName, bool bIsMiss, CCustomScript *parent, int label)
         : CRunningScript(), bSaveEnabled(false), bOK(false),
         LastSearchPed(0), LastSearchCar(0), LastSearchObj(0),
-        CompatVer(CLEO_VERSION)
+        CompatVer(CLEO_VERSION), parentThread(nullptr),
+        prevCustom(nullptr), nextCustom(nullptr), NameKey(0)
     {
         IsCustom(1);
+        SetScmFunction(0);
         bIsMission = bUseMissionCleanup = bIsMiss;
         UseTextCommands = 0;
         NumDraws = 0;
         NumTexts = 0;
+        std::fill(script_textures, script_textures + NUM_SCRIPT_TEXTURES, nullptr);
+        bTexturesRestored = false;
 
         TRACE("Loading custom script %s...", szFileName);
 
         try
         {
-			std::ifstream is;
 			if (label != 0) // Create external from label.
 			{
 				if (!parent)
@@ -1003,18 +1275,16 @@ namespace CLEO
 				CurrentIP = parent->GetBasePointer() - label;
 				memcpy(Name, parent->Name, sizeof(Name));
 				dwChecksum = parent->dwChecksum;
+				CodeIndex = parent->CodeIndex;
 				parentThread = parent;
 				parent->childThreads.push_back(this);
 			}
 			else
 			{
-				using std::ios;
-				std::ifstream is(szFileName, std::ios::binary);
-				is.exceptions(std::ios::badbit | std::ios::failbit);
-				std::size_t length;
-				is.seekg(0, std::ios::end);
-				length = is.tellg();
-				is.seekg(0, std::ios::beg);
+				// every thread gets own copy of the code, as scripts are free to write into it
+				// code the verifier could not index is still run, only without the fast paths using the index
+				auto bytecode = GetInstance().ScriptEngine.BytecodeCache.Get(szFileName);
+				std::size_t length = bytecode->code.size();
 
 				if (bIsMiss)
 				{
@@ -1026,14 +1296,15 @@ namespace CLEO
 				else {
 					BaseIP = CurrentIP = new BYTE[length];
 				}
-				is.read(reinterpret_cast<char *>(BaseIP), length);
+				if (length) memcpy(BaseIP, bytecode->code.data(), length);
 
 				auto fname = strrchr(szFileName, '\\') + 1;
 				if (!fname) fname = strrchr(szFileName, '/') + 1;
 				if (fname < szFileName) fname = szFileName;
 				memcpy(Name, fname, sizeof(Name));
 				Name[7] = '\0';
-				dwChecksum = crc32(reinterpret_cast<BYTE *>(BaseIP), length);
+				dwChecksum = bytecode->checksum;
+				CodeIndex = bytecode->index;
 			}
 			lastScriptCreated = this;
             bOK = true;
@@ -1050,10 +1321,57 @@ namespace CLEO
 
     CCustomScript::~CCustomScript()
     {
-        if (BaseIP && !bIsMission) delete[] BaseIP;
+        if (BaseIP && !bIsMission && !parentThread) delete[] BaseIP; // child threads share the code of parent
+        if (GetScmFunction()) ReleaseScmCallStack(this); // ended inside of scm function
+        FlushScriptFiles(this);
 		RunScriptDeleteDelegate(reinterpret_cast<CRunningScript*>(this));
 		if (lastScriptCreated == this) lastScriptCreated = nullptr;
     }
 
 	float VectorSqrMagnitude(CVector vector) { return vector.x * vector.x + vector.y * vector.y + vector.z * vector.z; }
+
+    extern "C"
+    {
+        int __stdcall CLEO_GetSaveStatus();
+
+        int __stdcall CLEO_GetSaveStatus()
+        {
+            return GetInstance().ScriptEngine.SaveWriter.GetStatus();
+        }
+
+        void __stdcall CLEO_SetScriptName(CRunningScript *thread, LPCSTR name);
+
+        void __stdcall CLEO_SetScriptName(CRunningScript *thread, LPCSTR name)
+        {
+            GetInstance().ScriptEngine.RenameScript(thread, name);
+        }
+
+        BOOL __stdcall CLEO_SetScriptBlob(CRunningScript *thread, LPCSTR name, const void *data, DWORD size);
+        DWORD __stdcall CLEO_GetScriptBlob(CRunningScript *thread, LPCSTR name, void *buf, DWORD bufSize);
+        BOOL __stdcall CLEO_DeleteScriptBlob(CRunningScript *thread, LPCSTR name);
+
+        BOOL __stdcall CLEO_SetScriptBlob(CRunningScript *thread, LPCSTR name, const void *data, DWORD size)
+        {
+            auto cs = reinterpret_cast<CCustomScript *>(thread);
+            if (!cs->IsCustom()) return FALSE;
+            return GetInstance().ScriptEngine.ScriptBlobs.Set(cs->GetChecksum(), name, data, size);
+        }
+
+        DWORD __stdcall CLEO_GetScriptBlob(CRunningScript *thread, LPCSTR name, void *buf, DWORD bufSize)
+        {
+            auto cs = reinterpret_cast<CCustomScript *>(thread);
+            if (!cs->IsCustom()) return 0;
+            auto blob = GetInstance().ScriptEngine.ScriptBlobs.Get(cs->GetChecksum(), name);
+            if (!blob) return 0;
+            if (buf) memcpy(buf, blob->data(), min(static_cast<size_t>(bufSize), blob->size()));
+            return static_cast<DWORD>(blob->size());
+        }
+
+        BOOL __stdcall CLEO_DeleteScriptBlob(CRunningScript *thread, LPCSTR name)
+        {
+            auto cs = reinterpret_cast<CCustomScript *>(thread);
+            if (!cs->IsCustom()) return FALSE;
+            return GetInstance().ScriptEngine.ScriptBlobs.Remove(cs->GetChecksum(), name);
+        }
+    }
 }
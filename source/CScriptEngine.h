@@ -1,18 +1,34 @@
 #pragma once
 #include "CCodeInjector.h"
 #include "CCustomOpcodeSystem.h"
+#include "CBytecodeCache.h"
+#include "CSaveWriter.h"
+#include "CScriptBlobStorage.h"
+#include "CGlobalVarStore.h"
+#include <unordered_map>
+#include <iterator>
 
 namespace CLEO
 {
     const char cleo_dir[] = "./cleo";
-    const char cs_mask[] = "./*.cs";
-    const char cs4_mask[] = "./*.cs4";
-    const char cs3_mask[] = "./*.cs3";
+    const char cs_files_mask[] = "./*.cs*";
+    const size_t NUM_SCRIPT_TEXTURES = 128;
+    const size_t MAX_POOLED_SCRIPTS = 64;
+    const size_t NUM_CLEO_VARIABLES = 0x400;
+
+    // case-insensitive key of script name, names are up to 8 chars long
+    inline unsigned long long GetScriptNameKey(const char *name)
+    {
+        unsigned long long key = 0;
+        for (int i = 0; i < 8 && name[i]; ++i)
+            key |= static_cast<unsigned long long>(static_cast<BYTE>(tolower(static_cast<BYTE>(name[i])))) << (i * 8);
+        return key;
+    }
 
     class CCustomScript : public CRunningScript
     {
         friend class CScriptEngine;
-        friend struct ScmFunction;
+        friend class CCustomScriptList;
         friend struct ThreadSavingInfo;
 
         DWORD dwChecksum;
@@ -25,30 +41,40 @@ namespace CLEO
         int NumTexts;
 		CCustomScript *parentThread;
 		std::list<CCustomScript*> childThreads;
-        std::list<RwTexture*> script_textures;
+        RwTexture *script_textures[NUM_SCRIPT_TEXTURES];
+        bool bTexturesRestored; // script_textures are in game's sprite array currently
+        CCustomScript *prevCustom, *nextCustom;   // links of CScriptEngine::CustomScripts
+        std::shared_ptr<const CBytecodeIndex> CodeIndex;    // built when the code was loaded, shared with child threads
+        unsigned long long NameKey;                 // key the script is indexed with by name
         std::vector<BYTE> script_draws;
         std::vector<BYTE> script_texts;
 
+        void ProcessWithoutDrawState();
+        bool IsProcessedByGame();
+        void RunCommands();
+        void CheckNameChange();
+
+        // freed script objects kept for reuse by next spawns (plain array, as scripts are deleted during static destruction too)
+        static void *Pool[MAX_POOLED_SCRIPTS];
+        static size_t NumPooled;
+        static size_t NumLive;
+
     public:
-		inline RwTexture* GetScriptTextureById(unsigned int id)
-		{
-			if (script_textures.size() > id)
-			{
-				auto it = script_textures.begin();
-				std::advance(it, id);
-				return *it;
-			}
-			return nullptr;
-		}
+        void *operator new(size_t size);
+        void operator delete(void *mem);
+        static inline size_t GetNumLive() { return NumLive; }
+        static inline size_t GetNumPooled() { return NumPooled; }
+
+		RwTexture* GetScriptTextureById(unsigned int id);
 
         inline SCRIPT_VAR * GetVarsPtr() { return LocalVar; }
         inline WORD GetScmFunction() { return MemRead<WORD>(reinterpret_cast<BYTE*>(this) + 0xDD); }
         inline void SetScmFunction(WORD id) { MemWrite<WORD>(reinterpret_cast<BYTE*>(this) + 0xDD, id); }
-        inline void SetNotFlag(bool b) { NotFlag = b; }
-        inline char GetNotFlag() { return NotFlag; }
         inline void IsCustom(bool b) { MemWrite<BYTE>(reinterpret_cast<BYTE*>(this) + 0xDF, b); }
         inline bool IsCustom() { return MemRead<bool>(reinterpret_cast<BYTE*>(this) + 0xDF); }
         inline bool IsOK() { return bOK; }
+        inline DWORD GetChecksum() { return dwChecksum; }
+        inline const CBytecodeIndex *GetCodeIndex() { return CodeIndex.get(); }
         inline void enable_saving(bool en = true) { bSaveEnabled = en; }
         inline void SetCompatibility(CLEO_Version ver) { CompatVer = ver; }
         inline CLEO_Version GetCompatibility() { return CompatVer; }
@@ -58,6 +84,7 @@ namespace CLEO
 		CCustomScript(const char *szFileName, bool bIsMiss = false, CCustomScript *parent = nullptr, int label = 0);
         ~CCustomScript();
 
+        bool IsDormant();
         void Process();
         void Draw(char bBeforeFade);
 
@@ -72,29 +99,126 @@ namespace CLEO
         void RestoreScriptCustoms();
     };
 
+    // intrusive list of custom scripts, unlinking does not need a search
+    class CCustomScriptList
+    {
+        CCustomScript *first, *last;
+        size_t count;
+
+    public:
+        class iterator
+        {
+            CCustomScript *cs;
+
+        public:
+            typedef std::forward_iterator_tag iterator_category;
+            typedef CCustomScript *value_type;
+            typedef ptrdiff_t difference_type;
+            typedef CCustomScript **pointer;
+            typedef CCustomScript *&reference;
+
+            iterator(CCustomScript *cs) : cs(cs) { }
+            inline CCustomScript *operator*() const { return cs; }
+            inline iterator& operator++() { cs = cs->nextCustom; return *this; }
+            inline bool operator==(const iterator& other) const { return cs == other.cs; }
+            inline bool operator!=(const iterator& other) const { return cs != other.cs; }
+        };
+
+        CCustomScriptList() : first(nullptr), last(nullptr), count(0) { }
+
+        inline iterator begin() const { return iterator(first); }
+        inline iterator end() const { return iterator(nullptr); }
+        inline size_t size() const { return count; }
+        inline bool empty() const { return !count; }
+        inline bool contains(CCustomScript *cs) const { return cs->prevCustom || cs->nextCustom || first == cs; }
+
+        void push_back(CCustomScript *cs)
+        {
+            cs->prevCustom = last;
+            cs->nextCustom = nullptr;
+            if (last) last->nextCustom = cs;
+            else first = cs;
+            last = cs;
+            ++count;
+        }
+
+        void remove(CCustomScript *cs)
+        {
+            if (!contains(cs)) return;
+            if (cs->prevCustom) cs->prevCustom->nextCustom = cs->nextCustom;
+            else first = cs->nextCustom;
+            if (cs->nextCustom) cs->nextCustom->prevCustom = cs->prevCustom;
+            else last = cs->prevCustom;
+            cs->prevCustom = cs->nextCustom = nullptr;
+            --count;
+        }
+
+        inline void clear()
+        {
+            first = last = nullptr;
+            count = 0;
+        }
+    };
+
+    // set of script checksums kept in sorted flat array, iterated in ascending order like std::set
+    class CScriptHashSet
+    {
+        std::vector<unsigned long> hashes;
+
+    public:
+        typedef std::vector<unsigned long>::const_iterator const_iterator;
+
+        inline const_iterator begin() const { return hashes.begin(); }
+        inline const_iterator end() const { return hashes.end(); }
+        inline size_t size() const { return hashes.size(); }
+        inline void clear() { hashes.clear(); }
+
+        inline bool contains(unsigned long hash) const
+        {
+            return std::binary_search(hashes.begin(), hashes.end(), hash);
+        }
+
+        void insert(unsigned long hash)
+        {
+            auto pos = std::lower_bound(hashes.begin(), hashes.end(), hash);
+            if (pos == hashes.end() || *pos != hash) hashes.insert(pos, hash);
+        }
+    };
+
     class CScriptEngine : VInjectible
     {
         friend class CCustomScript;
-        std::list<CCustomScript *> CustomScripts;
+        CCustomScriptList CustomScripts;
+        std::unordered_map<unsigned long long, std::vector<CCustomScript *>> CustomScriptsByName; // same order as in CustomScripts
         std::list<CCustomScript *> ScriptsWaitingForDelete;
-        std::set<unsigned long> InactiveScriptHashes;
+        CScriptHashSet InactiveScriptHashes;
         CCustomScript *CustomMission;
 
         CCustomScript			*	LoadScript(const char *szFilePath);
+        void							IndexScriptName(CCustomScript *);
+        void							UnindexScriptName(CCustomScript *);
 
     public:
-        static SCRIPT_VAR			CleoVariables[0x400];
+        static SCRIPT_VAR			CleoVariables[NUM_CLEO_VARIABLES];
+        CGlobalVarStore					GlobalVars;     // cleo variables of ids out of CleoVariables and named ones
+        CBytecodeCache					BytecodeCache;
+        CSaveWriter						SaveWriter;
+        CScriptBlobStorage				ScriptBlobs;
         inline CCustomScript		*	GetCustomMission() { return CustomMission; }
         void							LoadCustomScripts(bool bMode = false);
         void							SaveState();
         CRunningScript			*	FindScriptNamed(const char *);
+        void							RenameScript(CRunningScript *, const char *name);  // as 03A4 does, keeps the name index of custom scripts up to date
         CCustomScript			*	FindCustomScriptNamed(const char*);
         void							AddCustomScript(CCustomScript*);
         void							RemoveCustomScript(CCustomScript*);
         void							RemoveAllCustomScripts();
+        void							DeleteInactiveScripts();
         void							UnregisterAllScripts();
         void							ReregisterAllScripts();
         inline size_t				WorkingScriptsCount() { return CustomScripts.size(); }
+        inline size_t				LiveScriptsCount() { return CCustomScript::GetNumLive(); }
+        inline size_t				PooledScriptsCount() { return CCustomScript::GetNumPooled(); }
         virtual void					Inject(CCodeInjector&);
 
         CScriptEngine()
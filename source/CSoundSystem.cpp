@@ -26,6 +26,10 @@ namespace CLEO
 
     LRESULT __stdcall HOOK_DefWindowProc(HWND wnd, UINT msg, WPARAM wparam, LPARAM lparam)
     {
+        // the main window is destroyed as the game exits; once it returns to the system the process is torn down,
+        // and the save writer's thread with it, so cleo saves have to be on disk before that
+        if (msg == WM_NCDESTROY) GetInstance().ScriptEngine.SaveWriter.Shutdown();
+
         if (GetInstance().SoundSystem.Initialized())
         {
             // pause streams if the window loses focus, or if SA found any other reason to pause
@@ -161,6 +161,21 @@ public:
     inline	bool				GetConditionResult() {
         return bCondResult != 0;
     }
+    inline	void				SetConditionResult(bool b) {
+        bCondResult = b;
+    }
+    inline	eLogicalOperation	GetLogicalOp() {
+        return LogicalOp;
+    }
+    inline	void				SetLogicalOp(eLogicalOperation op) {
+        LogicalOp = op;
+    }
+    inline	bool				GetNotFlag() {
+        return NotFlag;
+    }
+    inline	void				SetNotFlag(bool b) {
+        NotFlag = b;
+    }
     /*
     inline	int			GetLocalVarVal(int i) {
     return IsMission() ? CTheScripts::GetMissionLocal(i) : GetIntVar(i);
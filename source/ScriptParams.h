@@ -0,0 +1,265 @@
+#pragma once
+#include "CTheScripts.h"
+
+// Native decoder of script operands.
+// Mirrors the game's CollectParameters, StoreParameters, GetPointerToScriptVariable and ReadTextLabelFromScript,
+// but depends on nothing except the script space and mission locals, so it can be used outside of the game too.
+
+namespace CLEO
+{
+    extern BYTE *scmBlock;
+    extern "C" SCRIPT_VAR *missionLocals;
+
+    // local variable storage of the thread (mission locals are shared between mission scripts)
+    inline SCRIPT_VAR *GetScriptLocalVarPointer(CRunningScript *thread, WORD index)
+    {
+        return thread->IsMission() ? &missionLocals[index] : thread->GetVarPtr(index);
+    }
+
+    inline SCRIPT_VAR *GetScriptGlobalVarPointer(WORD offset)
+    {
+        return reinterpret_cast<SCRIPT_VAR *>(scmBlock + offset);
+    }
+
+    // read array operand info (offset, index variable, size, flags) and return the element index
+    inline int ReadScriptArrayIndex(CRunningScript *thread, WORD& offset)
+    {
+        offset = static_cast<WORD>(thread->ReadDataArrayOffset());
+        WORD indexVar = static_cast<WORD>(thread->ReadDataArrayIndex());
+        thread->ReadDataArraySize();
+        bool globalIndex = (thread->ReadDataArrayFlags() & 0x80) != 0;
+        return globalIndex ? GetScriptGlobalVarPointer(indexVar)->nParam : GetScriptLocalVarPointer(thread, indexVar)->nParam;
+    }
+
+    // element of global array, elemSize is in bytes
+    inline SCRIPT_VAR *ReadScriptGlobalArrayPointer(CRunningScript *thread, int elemSize)
+    {
+        WORD offset;
+        int index = ReadScriptArrayIndex(thread, offset);
+        return reinterpret_cast<SCRIPT_VAR *>(scmBlock + offset + elemSize * index);
+    }
+
+    // element of local array, elemSize is in variables
+    inline SCRIPT_VAR *ReadScriptLocalArrayPointer(CRunningScript *thread, int elemSize)
+    {
+        WORD offset;
+        int index = ReadScriptArrayIndex(thread, offset);
+        return GetScriptLocalVarPointer(thread, static_cast<WORD>(offset + elemSize * index));
+    }
+
+    // step over single operand of any type
+    inline void SkipScriptParam(CRunningScript *thread)
+    {
+        switch (thread->ReadDataType())
+        {
+        case DT_VAR:
+        case DT_LVAR:
+        case DT_WORD:
+        case DT_VAR_TEXTLABEL:
+        case DT_LVAR_TEXTLABEL:
+        case DT_VAR_STRING:
+        case DT_LVAR_STRING:
+            thread->IncPtr(2);
+            break;
+        case DT_VAR_ARRAY:
+        case DT_LVAR_ARRAY:
+        case DT_VAR_TEXTLABEL_ARRAY:
+        case DT_LVAR_TEXTLABEL_ARRAY:
+        case DT_VAR_STRING_ARRAY:
+        case DT_LVAR_STRING_ARRAY:
+            thread->IncPtr(6);
+            break;
+        case DT_BYTE:
+            thread->IncPtr();
+            break;
+        case DT_DWORD:
+        case DT_FLOAT:
+            thread->IncPtr(4);
+            break;
+        case DT_VARLEN_STRING:
+            thread->IncPtr(1 + *thread->GetBytePointer());
+            break;
+        case DT_TEXTLABEL:
+            thread->IncPtr(8);
+            break;
+        case DT_STRING:
+            thread->IncPtr(16);
+            break;
+        }
+    }
+
+    // read pointer to variable operand of any type (numeric, text label or string), nullptr for non-variable operands (which are skipped)
+    inline SCRIPT_VAR *ReadScriptParamPointer(CRunningScript *thread)
+    {
+        switch (thread->ReadDataType())
+        {
+        case DT_VAR:
+        case DT_VAR_TEXTLABEL:
+        case DT_VAR_STRING:
+            return GetScriptGlobalVarPointer(static_cast<WORD>(thread->ReadDataVarIndex()));
+        case DT_LVAR:
+        case DT_LVAR_TEXTLABEL:
+        case DT_LVAR_STRING:
+            return GetScriptLocalVarPointer(thread, static_cast<WORD>(thread->ReadDataVarIndex()));
+        case DT_VAR_ARRAY:
+            return ReadScriptGlobalArrayPointer(thread, 4);
+        case DT_LVAR_ARRAY:
+            return ReadScriptLocalArrayPointer(thread, 1);
+        case DT_VAR_TEXTLABEL_ARRAY:
+            return ReadScriptGlobalArrayPointer(thread, 8);
+        case DT_LVAR_TEXTLABEL_ARRAY:
+            return ReadScriptLocalArrayPointer(thread, 2);
+        case DT_VAR_STRING_ARRAY:
+            return ReadScriptGlobalArrayPointer(thread, 16);
+        case DT_LVAR_STRING_ARRAY:
+            return ReadScriptLocalArrayPointer(thread, 4);
+        }
+        thread->IncPtr(-1);
+        SkipScriptParam(thread);
+        return nullptr;
+    }
+
+    // read single numeric operand, returns false if operand is not of numeric type (the ip is left at the operand)
+    inline bool ReadScriptParam(CRunningScript *thread, SCRIPT_VAR& out)
+    {
+        switch (*thread->GetBytePointer())
+        {
+        case DT_DWORD:
+        case DT_FLOAT:
+            thread->IncPtr();
+            out.nParam = thread->ReadDataInt();
+            return true;
+        case DT_BYTE:
+            thread->IncPtr();
+            out.nParam = thread->ReadDataByte();
+            return true;
+        case DT_WORD:
+            thread->IncPtr();
+            out.nParam = thread->ReadDataWord();
+            return true;
+        case DT_VAR:
+        case DT_LVAR:
+        case DT_VAR_ARRAY:
+        case DT_LVAR_ARRAY:
+            out = *ReadScriptParamPointer(thread);
+            return true;
+        }
+        return false;
+    }
+
+    // read count numeric operands at once, operands of other types are skipped and read as 0
+    inline void ReadScriptParams(CRunningScript *thread, SCRIPT_VAR *out, int count)
+    {
+        for (SCRIPT_VAR *end = out + count; out != end; ++out)
+        {
+            if (!ReadScriptParam(thread, *out))
+            {
+                out->dwParam = 0;
+                SkipScriptParam(thread);
+            }
+        }
+    }
+
+    // store value to variable operand, non-variable operands are just skipped
+    inline void WriteScriptParam(CRunningScript *thread, SCRIPT_VAR value)
+    {
+        switch (*thread->GetBytePointer())
+        {
+        case DT_VAR:
+        case DT_LVAR:
+        case DT_VAR_ARRAY:
+        case DT_LVAR_ARRAY:
+            *ReadScriptParamPointer(thread) = value;
+            break;
+        default:
+            SkipScriptParam(thread);
+        }
+    }
+
+    inline void WriteScriptParams(CRunningScript *thread, const SCRIPT_VAR *values, int count)
+    {
+        for (const SCRIPT_VAR *end = values + count; values != end; ++values) WriteScriptParam(thread, *values);
+    }
+
+    // text operand, pointing into the script code or the variable keeping it; the characters are not null-terminated
+    struct ScriptStringView
+    {
+        const char *data;
+        size_t length;
+    };
+
+    // locate characters of text operand and the size of their storage, false for operands of other types (which are skipped)
+    inline bool ReadScriptTextOperand(CRunningScript *thread, const char *&src, size_t& maxLen)
+    {
+        switch (*thread->GetBytePointer())
+        {
+        case DT_TEXTLABEL:
+            thread->IncPtr();
+            src = reinterpret_cast<const char *>(thread->GetBytePointer());
+            maxLen = 8;
+            thread->IncPtr(8);
+            return true;
+        case DT_STRING:
+            thread->IncPtr();
+            src = reinterpret_cast<const char *>(thread->GetBytePointer());
+            maxLen = 16;
+            thread->IncPtr(16);
+            return true;
+        case DT_VARLEN_STRING:
+            thread->IncPtr();
+            maxLen = *thread->GetBytePointer();
+            thread->IncPtr();
+            src = reinterpret_cast<const char *>(thread->GetBytePointer());
+            thread->IncPtr(maxLen);
+            return true;
+        case DT_VAR_TEXTLABEL:
+        case DT_LVAR_TEXTLABEL:
+        case DT_VAR_TEXTLABEL_ARRAY:
+        case DT_LVAR_TEXTLABEL_ARRAY:
+            src = reinterpret_cast<const char *>(ReadScriptParamPointer(thread));
+            maxLen = 8;
+            return true;
+        case DT_VAR_STRING:
+        case DT_LVAR_STRING:
+        case DT_VAR_STRING_ARRAY:
+        case DT_LVAR_STRING_ARRAY:
+            src = reinterpret_cast<const char *>(ReadScriptParamPointer(thread));
+            maxLen = 16;
+            return true;
+        }
+        SkipScriptParam(thread);
+        return false;
+    }
+
+    // read text operand without copying it, the view is empty (with null data) for operands of other types
+    inline bool ReadScriptStringView(CRunningScript *thread, ScriptStringView& out)
+    {
+        const char *src;
+        size_t maxLen;
+        if (!ReadScriptTextOperand(thread, src, maxLen))
+        {
+            out.data = nullptr;
+            out.length = 0;
+            return false;
+        }
+        out.data = src;
+        out.length = strnlen(src, maxLen);
+        return true;
+    }
+
+    // read text operand into buf, always null-terminated and padded with zeros up to size (same as the game's ReadTextLabelFromScript)
+    // operands of other types are read as empty text
+    inline char *ReadScriptStringParam(CRunningScript *thread, char *buf, BYTE size)
+    {
+        const char *src;
+        size_t maxLen, length = 0;
+        if (!size) return buf;
+        if (ReadScriptTextOperand(thread, src, maxLen))
+        {
+            length = strnlen(src, maxLen < size - 1u ? maxLen : size - 1u);
+            memcpy(buf, src, length);
+        }
+        memset(buf + length, 0, size - length);
+        return buf;
+    }
+}
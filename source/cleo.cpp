@@ -10,6 +10,7 @@ namespace CLEO
     {
         //GetInstance().UpdateGameLogics(); // !
         GetInstance().SoundSystem.Update();
+        GetInstance().ScriptEngine.DeleteInactiveScripts();
         static DWORD dwFunc;
         dwFunc = (DWORD)(GetInstance().UpdateGameLogics);
         _asm jmp dwFunc
@@ -1,8 +1,14 @@
 #include "stdafx.h"
 #include "crc32.h"
 #include <ctype.h>
+#include <intrin.h>
+#include <smmintrin.h>
+#include <wmmintrin.h>
 
-static const unsigned long crcTable[256] = {
+// The checksums are stored in cleo saves and used as keys of FXT entries, so all the implementations below
+// have to give exactly the same results as the plain table loop: reflected 0x04C11DB7, 0xFFFFFFFF initial value, no final xor.
+
+constexpr unsigned long crcTable[256] = {
     0x00000000UL, 0x77073096UL, 0xee0e612cUL, 0x990951baUL, 0x076dc419UL,
     0x706af48fUL, 0xe963a535UL, 0x9e6495a3UL, 0x0edb8832UL, 0x79dcb8a4UL,
     0xe0d5e91eUL, 0x97d2d988UL, 0x09b64c2bUL, 0x7eb17cbdUL, 0xe7b82d07UL,
@@ -57,11 +63,152 @@ static const unsigned long crcTable[256] = {
     0x2d02ef8dUL
 };
 
+namespace
+{
+    // slicing-by-8 tables, table[0] is crcTable
+    struct Crc32Slices
+    {
+        unsigned long table[8][256];
+    };
+
+    constexpr Crc32Slices MakeSlices()
+    {
+        Crc32Slices s{};
+        for (int n = 0; n < 256; ++n) s.table[0][n] = crcTable[n];
+        for (int k = 1; k < 8; ++k)
+        {
+            for (int n = 0; n < 256; ++n)
+                s.table[k][n] = (s.table[k - 1][n] >> 8) ^ crcTable[s.table[k - 1][n] & 0xFF];
+        }
+        return s;
+    }
+
+    // built by the compiler: script files are hashed by several threads at startup,
+    // and function statics are not guarded with /Zc:threadSafeInit-
+    constexpr Crc32Slices crcSlices = MakeSlices();
+
+    bool IsClmulSupported()
+    {
+        int info[4];
+        __cpuid(info, 1);
+        return (info[2] & (1 << 1)) && (info[2] & (1 << 19)); // PCLMULQDQ and SSE4.1
+    }
+
+    // set when the dll is loaded, before any thread is started (false until then, the tables are used meanwhile)
+    const bool useClmul = IsClmulSupported();
+
+    inline unsigned long crc32Byte(unsigned long crc, unsigned char c)
+    {
+        return crcTable[(crc ^ c) & 0xFF] ^ (crc >> 8);
+    }
+
+    // same as toupper in "C" locale
+    inline unsigned char upcaseAscii(unsigned char c)
+    {
+        return static_cast<unsigned char>(c - 'a') < 26 ? c - ('a' - 'A') : c;
+    }
+
+    unsigned long crc32Slicing8(unsigned long crc, const unsigned char *buf, size_t len)
+    {
+        auto& s = crcSlices.table;
+        for (; len && (reinterpret_cast<uintptr_t>(buf) & 3); --len) crc = crc32Byte(crc, *buf++);
+        for (; len >= 8; len -= 8, buf += 8)
+        {
+            uint32_t lo, hi;
+            memcpy(&lo, buf, 4);
+            memcpy(&hi, buf + 4, 4);
+            lo ^= crc;
+            crc = s[7][lo & 0xFF] ^ s[6][(lo >> 8) & 0xFF] ^ s[5][(lo >> 16) & 0xFF] ^ s[4][lo >> 24] ^
+                s[3][hi & 0xFF] ^ s[2][(hi >> 8) & 0xFF] ^ s[1][(hi >> 16) & 0xFF] ^ s[0][hi >> 24];
+        }
+        for (; len; --len) crc = crc32Byte(crc, *buf++);
+        return crc;
+    }
+
+    // carry-less multiplication folding (Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ"),
+    // len has to be a multiple of 16, not less than 64
+    unsigned long crc32Clmul(unsigned long crc, const unsigned char *buf, size_t len)
+    {
+        alignas(16) static const unsigned long long k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+        alignas(16) static const unsigned long long k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+        alignas(16) static const unsigned long long k5k0[] = { 0x0163cd6124, 0x0000000000 };
+        alignas(16) static const unsigned long long poly[] = { 0x01db710641, 0x01f7011641 };
+
+        __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+        x1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x00));
+        x2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x10));
+        x3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x20));
+        x4 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x30));
+        x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+        x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(k1k2));
+        buf += 64;
+        len -= 64;
+
+        // fold 4 blocks at once
+        for (; len >= 64; len -= 64, buf += 64)
+        {
+            x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+            x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+            x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+            x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+            x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+            x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+            x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+            x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x00)));
+            x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x10)));
+            x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x20)));
+            x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 0x30)));
+        }
+
+        // fold into 128 bits
+        x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(k3k4));
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+        // remaining 16 byte blocks
+        for (; len >= 16; len -= 16, buf += 16)
+        {
+            x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+            x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf))), x5);
+        }
+
+        // fold 128 bits to 64 bits
+        x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+        x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+        x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+        x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(k5k0));
+        x2 = _mm_srli_si128(x1, 4);
+        x1 = _mm_and_si128(x1, x3);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_xor_si128(x1, x2);
+
+        // Barrett reduction to 32 bits
+        x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(poly));
+        x2 = _mm_and_si128(x1, x3);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+        x2 = _mm_and_si128(x2, x3);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x1 = _mm_xor_si128(x1, x2);
+        return static_cast<unsigned int>(_mm_extract_epi32(x1, 1));
+    }
+}
+
 unsigned long crc32FromUpcaseString(const char *str)
 {
+    // keys are short, so there is nothing to gain from slicing, but toupper call per char is avoided
     unsigned long crc = 0xFFFFFFFF;
-    while (*str)
-        crc = crcTable[(crc^toupper(*str++)) & 0xff] ^ (crc >> 8);
+    for (auto p = reinterpret_cast<const unsigned char *>(str); *p; ++p)
+        crc = crc32Byte(crc, upcaseAscii(*p));
     return crc;
 }
 
@@ -86,7 +233,12 @@ unsigned long crc32FromStdString(const std::string& str)
 unsigned long crc32(const unsigned char *buf, unsigned long len)
 {
     unsigned long crc = 0xFFFFFFFF;
-    for (unsigned i = 0; i < len; i++)
-        crc = crcTable[(crc^buf[i]) & 0xFF] ^ (crc >> 8);
-    return crc;
+    if (useClmul && len >= 64)
+    {
+        unsigned long blocks = len & ~15UL;
+        crc = crc32Clmul(crc, buf, blocks);
+        buf += blocks;
+        len -= blocks;
+    }
+    return crc32Slicing8(crc, buf, len);
 }
@@ -0,0 +1,155 @@
+#include "stdafx.h"
+#include "CBytecodeVerifier.h"
+#include "Check.h"
+
+// operand layouts of the verifier checked on hand-assembled code
+
+using namespace CLEO;
+
+namespace
+{
+    class Code
+    {
+        std::vector<BYTE> bytes;
+
+    public:
+        Code& Opcode(WORD opcode) { return Raw(&opcode, sizeof(opcode)); }
+        Code& Var(WORD offset) { bytes.push_back(DT_VAR); return Raw(&offset, sizeof(offset)); }
+        Code& LVar(WORD index) { bytes.push_back(DT_LVAR); return Raw(&index, sizeof(index)); }
+        Code& Int(int value) { bytes.push_back(DT_DWORD); return Raw(&value, sizeof(value)); }
+        Code& Text(const char *text)
+        {
+            bytes.push_back(DT_VARLEN_STRING);
+            bytes.push_back(static_cast<BYTE>(strlen(text)));
+            return Raw(text, strlen(text));
+        }
+        Code& End() { bytes.push_back(DT_END); return *this; }
+        Code& Raw(const void *data, size_t size)
+        {
+            auto p = static_cast<const BYTE *>(data);
+            bytes.insert(bytes.end(), p, p + size);
+            return *this;
+        }
+
+        const BYTE *Data() const { return bytes.data(); }
+        size_t Size() const { return bytes.size(); }
+    };
+
+    bool Verifies(const Code& code, CBytecodeListing& listing)
+    {
+        try
+        {
+            DecodeBytecode(code.Data(), code.Size(), listing);
+            return true;
+        }
+        catch (const std::runtime_error&)
+        {
+            return false;
+        }
+    }
+
+    void TestPopFloat()
+    {
+        // 0AE9 writes its result into an operand
+        Code code;
+        code.Opcode(0x0AE9).Var(0x10)
+            .Opcode(0x0A93);
+        CBytecodeListing listing;
+        CHECK(Verifies(code, listing));
+        CHECK_EQ(listing.instructions.size(), 2u);
+        CHECK_EQ(listing.instructions[0].numOperands, 1);
+        CHECK(listing.IsComplete());
+    }
+
+    void TestScanOpcodes()
+    {
+        // source, format and result are fixed, values to scan follow up to DT_END
+        Code code;
+        code.Opcode(0x0AD4).Text("12 34").Text("%d %d").Var(0x10).Var(0x14).Var(0x18).End()
+            .Opcode(0x0ADA).Var(0x20).Text("%d").Var(0x24).Var(0x28).End()
+            .Opcode(0x0A93);
+        CBytecodeListing listing;
+        CHECK(Verifies(code, listing));
+        CHECK_EQ(listing.instructions.size(), 3u);
+        CHECK_EQ(listing.instructions[0].numOperands, 5);
+        CHECK_EQ(listing.instructions[1].numOperands, 4);
+
+        Code missingResult;
+        missingResult.Opcode(0x0AD4).Text("12").Text("%d").End()
+            .Opcode(0x0A93);
+        CHECK(!Verifies(missingResult, listing));
+    }
+
+    void TestJumps()
+    {
+        Code loop;
+        loop.Opcode(0x0001).Int(0)      // wait 0
+            .Opcode(0x0002).Int(0);     // jump to the beginning
+        CBytecodeListing listing;
+        CHECK(Verifies(loop, listing));
+        CHECK_EQ(listing.instructions.size(), 2u);
+
+        Code intoInstruction;
+        intoInstruction.Opcode(0x0001).Int(0)
+            .Opcode(0x0002).Int(-3);
+        CHECK(!Verifies(intoInstruction, listing));
+
+        Code pastEnd;
+        pastEnd.Opcode(0x0001).Int(0);
+        CHECK(!Verifies(pastEnd, listing));
+    }
+
+    void TestUnknownOpcodes()
+    {
+        // code after opcodes of unknown layout is not decoded
+        Code code;
+        code.Opcode(0x0001).Int(0)
+            .Opcode(0x0BEE).Int(1);
+        CBytecodeListing listing;
+        CHECK(Verifies(code, listing));
+        CHECK_EQ(listing.instructions.size(), 1u);
+        CHECK(!listing.IsComplete());
+
+        // only the counts are kept of the listing
+        CBytecodeIndex index;
+        BuildBytecodeIndex(code.Data(), code.Size(), index);
+        CHECK_EQ(index.indexedBytes, listing.indexedBytes);
+        CHECK(!index.IsComplete());
+    }
+
+    void TestFunctionScopes()
+    {
+        // 0AB1 @15 0, then the function sets 3@ and returns
+        auto build = [](WORD afterCall)
+        {
+            Code code;
+            code.Opcode(0x0AB1).Int(-15).Int(0).End()
+                .Opcode(afterCall)
+                .Opcode(0x0006).LVar(3).Int(1)
+                .Opcode(0x0AB2).Int(0).End();
+            return code;
+        };
+
+        CBytecodeIndex index;
+        auto code = build(0x0A93);
+        BuildBytecodeIndex(code.Data(), code.Size(), index);
+        CHECK_EQ(index.GetFunctionLocals(15), 4);
+        CHECK_EQ(index.GetFunctionLocals(0), NUM_FUNCTION_LOCALS);
+
+        // code not decoded (after the unknown opcode) may take address of the locals
+        code = build(0x0BEE);
+        BuildBytecodeIndex(code.Data(), code.Size(), index);
+        CHECK(!index.IsComplete());
+        CHECK_EQ(index.GetFunctionLocals(15), NUM_FUNCTION_LOCALS);
+    }
+}
+
+int main()
+{
+    TestPopFloat();
+    TestScanOpcodes();
+    TestJumps();
+    TestUnknownOpcodes();
+    TestFunctionScopes();
+    return CLEO::Test::Result("BytecodeVerifierTest");
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdio>
+
+// minimal checks of the portable tests: failed ones are printed, and the test exits with the number of failures
+
+namespace CLEO
+{
+    namespace Test
+    {
+        inline int& Failures()
+        {
+            static int failures = 0;
+            return failures;
+        }
+
+        inline void Fail(const char *file, int line, const char *expr)
+        {
+            printf("%s(%d): check failed: %s\n", file, line, expr);
+            ++Failures();
+        }
+
+        inline int Result(const char *name)
+        {
+            if (Failures()) printf("%s: %d checks failed\n", name, Failures());
+            else printf("%s: passed\n", name);
+            return Failures() ? 1 : 0;
+        }
+    }
+}
+
+#define CHECK(expr) ((expr) ? (void)0 : CLEO::Test::Fail(__FILE__, __LINE__, #expr))
+#define CHECK_EQ(a, b) CHECK((a) == (b))
+#define CHECK_THROWS(expr) do { bool thrown = false; try { expr; } catch (...) { thrown = true; } CHECK(thrown && #expr); } while (0)
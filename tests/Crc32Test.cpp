@@ -0,0 +1,70 @@
+#include "stdafx.h"
+#include "crc32.h"
+#include "Check.h"
+#include <chrono>
+#include <random>
+
+// crc32 (slicing-by-8 and carry-less multiplication paths) checked against the plain table loop,
+// as the checksums are stored in cleo saves and must never change
+
+namespace
+{
+    unsigned long ReferenceCrc32(const unsigned char *buf, size_t len)
+    {
+        unsigned long crc = 0xFFFFFFFF;
+        for (size_t i = 0; i < len; ++i)
+        {
+            crc ^= buf[i];
+            for (int k = 0; k < 8; ++k) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+        return crc & 0xFFFFFFFF;
+    }
+
+    void TestKnownValues()
+    {
+        // standard check value of "123456789" is 0xCBF43926, with the final xor which cleo does not apply
+        CHECK_EQ(crc32(reinterpret_cast<const unsigned char *>("123456789"), 9), ~0xCBF43926UL & 0xFFFFFFFF);
+        CHECK_EQ(crc32(nullptr, 0), 0xFFFFFFFFUL);
+        CHECK_EQ(crc32FromString("123456789"), crc32(reinterpret_cast<const unsigned char *>("123456789"), 9));
+        CHECK_EQ(crc32FromUpcaseString("Script.cs"), crc32FromString("SCRIPT.CS"));
+        CHECK_EQ(crc32FromUpcaseStdString("main_1"), crc32FromString("MAIN_1"));
+    }
+
+    void TestAgainstReference()
+    {
+        std::mt19937 rng(11);
+        std::vector<unsigned char> data(5000 + 16);
+        for (auto& c : data) c = static_cast<unsigned char>(rng());
+
+        // every length up to a few folding blocks and every alignment of the start
+        for (size_t len = 0; len <= 600; ++len)
+        {
+            for (size_t offset = 0; offset < 16; offset += 5)
+                CHECK_EQ(crc32(data.data() + offset, len), ReferenceCrc32(data.data() + offset, len));
+        }
+        for (int i = 0; i < 200; ++i)
+        {
+            size_t offset = rng() % 16, len = rng() % 5000;
+            CHECK_EQ(crc32(data.data() + offset, len), ReferenceCrc32(data.data() + offset, len));
+        }
+    }
+
+    void ReportThroughput()
+    {
+        std::vector<unsigned char> data(1 << 20, 0x5A);
+        unsigned long sink = 0;
+        auto start = std::chrono::steady_clock::now();
+        const int rounds = 64;
+        for (int i = 0; i < rounds; ++i) sink ^= crc32(data.data(), static_cast<unsigned long>(data.size()));
+        auto time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("crc32: %.0f MB/s (%08lX)\n", rounds / time, sink);
+    }
+}
+
+int main()
+{
+    TestKnownValues();
+    TestAgainstReference();
+    ReportThroughput();
+    return CLEO::Test::Result("Crc32Test");
+}
@@ -0,0 +1,175 @@
+#include "stdafx.h"
+#include "CFormatCache.h"
+#include "Check.h"
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <random>
+
+// integer and %f renderers of the formatting opcodes checked against sprintf, whose output they have to repeat byte for byte
+// 'l' sizes are left out: long is wider than int outside of Win32, so sprintf would read the values wrong
+
+using namespace CLEO;
+
+namespace
+{
+    const char *integerSpecs[] =
+    {
+        "%d", "%i", "%u", "%x", "%X", "%o", "%5d", "%-5d", "%05d", "%08x", "%-8X", "%012o", "%0-5d", "%-05d", "%1d", "%20u",
+        "%64d", "%064x", "%65d", "%+d", "% d", "%#x", "%#o", "%.3d", "%.0d", "%hd", "%hu", "%hx",
+    };
+
+    const char *realSpecs[] =
+    {
+        "%f", "%F", "%.0f", "%.1f", "%.2f", "%.3f", "%.6f", "%.9f", "%.10f", "%.12f", "%10.3f", "%-10.1f", "%010.4f", "%08.2f",
+        "%-012.5f", "%64.2f", "%65f", "%+f", "% .2f", "%#.0f", "%e", "%.3E", "%g", "%G", "%.3g", "%a",
+    };
+
+    const FormatToken& CompileSpec(CFormatProgram& program, const char *spec)
+    {
+        program.Compile(spec, strlen(spec));
+        CHECK_EQ(program.tokens.size(), 1u);
+        return program.tokens.front();
+    }
+
+    // returns true if the value has been printed natively
+    bool CheckInteger(const char *spec, DWORD value)
+    {
+        CFormatProgram program;
+        auto& token = CompileSpec(program, spec);
+        CHECK_EQ(token.kind, FormatToken::INTEGER);
+
+        char native[256], expected[256];
+        int len = FormatInteger(native, token, value);
+        if (len < 0) return false;
+        native[len] = '\0';
+        sprintf(expected, program.GetText(token), value);
+        if (strcmp(native, expected))
+        {
+            printf("%s of %u: '%s', sprintf gives '%s'\n", spec, value, native, expected);
+            CHECK(!"integer differs from sprintf");
+        }
+        return true;
+    }
+
+    bool CheckReal(const char *spec, float value)
+    {
+        CFormatProgram program;
+        auto& token = CompileSpec(program, spec);
+        CHECK_EQ(token.kind, FormatToken::REAL);
+
+        char native[256], expected[256];
+        int len = FormatReal(native, token, value);
+        if (len < 0) return false;
+        native[len] = '\0';
+        sprintf(expected, program.GetText(token), value);
+        if (strcmp(native, expected))
+        {
+            printf("%s of %.9g: '%s', sprintf gives '%s'\n", spec, value, native, expected);
+            CHECK(!"float differs from sprintf");
+        }
+        return true;
+    }
+
+    void TestCompile()
+    {
+        CFormatProgram program;
+        const char *format = "x=%5d%% %-s %c%p %.2f %*d%";
+        program.Compile(format, strlen(format));
+
+        const FormatToken::Kind kinds[] =
+        {
+            FormatToken::LITERAL, FormatToken::INTEGER, FormatToken::LITERAL, FormatToken::STRING, FormatToken::LITERAL,
+            FormatToken::CHAR, FormatToken::POINTER, FormatToken::LITERAL, FormatToken::REAL, FormatToken::LITERAL,
+            FormatToken::INTEGER, FormatToken::INCOMPLETE,
+        };
+        CHECK_EQ(program.tokens.size(), sizeof(kinds) / sizeof(*kinds));
+        for (size_t i = 0; i < program.tokens.size() && i < sizeof(kinds) / sizeof(*kinds); ++i) CHECK_EQ(program.tokens[i].kind, kinds[i]);
+
+        CHECK(!strncmp(program.GetText(program.tokens[0]), "x=", program.tokens[0].textLength));
+        CHECK(!strcmp(program.GetText(program.tokens[1]), "%5d"));
+        CHECK_EQ(program.tokens[1].width, 5);
+        CHECK(!strncmp(program.GetText(program.tokens[2]), "% ", program.tokens[2].textLength));
+        CHECK_EQ(program.tokens[8].precision, 2);
+        CHECK_EQ(program.tokens[10].numStars, 1);
+        CHECK(program.tokens[10].flags & FormatToken::DYNAMIC);
+
+        // stars are replaced with the values read for them, a star of precision stays the conversion
+        char out[64];
+        int stars[] = { 7, 3 }, *star = stars;
+        BuildDynamicFormat("%-*d", out, [&] { return *star++; });
+        CHECK(!strcmp(out, "%-7d"));
+        BuildDynamicFormat("%.*f", out, [&] { return *star++; });
+        CHECK(!strcmp(out, "%.3*f"));
+    }
+
+    void TestIntegers()
+    {
+        const DWORD edges[] = { 0, 1, 7, 8, 9, 10, 15, 16, 99, 100, 0x7FFFFFFF, 0x80000000, 0x80000001, 0xFFFFFFFF, 0xFFFFFFFE, 12345678 };
+        std::mt19937 rng(23);
+        size_t native = 0;
+
+        for (auto spec : integerSpecs)
+        {
+            for (auto value : edges) native += CheckInteger(spec, value);
+            for (int i = 0; i < 2000; ++i)
+            {
+                DWORD value = rng();
+                if (i % 2) value >>= rng() % 32;
+                if (i % 3 == 0) value = 0u - value;
+                native += CheckInteger(spec, value);
+            }
+        }
+        printf("integers: %u printed natively\n", static_cast<unsigned>(native));
+        CHECK(native > 0);
+    }
+
+    void TestReals()
+    {
+        const float edges[] =
+        {
+            0.0f, -0.0f, 1.0f, -1.0f, 0.5f, 1.5f, 2.5f, -2.5f, 0.125f, 0.0625f, 0.05f, 0.005f, 0.0005f, 9.5f, 99.95f, 999999.5f,
+            123.456f, 1e-10f, 1e10f, 16777216.0f, 16777217.0f, 3.4e38f, FLT_MAX, -FLT_MAX, FLT_MIN, FLT_EPSILON, 1.4e-45f,
+            INFINITY, -INFINITY, NAN,
+        };
+        std::mt19937 rng(29);
+        size_t native = 0, randomNative = 0, checked = 0;
+
+        for (auto spec : realSpecs)
+        {
+            for (auto value : edges) native += CheckReal(spec, value);
+            for (int i = 0; i < 2000; ++i)
+            {
+                float value = static_cast<float>(static_cast<int>(rng()) % 100000) / static_cast<float>(1 + rng() % 1000);
+                native += CheckReal(spec, value);
+            }
+        }
+
+        // random bits of every finite float, with random precision, width and flags
+        for (int i = 0; i < 2000000; ++i)
+        {
+            DWORD bits = rng();
+            float value;
+            memcpy(&value, &bits, sizeof(value));
+            if (!std::isfinite(value)) continue;
+
+            char spec[32];
+            unsigned flags = rng() % 3, width = rng() % 3 ? 0 : rng() % 20, precision = rng() % 10;
+            sprintf(spec, "%%%s%u.%uf", flags == 1 ? "0" : flags == 2 ? "-" : "", width, precision);
+            randomNative += CheckReal(spec, value);
+            ++checked;
+        }
+        printf("floats: %u of the corpus and %u of %u random values printed natively\n",
+            static_cast<unsigned>(native), static_cast<unsigned>(randomNative), static_cast<unsigned>(checked));
+        CHECK(native > 0);
+        CHECK(randomNative > checked / 2);
+    }
+}
+
+int main()
+{
+    TestCompile();
+    TestIntegers();
+    TestReals();
+    return CLEO::Test::Result("FormatTest");
+}
@@ -0,0 +1,160 @@
+#include "stdafx.h"
+#include "CSaveFile.h"
+#include "Check.h"
+#include <random>
+
+// round trips of the cleo save container, damaged files have to be rejected without reading out of the data
+
+using namespace CLEO;
+
+namespace
+{
+    const DWORD SECTION_UNKNOWN = MakeSaveSectionId('T', 'E', 'S', 'T');
+
+    std::vector<BYTE> SampleVariables()
+    {
+        std::vector<BYTE> vars(4096, 0);
+        for (size_t i = 0; i < vars.size(); i += 97) vars[i] = static_cast<BYTE>(i);
+        return vars;
+    }
+
+    std::vector<BYTE> BuildSample()
+    {
+        auto vars = SampleVariables();
+        const char text[] = "not packed";
+        CSaveFileWriter writer;
+        writer.AddSection(SAVE_SECTION_VARIABLES, vars.data(), vars.size(), true);
+        writer.AddSection(SAVE_SECTION_STOPPED_THREADS, text, sizeof(text));
+        writer.AddSection(SECTION_UNKNOWN, nullptr, 0, true);
+        return writer.Build();
+    }
+
+    void TestRoundTrip()
+    {
+        auto file = BuildSample();
+        CHECK(file.size() < 4096);                  // variables are packed
+
+        CSaveFileReader reader;
+        reader.Parse(file.data(), file.size());
+        CHECK(!reader.IsLegacy());
+
+        const BYTE *data;
+        size_t size;
+        CHECK(reader.GetSection(SAVE_SECTION_VARIABLES, data, size));
+        auto vars = SampleVariables();
+        CHECK_EQ(size, vars.size());
+        CHECK(size == vars.size() && !memcmp(data, vars.data(), size));
+
+        CHECK(reader.GetSection(SAVE_SECTION_STOPPED_THREADS, data, size));
+        CHECK_EQ(std::string(reinterpret_cast<const char *>(data)), "not packed");
+        CHECK(reader.GetSection(SECTION_UNKNOWN, data, size));
+        CHECK_EQ(size, 0u);
+        CHECK(!reader.GetSection(SAVE_SECTION_BLOBS, data, size));
+    }
+
+    void TestPacking()
+    {
+        // data packing would not make smaller is stored as it is
+        std::vector<BYTE> noise(300);
+        std::mt19937 rng(5);
+        for (auto& c : noise) c = static_cast<BYTE>(rng() | 1);
+        std::vector<BYTE> runs(1000, 0);
+        runs[0] = 1; runs[500] = 2; runs[501] = 0; runs[502] = 3; runs[999] = 4;
+
+        CSaveFileWriter writer;
+        writer.AddSection(SAVE_SECTION_THREADS, noise.data(), noise.size(), true);
+        writer.AddSection(SAVE_SECTION_GLOBAL_VARS, runs.data(), runs.size(), true);
+        auto file = writer.Build();
+
+        CSaveFileReader reader;
+        reader.Parse(file.data(), file.size());
+        const BYTE *data;
+        size_t size;
+        CHECK(reader.GetSection(SAVE_SECTION_THREADS, data, size));
+        CHECK(size == noise.size() && !memcmp(data, noise.data(), size));
+        CHECK(reader.GetSection(SAVE_SECTION_GLOBAL_VARS, data, size));
+        CHECK(size == runs.size() && !memcmp(data, runs.data(), size));
+    }
+
+    void TestDamaged()
+    {
+        auto file = BuildSample();
+        const BYTE *data;
+        size_t size;
+
+        {
+            // section data
+            auto damaged = file;
+            auto directory = reinterpret_cast<const SaveSectionEntry *>(file.data() + sizeof(SaveFileHeader));
+            damaged[directory[1].offset] ^= 1;
+            CSaveFileReader reader;
+            reader.Parse(damaged.data(), damaged.size());
+            CHECK_THROWS(reader.GetSection(SAVE_SECTION_STOPPED_THREADS, data, size));
+        }
+        {
+            // section directory
+            auto damaged = file;
+            damaged[sizeof(SaveFileHeader) + 8] ^= 1;
+            CSaveFileReader reader;
+            CHECK_THROWS(reader.Parse(damaged.data(), damaged.size()));
+        }
+        {
+            CSaveFileReader reader;
+            CHECK_THROWS(reader.Parse(file.data(), sizeof(SaveFileHeader) + 4));
+            CHECK_THROWS(reader.Parse(file.data(), 2));
+        }
+        {
+            auto newer = file;
+            reinterpret_cast<SaveFileHeader *>(newer.data())->version = SAVE_FILE_VERSION + 1;
+            CSaveFileReader reader;
+            CHECK_THROWS(reader.Parse(newer.data(), newer.size()));
+        }
+        {
+            DWORD legacy[] = { LEGACY_SAVE_FILE_SIGNATURE, 0, 0 };
+            CSaveFileReader reader;
+            reader.Parse(reinterpret_cast<const BYTE *>(legacy), sizeof(legacy));
+            CHECK(reader.IsLegacy());
+        }
+    }
+
+    // random damage must end with a valid section or an exception (the sanitizers catch reads out of the data)
+    void TestFuzz()
+    {
+        auto file = BuildSample();
+        std::mt19937 rng(17);
+        const DWORD ids[] = { SAVE_SECTION_VARIABLES, SAVE_SECTION_STOPPED_THREADS, SECTION_UNKNOWN };
+        for (int i = 0; i < 20000; ++i)
+        {
+            auto damaged = file;
+            damaged.resize(rng() % 2 ? damaged.size() : rng() % damaged.size());
+            for (int k = rng() % 4; k >= 0 && !damaged.empty(); --k) damaged[rng() % damaged.size()] = static_cast<BYTE>(rng());
+            try
+            {
+                CSaveFileReader reader;
+                reader.Parse(damaged.data(), damaged.size());
+                const BYTE *data;
+                size_t size;
+                for (auto id : ids)
+                {
+                    if (reader.GetSection(id, data, size) && size)
+                    {
+                        volatile BYTE sum = 0;
+                        for (size_t n = 0; n < size; ++n) sum += data[n];
+                    }
+                }
+            }
+            catch (const std::exception&)
+            {
+            }
+        }
+    }
+}
+
+int main()
+{
+    TestRoundTrip();
+    TestPacking();
+    TestDamaged();
+    TestFuzz();
+    return CLEO::Test::Result("SaveFileTest");
+}
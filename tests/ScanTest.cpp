@@ -0,0 +1,281 @@
+#include "stdafx.h"
+#include "CScanProgram.h"
+#include "Check.h"
+#include <chrono>
+#include <functional>
+#include <random>
+
+// compiled scan formats of 0AD4, 0ADA and CLEO_ScanBuffer checked against sscanf and fscanf of the C runtime:
+// whatever the program decides itself has to match them, undecided input goes to the C runtime the same way the opcodes do it
+// 'l' is dropped from the formats given to the C runtime, as long is wider than int outside of Win32
+
+using namespace CLEO;
+
+namespace
+{
+    const char *directives[] =
+    {
+        "%d", "%u", "%x", "%X", "%f", "%g", "%e", "%s", "%c", "%n", "%*d", "%*s", "%3d", "%2x", "%5s", "%3c", "%4f", "%ld", "%lx",
+        " ", ",", ":", "ab", "\t", "%*f", "%1s", "%2f",
+    };
+
+    const char *pieces[] =
+    {
+        "12", "-7", "+3", "0x1f", "0X", "ff", "1.5", "-2.25e3", "1e", "1e+", "abc", " ", "  ", "\t", "\n", ",", ":", "ab", "0", "00012",
+        "4294967295", "99999999999", "x", "-", "+", ".", "5.", "inf", "nan", "0x1.8p1", "Z", "1234567890", "deadbeef", "1e-40", "3.4e39", "a",
+    };
+
+    const size_t MAX_VALUES = 8;
+
+    union Value
+    {
+        int i;
+        float f;
+        char s[64];
+    };
+
+    struct Values
+    {
+        Value values[MAX_VALUES];
+        void *args[MAX_VALUES];
+
+        Values()
+        {
+            memset(values, 0x55, sizeof(values));
+            for (size_t i = 0; i < MAX_VALUES; ++i) args[i] = &values[i];
+        }
+
+        bool operator==(const Values& other) const { return !memcmp(values, other.values, sizeof(values)); }
+    };
+
+    std::string RuntimeFormat(std::string format)
+    {
+        for (size_t pos; (pos = format.find("%l")) != std::string::npos;) format.erase(pos + 1, 1);
+        return format;
+    }
+
+    int RuntimeScan(const char *input, const std::string& format, Values& out)
+    {
+        void **a = out.args;
+        return sscanf(input, format.c_str(), a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]);
+    }
+
+    int RuntimeScan(FILE *file, const std::string& format, Values& out)
+    {
+        void **a = out.args;
+        return fscanf(file, format.c_str(), a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]);
+    }
+
+    // the way 0ADA scans the file
+    int ScanFile(const CScanProgram& program, FILE *file, const std::string& format, Values& out)
+    {
+        int result = program.Scan(file, out.args);
+        return result != CScanProgram::UNDECIDED ? result : RuntimeScan(file, format, out);
+    }
+
+    FILE *OpenInput(const std::string& input)
+    {
+        FILE *file = tmpfile();
+        fwrite(input.data(), 1, input.size(), file);
+        rewind(file);
+        return file;
+    }
+
+    void TestAgainstRuntime()
+    {
+        std::mt19937 rng(7);
+        size_t decided = 0, undecided = 0, files = 0;
+
+        for (int i = 0; i < 400000; ++i)
+        {
+            std::string format, input;
+            for (int n = 1 + rng() % 5; n; --n) format += directives[rng() % (sizeof(directives) / sizeof(*directives))];
+            for (int n = rng() % 7; n; --n) input += pieces[rng() % (sizeof(pieces) / sizeof(*pieces))];
+
+            CScanProgram program;
+            program.Compile(format.c_str(), format.size());
+            if (!program.supported) continue;
+            auto runtimeFormat = RuntimeFormat(format);
+
+            Values scanned, expected;
+            const char *pos = input.c_str();
+            int result = program.Scan(pos, pos + input.size(), scanned.args);
+            if (result == CScanProgram::UNDECIDED)
+            {
+                ++undecided;
+                continue;
+            }
+            ++decided;
+
+            int consumed = -1;
+            Values counted;
+            counted.args[program.numArgs] = &consumed;
+            int expectedResult = RuntimeScan(input.c_str(), runtimeFormat + "%n", counted);
+            RuntimeScan(input.c_str(), runtimeFormat, expected);
+
+            bool same = result == expectedResult && scanned == expected;
+            // the input is only advanced if the whole format has been matched, as %n appended to the format tells
+            same &= pos - input.c_str() == (consumed < 0 ? 0 : consumed);
+            if (!same)
+            {
+                printf("sscanf of '%s' with '%s': %d, %d expected\n", input.c_str(), format.c_str(), result, expectedResult);
+                CHECK(!"scan differs from sscanf");
+            }
+
+            // files have to end up the same in every case, as undecided input is scanned by fscanf again
+            if (i % 10 == 0 && !input.empty())
+            {
+                FILE *file = OpenInput(input), *expectedFile = OpenInput(input);
+                Values fileScanned, fileExpected;
+                result = ScanFile(program, file, runtimeFormat, fileScanned);
+                expectedResult = RuntimeScan(expectedFile, runtimeFormat, fileExpected);
+                if (result != expectedResult || !(fileScanned == fileExpected) || ftell(file) != ftell(expectedFile) ||
+                    fgetc(file) != fgetc(expectedFile))
+                {
+                    printf("fscanf of '%s' with '%s': %d, %d expected\n", input.c_str(), format.c_str(), result, expectedResult);
+                    CHECK(!"file scan differs from fscanf");
+                }
+                fclose(file);
+                fclose(expectedFile);
+                ++files;
+            }
+        }
+        printf("scan: %u decided, %u undecided, %u files\n",
+            static_cast<unsigned>(decided), static_cast<unsigned>(undecided), static_cast<unsigned>(files));
+        CHECK(decided > undecided);
+    }
+
+    void TestUndecidedFile()
+    {
+        // malformed number: the file is put back, fscanf reads the same characters again
+        CScanProgram program;
+        program.Compile("%d %f", 5);
+        FILE *file = OpenInput("12 1e+x rest");
+        Values values;
+        CHECK_EQ(program.Scan(file, values.args), CScanProgram::UNDECIDED);
+        CHECK_EQ(ftell(file), 0);
+        fclose(file);
+    }
+
+    void TestMayWrite()
+    {
+        CScanProgram program;
+        program.Compile("%d %*s %s %3c", 14);
+        CHECK_EQ(program.numArgs, 3u);
+
+        char text[64] = "1 skipped word abc";
+        size_t length = strlen(text);
+        const char *begin = text, *end = text + length + 1;
+        char other[64], buffer[128];
+        int number;
+
+        void *apart[] = { &number, other, other + 32 };
+        CHECK(!program.MayWrite(apart, length, begin, end));
+
+        void *numberInside[] = { text + length - 2, other, other + 32 };
+        CHECK(program.MayWrite(numberInside, length, begin, end));
+
+        void *onTerminator[] = { &number, other, text + length };
+        CHECK(program.MayWrite(onTerminator, length, begin, end));
+
+        // %3c right before the input, then one character into it
+        void *charsBeforeInput[] = { &number, other, buffer + 40 - 3 };
+        CHECK(!program.MayWrite(charsBeforeInput, length, buffer + 40, buffer + 60));
+        charsBeforeInput[2] = buffer + 40 - 2;
+        CHECK(program.MayWrite(charsBeforeInput, length, buffer + 40, buffer + 60));
+
+        // %s may take the whole input and its terminator
+        void *stringBefore[] = { &number, buffer, other };
+        CHECK(program.MayWrite(stringBefore, length, buffer + length, buffer + 2 * length + 1));
+        CHECK(!program.MayWrite(stringBefore, length, buffer + length + 1, buffer + 2 * length + 2));
+
+        CScanProgram limited;
+        limited.Compile("%5s", 3);
+        void *limitedString[] = { buffer };
+        CHECK(limited.MayWrite(limitedString, length, buffer + 5, buffer + 10));
+        CHECK(!limited.MayWrite(limitedString, length, buffer + 6, buffer + 10));
+    }
+
+    // records of a large generated file, read the ways 0ADA (from the file), 0AD4 (line by line) and CLEO_ScanBuffer (whole buffer) do
+    void ReportThroughput()
+    {
+        std::mt19937 rng(31);
+        std::string data;
+        std::vector<std::string> lines;
+        const int numRecords = 200000;
+        char line[96];
+        for (int i = 0; i < numRecords; ++i)
+        {
+            sprintf(line, "%d %d %.3f name_%u\n", static_cast<int>(rng() % 100000) - 50000, static_cast<int>(rng() % 1000),
+                static_cast<float>(rng() % 1000000) / 1000.0f, static_cast<unsigned>(rng() % 1000));
+            data += line;
+            lines.push_back(line);
+        }
+
+        const char *format = "%d %d %f %s";
+        CScanProgram program;
+        program.Compile(format, strlen(format));
+        int a, b;
+        float c;
+        char s[64];
+        void *args[] = { &a, &b, &c, s };
+
+        auto measure = [&](const char *name, const std::function<int()>& scanAll)
+        {
+            auto start = std::chrono::steady_clock::now();
+            int records = scanAll();
+            auto time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            printf("%-24s %6.1f MB/s, %.0f ns per record\n", name, data.size() / time / (1024.0 * 1024.0), time * 1e9 / numRecords);
+            CHECK_EQ(records, numRecords);
+        };
+
+        measure("fscanf", [&]
+        {
+            FILE *file = OpenInput(data);
+            int records = 0;
+            while (fscanf(file, format, &a, &b, &c, s) == 4) ++records;
+            fclose(file);
+            return records;
+        });
+        measure("compiled, file", [&]
+        {
+            FILE *file = OpenInput(data);
+            int records = 0;
+            while (program.Scan(file, args) == 4) ++records;
+            fclose(file);
+            return records;
+        });
+        measure("sscanf, lines", [&]
+        {
+            int records = 0;
+            for (auto& line : lines) records += sscanf(line.c_str(), format, &a, &b, &c, s) == 4;
+            return records;
+        });
+        measure("compiled, lines", [&]
+        {
+            int records = 0;
+            for (auto& line : lines)
+            {
+                const char *pos = line.c_str();
+                records += program.Scan(pos, pos + line.size(), args) == 4;
+            }
+            return records;
+        });
+        measure("compiled, buffer", [&]
+        {
+            const char *pos = data.c_str(), *end = pos + data.size();
+            int records = 0;
+            while (program.Scan(pos, end, args) == 4) ++records;
+            return records;
+        });
+    }
+}
+
+int main()
+{
+    TestAgainstRuntime();
+    TestUndecidedFile();
+    TestMayWrite();
+    ReportThroughput();
+    return CLEO::Test::Result("ScanTest");
+}
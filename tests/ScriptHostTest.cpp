@@ -0,0 +1,297 @@
+#include "ScriptHost.h"
+#include "Check.h"
+#include <chrono>
+#include <functional>
+#include <map>
+
+// hand-assembled scripts run by the headless host with both ways of dispatch,
+// then the throughput of the dispatch, of scm function calls and of the verifier is reported
+
+using namespace CLEO;
+using namespace CLEO::Host;
+
+namespace
+{
+    // labels are resolved when the code is finished, as offsets relative to the script (negative)
+    class Code
+    {
+        std::vector<BYTE> bytes;
+        std::map<std::string, size_t> labels;
+        std::vector<std::pair<size_t, std::string>> refs;
+
+    public:
+        Code& Opcode(WORD opcode) { return Raw(&opcode, sizeof(opcode)); }
+        Code& Not(WORD opcode) { return Opcode(opcode | 0x8000); }
+        Code& Var(WORD offset) { bytes.push_back(DT_VAR); return Raw(&offset, sizeof(offset)); }
+        Code& LVar(WORD index) { bytes.push_back(DT_LVAR); return Raw(&index, sizeof(index)); }
+        Code& Int(int value) { bytes.push_back(DT_DWORD); return Raw(&value, sizeof(value)); }
+        Code& Float(float value) { bytes.push_back(DT_FLOAT); return Raw(&value, sizeof(value)); }
+        Code& Text(const char *text)
+        {
+            bytes.push_back(DT_VARLEN_STRING);
+            bytes.push_back(static_cast<BYTE>(strlen(text)));
+            return Raw(text, strlen(text));
+        }
+        Code& End() { bytes.push_back(DT_END); return *this; }
+        Code& Label(const std::string& name) { labels[name] = bytes.size(); return *this; }
+        Code& Ref(const std::string& name)
+        {
+            refs.emplace_back(bytes.size() + 1, name);
+            return Int(0);
+        }
+        Code& Raw(const void *data, size_t size)
+        {
+            auto p = static_cast<const BYTE *>(data);
+            bytes.insert(bytes.end(), p, p + size);
+            return *this;
+        }
+
+        const std::vector<BYTE>& Finish()
+        {
+            for (auto& ref : refs)
+            {
+                int label = -static_cast<int>(labels.at(ref.second));
+                memcpy(&bytes[ref.first], &label, sizeof(label));
+            }
+            refs.clear();
+            return bytes;
+        }
+    };
+
+    HostScript& Load(ScriptHost& host, Code& code)
+    {
+        auto& bytes = code.Finish();
+        return host.Load(bytes.data(), bytes.size());
+    }
+
+    const DispatchMode dispatchModes[] = { DispatchMode::GAME, DispatchMode::FLAT };
+
+    void TestLoop(DispatchMode dispatch)
+    {
+        // sum of 0..99, then 3 frames of waiting
+        Code code;
+        code.Opcode(0x03A4).Text("loop")
+            .Opcode(0x0006).LVar(0).Int(0)
+            .Opcode(0x0006).LVar(1).Int(0)
+            .Label("loop")
+            .Opcode(0x0A8E).LVar(1).LVar(0).LVar(1)
+            .Opcode(0x000A).LVar(0).Int(1)
+            .Opcode(0x00D6).Int(0)
+            .Opcode(0x0019).LVar(0).Int(99)
+            .Opcode(0x004D).Ref("loop")
+            .Opcode(0x0001).Int(50)
+            .Opcode(0x0006).LVar(2).Int(1)
+            .Opcode(0x0A93);
+
+        ScriptHost host(dispatch);
+        auto& script = Load(host, code);
+        CHECK(script.index.IsComplete());
+        CHECK_EQ(host.Process(20), 1u + 2 + 100 * 5 + 1);
+        CHECK(!strcmp(script.GetName(), "loop"));
+        CHECK_EQ(script.GetIntVar(1), 4950);
+        CHECK_EQ(host.Process(20), 0u);
+        CHECK_EQ(host.Process(20), 0u);
+        CHECK(!host.IsIdle());
+        CHECK_EQ(host.Process(20), 2u);
+        CHECK_EQ(script.GetIntVar(2), 1);
+        CHECK(host.IsIdle());
+    }
+
+    void TestConditions(DispatchMode dispatch)
+    {
+        // @0 = 10: (@0 > 5 and not @0 > 20) sets @1, (@0 == 5 or @0 >= 11) does not set @2
+        Code code;
+        code.Opcode(0x0006).LVar(0).Int(10)
+            .Opcode(0x00D6).Int(1)
+            .Opcode(0x0019).LVar(0).Int(5)
+            .Not(0x0019).LVar(0).Int(20)
+            .Opcode(0x004D).Ref("or")
+            .Opcode(0x0006).LVar(1).Int(1)
+            .Label("or")
+            .Opcode(0x00D6).Int(21)
+            .Opcode(0x0039).LVar(0).Int(5)
+            .Opcode(0x0029).LVar(0).Int(11)
+            .Opcode(0x004D).Ref("gosub")
+            .Opcode(0x0006).LVar(2).Int(1)
+            .Label("gosub")
+            .Opcode(0x0050).Ref("sub")
+            .Opcode(0x0A93)
+            .Label("sub")
+            .Opcode(0x0005).Var(0x10).Float(1.5f)
+            .Opcode(0x0009).Var(0x10).Float(2.0f)
+            .Opcode(0x0051);
+
+        ScriptHost host(dispatch);
+        auto& script = Load(host, code);
+        host.Run(1);
+        CHECK(host.IsIdle());
+        CHECK_EQ(script.GetIntVar(1), 1);
+        CHECK_EQ(script.GetIntVar(2), 0);
+        CHECK_EQ(GetScriptGlobalVarPointer(0x10)->fParam, 3.5f);
+    }
+
+    // @0 = fib(@0), recursively
+    void AddFibonacci(Code& code)
+    {
+        code.Label("fib")
+            .Opcode(0x00D6).Int(0)
+            .Opcode(0x0019).LVar(0).Int(1)
+            .Opcode(0x004D).Ref("fib_end")
+            .Opcode(0x0A8F).LVar(0).Int(1).LVar(1)
+            .Opcode(0x0A8F).LVar(0).Int(2).LVar(2)
+            .Opcode(0x0AB1).Ref("fib").Int(1).LVar(1).LVar(1).End()
+            .Opcode(0x0AB1).Ref("fib").Int(1).LVar(2).LVar(2).End()
+            .Opcode(0x0A8E).LVar(1).LVar(2).LVar(3)
+            .Opcode(0x0AB2).Int(1).LVar(3).End()
+            .Label("fib_end")
+            .Opcode(0x0AB2).Int(1).LVar(0).End();
+    }
+
+    void TestScmFunctions(DispatchMode dispatch)
+    {
+        Code code;
+        code.Opcode(0x0006).LVar(10).Int(77)
+            .Opcode(0x0006).LVar(5).Int(-1)
+            .Opcode(0x0AB1).Ref("fib").Int(1).Int(15).LVar(5).End()
+            // condition result of the function is passed to the caller
+            .Opcode(0x00D6).Int(0)
+            .Opcode(0x0AB1).Ref("positive").Int(1).LVar(10).End()
+            .Opcode(0x004D).Ref("text")
+            .Opcode(0x0006).LVar(6).Int(1)
+            .Label("text")
+            .Opcode(0x0AB1).Ref("store").Int(2).Text("passed").LVar(10).End()
+            .Opcode(0x0A93)
+            .Label("positive")
+            .Opcode(0x0019).LVar(0).Int(0)
+            .Opcode(0x0AB2).Int(0).End()
+            .Label("store")
+            .Opcode(0x0AB3).Int(0).LVar(0)
+            .Opcode(0x0AB3).Int(1).LVar(1)
+            .Opcode(0x0AB2).Int(0).End();
+        AddFibonacci(code);
+
+        ScriptHost host(dispatch);
+        auto& script = Load(host, code);
+        host.Run(1);
+        CHECK(host.IsIdle());
+        CHECK_EQ(script.GetIntVar(5), 610);
+        CHECK_EQ(script.GetIntVar(10), 77);     // out of the functions' scopes
+        CHECK_EQ(script.GetIntVar(6), 1);
+        CHECK(!strcmp(host.cleoVariables[0].pcParam, "passed"));
+        CHECK_EQ(host.cleoVariables[1].nParam, 77);
+        CHECK(script.callStack.Empty());
+    }
+
+    void TestErrors()
+    {
+        ScriptHost host;
+        Code unknown;
+        unknown.Opcode(0x0006).LVar(0).Int(1).Opcode(0x0BEE).Opcode(0x0A93);
+        auto& script = Load(host, unknown);
+        CHECK(!script.index.IsComplete());
+        CHECK_THROWS(host.Process(20));
+
+        // jump out of the script is rejected by the verifier
+        Code outside;
+        outside.Opcode(0x0002).Int(-1000);
+        CHECK_THROWS(Load(host, outside));
+    }
+
+    double Seconds(const std::function<void()>& run)
+    {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // opcodes of both groups of the game's table and of CLEO's, the way the script loop dispatches them
+    void ReportDispatch()
+    {
+        const int iterations = 1000000;
+        Code code;
+        code.Opcode(0x0006).LVar(0).Int(0)
+            .Label("loop")
+            .Opcode(0x0A8E).LVar(0).Int(1).LVar(0)
+            .Opcode(0x0A90).LVar(0).Int(1).LVar(1)
+            .Opcode(0x0AB3).Int(0).LVar(1)
+            .Opcode(0x0000)
+            .Opcode(0x00D6).Int(0)
+            .Opcode(0x0019).LVar(0).Int(iterations - 1)
+            .Opcode(0x004D).Ref("loop")
+            .Opcode(0x0A93);
+
+        for (auto dispatch : dispatchModes)
+        {
+            ScriptHost host(dispatch);
+            Load(host, code);
+            size_t executed = 0;
+            double time = Seconds([&] { executed = host.Process(20); });
+            printf("dispatch, %-4s %6.2f ns per opcode\n", dispatch == DispatchMode::GAME ? "game" : "flat", time * 1e9 / executed);
+            CHECK_EQ(executed, 2u + 7u * iterations);
+        }
+    }
+
+    void ReportScmCalls()
+    {
+        Code code;
+        code.Opcode(0x0AB1).Ref("fib").Int(1).Int(24).LVar(0).End()
+            .Opcode(0x0A93);
+        AddFibonacci(code);
+
+        ScriptHost host;
+        auto& script = Load(host, code);
+        double time = Seconds([&] { host.Run(1); });
+        const int calls = 2 * 46368 - 1;        // fib(24) calls
+        printf("recursive 0AB1, %6.2f ns per call, with the body of the function\n", time * 1e9 / calls);
+        CHECK_EQ(script.GetIntVar(0), 46368);
+    }
+
+    // large script: chain of conditional calls of functions, each using a few locals
+    void ReportVerifier()
+    {
+        const int numFunctions = 20000;
+        Code code;
+        for (int i = 0; i < numFunctions; ++i)
+        {
+            auto fn = "fn" + std::to_string(i), next = "next" + std::to_string(i);
+            code.Opcode(0x0006).LVar(0).Int(i)
+                .Opcode(0x0A8E).LVar(0).LVar(1).LVar(2)
+                .Opcode(0x00D6).Int(0)
+                .Opcode(0x0019).LVar(2).Int(5)
+                .Opcode(0x004D).Ref(next)
+                .Opcode(0x0AB1).Ref(fn).Int(1).LVar(0).LVar(3).End()
+                .Label(next);
+        }
+        code.Opcode(0x0A93);
+        for (int i = 0; i < numFunctions; ++i)
+        {
+            code.Label("fn" + std::to_string(i))
+                .Opcode(0x0A90).LVar(0).Int(i).LVar(i % 8)
+                .Opcode(0x0AB2).Int(1).LVar(i % 8).End();
+        }
+
+        auto& bytes = code.Finish();
+        const int runs = 5;
+        CBytecodeIndex index;
+        double time = Seconds([&] { for (int i = 0; i < runs; ++i) BuildBytecodeIndex(bytes.data(), bytes.size(), index); });
+        printf("verifier, %6.1f MB/s of %u KB\n", bytes.size() * runs / time / (1024.0 * 1024.0), static_cast<unsigned>(bytes.size() / 1024));
+        CHECK(index.IsComplete());
+        CHECK_EQ(index.indexedBytes, bytes.size());
+        CHECK_EQ(index.functionScopes.size(), static_cast<size_t>(numFunctions));
+    }
+}
+
+int main()
+{
+    for (auto dispatch : dispatchModes)
+    {
+        TestLoop(dispatch);
+        TestConditions(dispatch);
+        TestScmFunctions(dispatch);
+    }
+    TestErrors();
+    ReportDispatch();
+    ReportScmCalls();
+    ReportVerifier();
+    return CLEO::Test::Result("ScriptHostTest");
+}
@@ -0,0 +1,235 @@
+#include "stdafx.h"
+#include "ScriptParams.h"
+#include "Check.h"
+
+// operands are decoded from hand-assembled code against a mock script space and mission locals
+
+namespace CLEO
+{
+    BYTE *scmBlock;
+    extern "C" { SCRIPT_VAR *missionLocals = nullptr; }
+}
+
+using namespace CLEO;
+
+namespace
+{
+    BYTE scriptSpace[0x1000];
+    SCRIPT_VAR missionLocalStorage[1024];
+
+    class TestScript : public CRunningScript
+    {
+    public:
+        void SetMission(bool mission) { bIsMission = mission; }
+    };
+
+    class Code
+    {
+        std::vector<BYTE> bytes;
+
+    public:
+        Code& Byte(BYTE value) { bytes.push_back(value); return *this; }
+        Code& Word(WORD value) { return Raw(&value, sizeof(value)); }
+        Code& Dword(DWORD value) { return Raw(&value, sizeof(value)); }
+        Code& Float(float value) { return Raw(&value, sizeof(value)); }
+        Code& Raw(const void *data, size_t size)
+        {
+            auto p = static_cast<const BYTE *>(data);
+            bytes.insert(bytes.end(), p, p + size);
+            return *this;
+        }
+        Code& Text(const char *text, size_t size)
+        {
+            for (size_t i = 0; i < size; ++i) bytes.push_back(i < strlen(text) ? text[i] : 0);
+            return *this;
+        }
+        Code& Array(eDataType type, WORD offset, WORD indexVar, BYTE size, bool globalIndex)
+        {
+            return Byte(type).Word(offset).Word(indexVar).Byte(size).Byte(globalIndex ? 0x80 : 0);
+        }
+
+        BYTE *Data() { return bytes.data(); }
+        size_t Size() const { return bytes.size(); }
+    };
+
+    SCRIPT_VAR& Global(WORD offset) { return *reinterpret_cast<SCRIPT_VAR *>(scriptSpace + offset); }
+
+    void TestNumericOperands()
+    {
+        TestScript thread;
+        thread.SetIntVar(3, 1234);
+        thread.SetIntVar(5, 2);     // index of local array
+        thread.SetIntVar(9, -77);   // element 2 of local array at 7
+        Global(0x40).nParam = 555;
+        Global(0x10).nParam = 3;    // index of global array
+        Global(0x80 + 3 * 4).nParam = 999;
+
+        Code code;
+        code.Byte(DT_DWORD).Dword(0x12345678)
+            .Byte(DT_BYTE).Byte(0xFE)
+            .Byte(DT_WORD).Word(0x8001)
+            .Byte(DT_FLOAT).Float(2.5f)
+            .Byte(DT_VAR).Word(0x40)
+            .Byte(DT_LVAR).Word(3)
+            .Array(DT_VAR_ARRAY, 0x80, 0x10, 8, true)
+            .Array(DT_LVAR_ARRAY, 7, 5, 4, false)
+            .Byte(DT_STRING).Text("skipped", 16);
+        thread.SetIp(code.Data());
+
+        SCRIPT_VAR values[9];
+        ReadScriptParams(&thread, values, 9);
+        CHECK_EQ(values[0].dwParam, 0x12345678u);
+        CHECK_EQ(values[1].nParam, -2);             // bytes and words are signed
+        CHECK_EQ(values[2].nParam, -0x7FFF);
+        CHECK_EQ(values[3].fParam, 2.5f);
+        CHECK_EQ(values[4].nParam, 555);
+        CHECK_EQ(values[5].nParam, 1234);
+        CHECK_EQ(values[6].nParam, 999);
+        CHECK_EQ(values[7].nParam, -77);
+        CHECK_EQ(values[8].dwParam, 0u);            // not numeric, read as 0
+        CHECK_EQ(thread.GetBytePointer(), code.Data() + code.Size());
+    }
+
+    void TestMissionLocals()
+    {
+        TestScript thread;
+        thread.SetMission(true);
+        missionLocalStorage[40].nParam = 4040;
+
+        Code code;
+        code.Byte(DT_LVAR).Word(40).Byte(DT_LVAR).Word(41);
+        thread.SetIp(code.Data());
+
+        SCRIPT_VAR value;
+        CHECK(ReadScriptParam(&thread, value));
+        CHECK_EQ(value.nParam, 4040);
+        SCRIPT_VAR written;
+        written.nParam = 4141;
+        WriteScriptParam(&thread, written);
+        CHECK_EQ(missionLocalStorage[41].nParam, 4141);
+        CHECK_EQ(thread.GetIntVar(0), 0);           // own locals are not used by missions
+    }
+
+    void TestWriteAndPointers()
+    {
+        TestScript thread;
+        Code code;
+        code.Byte(DT_VAR).Word(0x200)
+            .Byte(DT_DWORD).Dword(1)                // constant, skipped
+            .Byte(DT_LVAR).Word(12)
+            .Byte(DT_VAR_STRING).Word(0x300)
+            .Array(DT_LVAR_TEXTLABEL_ARRAY, 4, 5, 3, false)
+            .Byte(DT_BYTE).Byte(1);
+        thread.SetIntVar(5, 3);
+        thread.SetIp(code.Data());
+
+        SCRIPT_VAR values[3];
+        values[0].nParam = 10;
+        values[1].nParam = 20;
+        values[2].nParam = 30;
+        WriteScriptParams(&thread, values, 3);
+        CHECK_EQ(Global(0x200).nParam, 10);
+        CHECK_EQ(thread.GetIntVar(12), 30);
+
+        CHECK_EQ(ReadScriptParamPointer(&thread), &Global(0x300));
+        CHECK_EQ(ReadScriptParamPointer(&thread), thread.GetVarPtr(4 + 2 * 3));
+        CHECK(ReadScriptParamPointer(&thread) == nullptr);
+        CHECK_EQ(thread.GetBytePointer(), code.Data() + code.Size());
+    }
+
+    void TestSkipping()
+    {
+        TestScript thread;
+        Code code;
+        code.Byte(DT_DWORD).Dword(0)
+            .Byte(DT_VAR).Word(0)
+            .Byte(DT_LVAR).Word(0)
+            .Byte(DT_BYTE).Byte(0)
+            .Byte(DT_WORD).Word(0)
+            .Byte(DT_FLOAT).Float(0)
+            .Array(DT_VAR_ARRAY, 0, 0, 0, false)
+            .Array(DT_LVAR_ARRAY, 0, 0, 0, false)
+            .Byte(DT_TEXTLABEL).Text("label", 8)
+            .Byte(DT_VAR_TEXTLABEL).Word(0)
+            .Byte(DT_LVAR_TEXTLABEL).Word(0)
+            .Array(DT_VAR_TEXTLABEL_ARRAY, 0, 0, 0, false)
+            .Array(DT_LVAR_TEXTLABEL_ARRAY, 0, 0, 0, false)
+            .Byte(DT_VARLEN_STRING).Byte(5).Text("hello", 5)
+            .Byte(DT_STRING).Text("long string", 16)
+            .Byte(DT_VAR_STRING).Word(0)
+            .Byte(DT_LVAR_STRING).Word(0)
+            .Array(DT_VAR_STRING_ARRAY, 0, 0, 0, false)
+            .Array(DT_LVAR_STRING_ARRAY, 0, 0, 0, false);
+        thread.SetIp(code.Data());
+        for (int i = 0; i < 19; ++i) SkipScriptParam(&thread);
+        CHECK_EQ(thread.GetBytePointer(), code.Data() + code.Size());
+    }
+
+    void TestTextOperands()
+    {
+        TestScript thread;
+        strcpy(reinterpret_cast<char *>(&Global(0x400)), "global string");
+        Code code;
+        code.Byte(DT_TEXTLABEL).Text("label", 8)
+            .Byte(DT_STRING).Text("sixteen chars!!!", 16)
+            .Byte(DT_VARLEN_STRING).Byte(5).Text("hello", 5)
+            .Byte(DT_VAR_STRING).Word(0x400)
+            .Byte(DT_DWORD).Dword(7);
+        thread.SetIp(code.Data());
+
+        ScriptStringView view;
+        CHECK(ReadScriptStringView(&thread, view));
+        CHECK_EQ(std::string(view.data, view.length), "label");
+        CHECK(ReadScriptStringView(&thread, view));
+        CHECK_EQ(std::string(view.data, view.length), "sixteen chars!!!");   // not terminated in the code
+        CHECK(ReadScriptStringView(&thread, view));
+        CHECK_EQ(std::string(view.data, view.length), "hello");
+        CHECK(ReadScriptStringView(&thread, view));
+        CHECK_EQ(std::string(view.data, view.length), "global string");
+        CHECK(!ReadScriptStringView(&thread, view));
+        CHECK(view.data == nullptr);
+        CHECK_EQ(thread.GetBytePointer(), code.Data() + code.Size());
+    }
+
+    void TestTextCopies()
+    {
+        TestScript thread;
+        Code code;
+        code.Byte(DT_VARLEN_STRING).Byte(2).Text("rt", 2)          // no terminator in the code
+            .Byte(DT_STRING).Text("sixteen chars!!!", 16)
+            .Byte(DT_TEXTLABEL).Text("label", 8)
+            .Byte(DT_DWORD).Dword(7);
+        thread.SetIp(code.Data());
+
+        char buf[16];
+        memset(buf, 'x', sizeof(buf));
+        ReadScriptStringParam(&thread, buf, sizeof(buf));
+        CHECK_EQ(std::string(buf), "rt");
+        CHECK(std::all_of(buf + 2, buf + sizeof(buf), [](char c) { return c == '\0'; }));
+
+        memset(buf, 'x', sizeof(buf));
+        ReadScriptStringParam(&thread, buf, 8);                     // truncated to fit with the terminator
+        CHECK_EQ(std::string(buf), "sixteen");
+        CHECK_EQ(buf[8], 'x');                                      // nothing written past size
+
+        ReadScriptStringParam(&thread, buf, sizeof(buf));
+        CHECK_EQ(std::string(buf), "label");
+        ReadScriptStringParam(&thread, buf, sizeof(buf));
+        CHECK_EQ(std::string(buf), "");
+        CHECK_EQ(thread.GetBytePointer(), code.Data() + code.Size());
+    }
+}
+
+int main()
+{
+    scmBlock = scriptSpace;
+    missionLocals = missionLocalStorage;
+
+    TestNumericOperands();
+    TestMissionLocals();
+    TestWriteAndPointers();
+    TestSkipping();
+    TestTextOperands();
+    TestTextCopies();
+    return CLEO::Test::Result("ScriptParamsTest");
+}
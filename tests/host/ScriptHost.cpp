@@ -0,0 +1,464 @@
+#include "ScriptHost.h"
+#include <stdexcept>
+
+namespace CLEO
+{
+    // mock of the game's script space and mission locals
+    static SCRIPT_VAR scriptSpace[Host::SCRIPT_SPACE_SIZE / sizeof(SCRIPT_VAR)];
+    static SCRIPT_VAR missionLocalStorage[Host::NUM_MISSION_LOCALS];
+
+    BYTE *scmBlock = reinterpret_cast<BYTE *>(scriptSpace);
+    extern "C" { SCRIPT_VAR *missionLocals = missionLocalStorage; }
+
+    namespace Host
+    {
+        namespace
+        {
+            const WORD NUM_OPCODE_GROUPS = 328;
+
+            typedef OpcodeResult (*GroupHandler)(HostScript *thread, WORD opcode);
+
+            OpcodeHandler flatHandlers[0x8000];
+            OpcodeHandler groupedHandlers[100][NUM_OPCODE_GROUPS];     // [opcode % 100][opcode / 100]
+            GroupHandler groupHandlers[NUM_OPCODE_GROUPS];
+
+            void ThrowScriptError(HostScript *thread, const char *what)
+            {
+                char buf[128];
+                sprintf(buf, "%s in script '%s'", what, thread->GetName());
+                throw std::runtime_error(buf);
+            }
+
+            OpcodeResult UnknownOpcode(HostScript *thread, WORD opcode)
+            {
+                char what[32];
+                sprintf(what, "unknown opcode %04X", opcode);
+                ThrowScriptError(thread, what);
+                return OR_INTERRUPT;
+            }
+
+            OpcodeResult DispatchGroup(HostScript *thread, WORD opcode)
+            {
+                auto handler = groupedHandlers[opcode % 100][opcode / 100];
+                return handler ? handler(thread) : UnknownOpcode(thread, opcode);
+            }
+
+            // game's CRunningScript::ProcessOneCommand
+            template<DispatchMode mode>
+            inline OpcodeResult ProcessOneCommand(HostScript *thread)
+            {
+                WORD opcode = static_cast<WORD>(thread->ReadDataWord());
+                thread->SetNotFlag((opcode & 0x8000) != 0);
+                opcode &= 0x7FFF;
+                ++thread->executed;
+
+                if (mode == DispatchMode::GAME) return groupHandlers[opcode / 100](thread, opcode);
+                auto handler = flatHandlers[opcode];
+                return handler ? handler(thread) : UnknownOpcode(thread, opcode);
+            }
+
+            template<DispatchMode mode>
+            void ProcessScript(HostScript *thread)
+            {
+                while (ProcessOneCommand<mode>(thread) == OR_CONTINUE);
+            }
+
+            SCRIPT_VAR *ReadVariable(HostScript *thread)
+            {
+                auto var = ReadScriptParamPointer(thread);
+                if (!var) ThrowScriptError(thread, "variable operand expected");
+                return var;
+            }
+
+            /************************************************************************/
+            /*              Game opcodes known to the host                          */
+            /************************************************************************/
+
+            //0000=0,nop
+            OpcodeResult Nop(HostScript *thread)
+            {
+                return OR_CONTINUE;
+            }
+
+            //0001=1,wait %1d% ms
+            OpcodeResult Wait(HostScript *thread)
+            {
+                SCRIPT_VAR time;
+                ReadScriptParams(thread, &time, 1);
+                thread->SetWakeTime(thread->host.time + time.dwParam);
+                return OR_INTERRUPT;
+            }
+
+            //0002=1,jump %1p%
+            OpcodeResult Jump(HostScript *thread)
+            {
+                SCRIPT_VAR label;
+                ReadScriptParams(thread, &label, 1);
+                thread->Jump(label.nParam);
+                return OR_CONTINUE;
+            }
+
+            //004C=1,jump_if_true %1p%
+            //004D=1,jump_if_false %1p%
+            template<bool condition>
+            OpcodeResult JumpIf(HostScript *thread)
+            {
+                SCRIPT_VAR label;
+                ReadScriptParams(thread, &label, 1);
+                if (thread->GetConditionResult() == condition) thread->Jump(label.nParam);
+                return OR_CONTINUE;
+            }
+
+            //004E=0,end_thread
+            //0A93=0,end_custom_thread
+            OpcodeResult EndThread(HostScript *thread)
+            {
+                thread->ended = true;
+                return OR_INTERRUPT;
+            }
+
+            //0050=1,gosub %1p%
+            OpcodeResult Gosub(HostScript *thread)
+            {
+                SCRIPT_VAR label;
+                ReadScriptParams(thread, &label, 1);
+                if (thread->IsStackFull()) ThrowScriptError(thread, "gosub stack overflow");
+                thread->PushStack(thread->GetBytePointer());
+                thread->Jump(label.nParam);
+                return OR_CONTINUE;
+            }
+
+            //0051=0,return
+            OpcodeResult Return(HostScript *thread)
+            {
+                if (thread->IsStackEmpty()) ThrowScriptError(thread, "return without gosub");
+                thread->SetIp(thread->PopStack());
+                return OR_CONTINUE;
+            }
+
+            //00D6=1,if %1d%
+            OpcodeResult AndOr(HostScript *thread)
+            {
+                SCRIPT_VAR param;
+                ReadScriptParams(thread, &param, 1);
+                int op = param.nParam;
+                if (!op)
+                {
+                    thread->SetLogicalOp(eLogicalOperation::NONE);
+                    thread->SetConditionResult(false);
+                }
+                // the game counts the conditions left, the last one (AND_2 or OR_2) ends the operation
+                else if (op >= eLogicalOperation::AND_2 && op < eLogicalOperation::AND_END)
+                {
+                    thread->SetLogicalOp(static_cast<eLogicalOperation>(op + 1));
+                    thread->SetConditionResult(true);
+                }
+                else if (op >= eLogicalOperation::OR_2 && op < eLogicalOperation::OR_END)
+                {
+                    thread->SetLogicalOp(static_cast<eLogicalOperation>(op + 1));
+                    thread->SetConditionResult(false);
+                }
+                return OR_CONTINUE;
+            }
+
+            //03A4=1,name_thread %1d%
+            OpcodeResult ScriptName(HostScript *thread)
+            {
+                char name[8];
+                ReadScriptStringParam(thread, name, sizeof(name));
+                thread->SetName(name);
+                return OR_CONTINUE;
+            }
+
+            int SetInt(int, int value) { return value; }
+            int AddInt(int a, int b) { return a + b; }
+            int SubInt(int a, int b) { return a - b; }
+            float SetFloat(float, float value) { return value; }
+            float AddFloat(float a, float b) { return a + b; }
+            float SubFloat(float a, float b) { return a - b; }
+            bool GreaterInt(int a, int b) { return a > b; }
+            bool GreaterOrEqualInt(int a, int b) { return a >= b; }
+            bool EqualInt(int a, int b) { return a == b; }
+            bool GreaterFloat(float a, float b) { return a > b; }
+
+            //0004=2,%1d% = %2d%
+            //0008=2,%1d% += %2d%
+            //000C=2,%1d% -= %2d%
+            //0084=2,%1d% = %2d%
+            template<int (*op)(int, int)>
+            OpcodeResult UpdateInt(HostScript *thread)
+            {
+                auto var = ReadVariable(thread);
+                SCRIPT_VAR value;
+                ReadScriptParams(thread, &value, 1);
+                var->nParam = op(var->nParam, value.nParam);
+                return OR_CONTINUE;
+            }
+
+            //0005=2,%1d% = %2d%
+            //0009=2,%1d% += %2d%
+            //000D=2,%1d% -= %2d%
+            template<float (*op)(float, float)>
+            OpcodeResult UpdateFloat(HostScript *thread)
+            {
+                auto var = ReadVariable(thread);
+                SCRIPT_VAR value;
+                ReadScriptParams(thread, &value, 1);
+                var->fParam = op(var->fParam, value.fParam);
+                return OR_CONTINUE;
+            }
+
+            //0018=2,  %1d% > %2d%
+            //0028=2,  %1d% >= %2d%
+            //0038=2,  %1d% == %2d%
+            template<bool (*compare)(int, int)>
+            OpcodeResult CompareInt(HostScript *thread)
+            {
+                SCRIPT_VAR values[2];
+                ReadScriptParams(thread, values, 2);
+                thread->UpdateCompareFlag(compare(values[0].nParam, values[1].nParam));
+                return OR_CONTINUE;
+            }
+
+            //0020=2,  %1d% > %2d%
+            template<bool (*compare)(float, float)>
+            OpcodeResult CompareFloat(HostScript *thread)
+            {
+                SCRIPT_VAR values[2];
+                ReadScriptParams(thread, values, 2);
+                thread->UpdateCompareFlag(compare(values[0].fParam, values[1].fParam));
+                return OR_CONTINUE;
+            }
+
+            /************************************************************************/
+            /*              CLEO opcodes known to the host                          */
+            /************************************************************************/
+
+            //0A8E=3,%3d% = %1d% + %2d% ; int
+            //0A8F=3,%3d% = %1d% - %2d% ; int
+            //0A90=3,%3d% = %1d% * %2d% ; int
+            //0A91=3,%3d% = %1d% / %2d% ; int
+            template<char op>
+            OpcodeResult IntOperation(HostScript *thread)
+            {
+                SCRIPT_VAR values[2], result;
+                ReadScriptParams(thread, values, 2);
+                switch (op)
+                {
+                case '+': result.nParam = values[0].nParam + values[1].nParam; break;
+                case '-': result.nParam = values[0].nParam - values[1].nParam; break;
+                case '*': result.nParam = values[0].nParam * values[1].nParam; break;
+                case '/':
+                    if (!values[1].nParam) ThrowScriptError(thread, "division by zero");
+                    result.nParam = values[0].nParam / values[1].nParam;
+                    break;
+                }
+                WriteScriptParam(thread, result);
+                return OR_CONTINUE;
+            }
+
+            //0AB1=-1,call_scm_func %1p%
+            OpcodeResult CallScmFunc(HostScript *thread)
+            {
+                SCRIPT_VAR params[2];
+                ReadScriptParams(thread, params, 2);
+                int label = params[0].nParam;
+                DWORD numLocals = label < 0 ? thread->index.GetFunctionLocals(-label) : NUM_FUNCTION_LOCALS;
+                CallScmFunction(thread, thread->callStack, label, params[1].dwParam, numLocals, true);
+                return OR_CONTINUE;
+            }
+
+            //0AB2=-1,ret
+            OpcodeResult ReturnScmFunc(HostScript *thread)
+            {
+                if (thread->callStack.Empty())
+                {
+                    // ignored, the same way CLEO does it
+                    while (*thread->GetBytePointer()) SkipScriptParam(thread);
+                    thread->IncPtr();
+                    return OR_CONTINUE;
+                }
+                ReturnFromScmFunction(thread, thread->callStack);
+                return OR_CONTINUE;
+            }
+
+            SCRIPT_VAR& GetCleoVariable(HostScript *thread, DWORD id)
+            {
+                if (id >= NUM_CLEO_VARIABLES) ThrowScriptError(thread, "CLEO variable id out of range");
+                return thread->host.cleoVariables[id];
+            }
+
+            //0AB3=2,var %1d% = %2d%
+            OpcodeResult SetCleoVar(HostScript *thread)
+            {
+                SCRIPT_VAR params[2];
+                ReadScriptParams(thread, params, 2);
+                GetCleoVariable(thread, params[0].dwParam) = params[1];
+                return OR_CONTINUE;
+            }
+
+            //0AB4=2,%2d% = var %1d%
+            OpcodeResult GetCleoVar(HostScript *thread)
+            {
+                SCRIPT_VAR id;
+                ReadScriptParams(thread, &id, 1);
+                WriteScriptParam(thread, GetCleoVariable(thread, id.dwParam));
+                return OR_CONTINUE;
+            }
+
+            struct OpcodeRegistration
+            {
+                OpcodeRegistration()
+                {
+                    std::fill(groupHandlers, groupHandlers + NUM_OPCODE_GROUPS, DispatchGroup);
+
+                    ScriptHost::RegisterOpcode(0x0000, Nop);
+                    ScriptHost::RegisterOpcode(0x0001, Wait);
+                    ScriptHost::RegisterOpcode(0x0002, Jump);
+                    ScriptHost::RegisterOpcode(0x004C, JumpIf<true>);
+                    ScriptHost::RegisterOpcode(0x004D, JumpIf<false>);
+                    ScriptHost::RegisterOpcode(0x004E, EndThread);
+                    ScriptHost::RegisterOpcode(0x0050, Gosub);
+                    ScriptHost::RegisterOpcode(0x0051, Return);
+                    ScriptHost::RegisterOpcode(0x00D6, AndOr);
+                    ScriptHost::RegisterOpcode(0x03A4, ScriptName);
+
+                    // int and float variants of global and local variables
+                    ScriptHost::RegisterOpcode(0x0004, UpdateInt<SetInt>);
+                    ScriptHost::RegisterOpcode(0x0005, UpdateFloat<SetFloat>);
+                    ScriptHost::RegisterOpcode(0x0006, UpdateInt<SetInt>);
+                    ScriptHost::RegisterOpcode(0x0007, UpdateFloat<SetFloat>);
+                    ScriptHost::RegisterOpcode(0x0008, UpdateInt<AddInt>);
+                    ScriptHost::RegisterOpcode(0x0009, UpdateFloat<AddFloat>);
+                    ScriptHost::RegisterOpcode(0x000A, UpdateInt<AddInt>);
+                    ScriptHost::RegisterOpcode(0x000B, UpdateFloat<AddFloat>);
+                    ScriptHost::RegisterOpcode(0x000C, UpdateInt<SubInt>);
+                    ScriptHost::RegisterOpcode(0x000D, UpdateFloat<SubFloat>);
+                    ScriptHost::RegisterOpcode(0x000E, UpdateInt<SubInt>);
+                    ScriptHost::RegisterOpcode(0x000F, UpdateFloat<SubFloat>);
+                    for (WORD opcode = 0x0018; opcode <= 0x001F; ++opcode) ScriptHost::RegisterOpcode(opcode, CompareInt<GreaterInt>);
+                    for (WORD opcode = 0x0020; opcode <= 0x0027; ++opcode) ScriptHost::RegisterOpcode(opcode, CompareFloat<GreaterFloat>);
+                    for (WORD opcode = 0x0028; opcode <= 0x002F; ++opcode) ScriptHost::RegisterOpcode(opcode, CompareInt<GreaterOrEqualInt>);
+                    for (WORD opcode = 0x0038; opcode <= 0x003B; ++opcode) ScriptHost::RegisterOpcode(opcode, CompareInt<EqualInt>);
+                    for (WORD opcode = 0x0084; opcode <= 0x008B; ++opcode) ScriptHost::RegisterOpcode(opcode, UpdateInt<SetInt>);
+
+                    ScriptHost::RegisterOpcode(0x0A8E, IntOperation<'+'>);
+                    ScriptHost::RegisterOpcode(0x0A8F, IntOperation<'-'>);
+                    ScriptHost::RegisterOpcode(0x0A90, IntOperation<'*'>);
+                    ScriptHost::RegisterOpcode(0x0A91, IntOperation<'/'>);
+                    ScriptHost::RegisterOpcode(0x0A93, EndThread);
+                    ScriptHost::RegisterOpcode(0x0AB1, CallScmFunc);
+                    ScriptHost::RegisterOpcode(0x0AB2, ReturnScmFunc);
+                    ScriptHost::RegisterOpcode(0x0AB3, SetCleoVar);
+                    ScriptHost::RegisterOpcode(0x0AB4, GetCleoVar);
+                }
+            } opcodeRegistration;
+        }
+
+        HostScript::HostScript(ScriptHost& host, const BYTE *data, size_t size, const char *name) :
+            code(data, data + size), host(host), ended(false), executed(0)
+        {
+            BuildBytecodeIndex(code.data(), code.size(), index);
+            BaseIP = CurrentIP = code.data();
+            bIsActive = true;
+            SetName(name);
+            callStack.owner = this;
+        }
+
+        void HostScript::UpdateCompareFlag(bool result)
+        {
+            if (NotFlag) result = !result;
+            if (LogicalOp == eLogicalOperation::NONE)
+            {
+                bCondResult = result;
+                return;
+            }
+            if (LogicalOp >= eLogicalOperation::OR_2) bCondResult = bCondResult || result;
+            else bCondResult = bCondResult && result;
+            --LogicalOp;
+        }
+
+        void HostScript::Jump(int label)
+        {
+            SetIp(label < 0 ? GetBasePointer() - label : scmBlock + label);
+        }
+
+        ScriptHost::ScriptHost(DispatchMode dispatch) : dispatch(dispatch), time(0)
+        {
+            memset(cleoVariables, 0, sizeof(cleoVariables));
+        }
+
+        HostScript& ScriptHost::Load(const BYTE *code, size_t size, const char *name)
+        {
+            scripts.emplace_back(new HostScript(*this, code, size, name));
+            return *scripts.back();
+        }
+
+        HostScript& ScriptHost::LoadFile(const char *path)
+        {
+            FILE *file = fopen(path, "rb");
+            if (!file) throw std::runtime_error(std::string("can not open ") + path);
+
+            std::vector<BYTE> code;
+            BYTE buf[0x1000];
+            for (size_t read; (read = fread(buf, 1, sizeof(buf), file));) code.insert(code.end(), buf, buf + read);
+            fclose(file);
+
+            // named after the file until the script names itself
+            std::string name = path;
+            auto slash = name.find_last_of("/\\");
+            if (slash != std::string::npos) name.erase(0, slash + 1);
+            return Load(code.data(), code.size(), name.c_str());
+        }
+
+        size_t ScriptHost::Process(DWORD frameTime)
+        {
+            time += frameTime;
+            size_t executed = 0;
+            for (auto& script : scripts)
+            {
+                if (script->ended || script->GetWakeTime() > time) continue;
+
+                size_t before = script->executed;
+                if (dispatch == DispatchMode::GAME) ProcessScript<DispatchMode::GAME>(script.get());
+                else ProcessScript<DispatchMode::FLAT>(script.get());
+                executed += script->executed - before;
+            }
+            return executed;
+        }
+
+        size_t ScriptHost::Run(size_t maxFrames, DWORD frameTime)
+        {
+            size_t frames = 0;
+            for (; frames < maxFrames && !IsIdle(); ++frames) Process(frameTime);
+            return frames;
+        }
+
+        bool ScriptHost::IsIdle() const
+        {
+            return std::all_of(scripts.begin(), scripts.end(), [](const std::unique_ptr<HostScript>& script) { return script->ended; });
+        }
+
+        void ScriptHost::RegisterOpcode(WORD opcode, OpcodeHandler handler)
+        {
+            opcode &= 0x7FFF;
+            flatHandlers[opcode] = handler;
+            if (opcode / 100 < NUM_OPCODE_GROUPS) groupedHandlers[opcode % 100][opcode / 100] = handler;
+        }
+
+        OpcodeHandler ScriptHost::GetOpcodeHandler(WORD opcode)
+        {
+            return flatHandlers[opcode & 0x7FFF];
+        }
+
+        SCRIPT_VAR *ScriptHost::GetScriptSpace()
+        {
+            return scriptSpace;
+        }
+
+        SCRIPT_VAR *ScriptHost::GetMissionLocals()
+        {
+            return missionLocals;
+        }
+    }
+}
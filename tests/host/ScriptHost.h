@@ -0,0 +1,98 @@
+#pragma once
+#include "stdafx.h"
+#include "ScriptParams.h"
+#include "CScmFunction.h"
+#include "CBytecodeVerifier.h"
+#include <memory>
+
+// Headless script host: runs custom scripts outside of the game, against a mock script space and mission locals.
+// Operands, scm function calls and the verifier are the plugin's own code; the script loop, the dispatch and the handlers
+// of the few game opcodes the host knows are reimplemented here, as the game's ones are not portable.
+
+namespace CLEO
+{
+    namespace Host
+    {
+        const size_t SCRIPT_SPACE_SIZE = 0x40000;       // main.scm and mission blocks
+        const size_t NUM_MISSION_LOCALS = 1024;
+        const size_t NUM_CLEO_VARIABLES = 0x400;
+
+        enum OpcodeResult : char
+        {
+            OR_CONTINUE = 0,
+            OR_INTERRUPT = 1,
+        };
+
+        class HostScript;
+        typedef OpcodeResult (*OpcodeHandler)(HostScript *thread);
+
+        // the ways opcodes are looked up by the script loop
+        enum class DispatchMode
+        {
+            GAME,       // handler of the opcode's group by opcode / 100, then the former [opcode % 100][opcode / 100] table of CLEO
+            FLAT,       // single table indexed by the opcode (CLEO_RegisterOpcode's table since the group lookup was dropped)
+        };
+
+        class ScriptHost;
+
+        class HostScript : public CRunningScript
+        {
+            friend class ScriptHost;
+
+            std::vector<BYTE> code;
+
+        public:
+            ScriptHost& host;
+            CBytecodeIndex index;
+            ScmCallStack callStack;
+            bool ended;
+            size_t executed;                            // opcodes
+
+            HostScript(ScriptHost& host, const BYTE *data, size_t size, const char *name);
+
+            inline size_t GetCodeSize() const { return code.size(); }
+            inline DWORD GetWakeTime() const { return WakeTime; }
+            inline void SetWakeTime(DWORD time) { WakeTime = time; }
+            inline void SetName(const char *name) { strncpy(Name, name, sizeof(Name) - 1); Name[sizeof(Name) - 1] = '\0'; }
+            inline bool IsStackEmpty() const { return !SP; }
+            inline bool IsStackFull() const { return SP == sizeof(Stack) / sizeof(*Stack); }
+
+            // game's CRunningScript::UpdateCompareFlag
+            void UpdateCompareFlag(bool result);
+
+            // jump operand: negative offsets are relative to the script's code, positive ones to the script space
+            void Jump(int label);
+        };
+
+        class ScriptHost
+        {
+            std::vector<std::unique_ptr<HostScript>> scripts;
+
+        public:
+            DispatchMode dispatch;
+            DWORD time;                                 // game timer, in ms
+            SCRIPT_VAR cleoVariables[NUM_CLEO_VARIABLES];
+
+            explicit ScriptHost(DispatchMode dispatch = DispatchMode::FLAT);
+
+            // the code is verified first, throws std::runtime_error if it is not valid
+            HostScript& Load(const BYTE *code, size_t size, const char *name = "noname");
+            HostScript& LoadFile(const char *path);
+
+            // one frame: every script runs until it waits or ends, returns the number of opcodes executed
+            size_t Process(DWORD frameTime);
+            // frames until all scripts have ended or maxFrames have passed, returns the number of frames
+            size_t Run(size_t maxFrames, DWORD frameTime = 20);
+
+            bool IsIdle() const;
+            inline const std::vector<std::unique_ptr<HostScript>>& GetScripts() const { return scripts; }
+
+            // handlers are shared by all hosts; the opcodes known to the host are registered on startup
+            static void RegisterOpcode(WORD opcode, OpcodeHandler handler);
+            static OpcodeHandler GetOpcodeHandler(WORD opcode);
+
+            static SCRIPT_VAR *GetScriptSpace();
+            static SCRIPT_VAR *GetMissionLocals();
+        };
+    }
+}
@@ -0,0 +1,53 @@
+#include "ScriptHost.h"
+#include <chrono>
+#include <stdexcept>
+
+// cleo_host [--game-dispatch] [--frames N] script.cs...
+// runs the scripts until they end or N frames (of 20 ms) have passed, then prints what every script has executed
+
+using namespace CLEO;
+
+int main(int argc, char **argv)
+{
+    Host::DispatchMode dispatch = Host::DispatchMode::FLAT;
+    size_t maxFrames = 1000;
+    std::vector<const char *> files;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "--game-dispatch")) dispatch = Host::DispatchMode::GAME;
+        else if (!strcmp(argv[i], "--frames") && i + 1 < argc) maxFrames = strtoul(argv[++i], nullptr, 10);
+        else files.push_back(argv[i]);
+    }
+    if (files.empty())
+    {
+        printf("usage: cleo_host [--game-dispatch] [--frames N] script.cs...\n");
+        return 2;
+    }
+
+    Host::ScriptHost host(dispatch);
+    try
+    {
+        for (auto file : files) host.LoadFile(file);
+
+        auto start = std::chrono::steady_clock::now();
+        size_t frames = host.Run(maxFrames);
+        auto time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        size_t executed = 0;
+        for (auto& script : host.GetScripts())
+        {
+            printf("%-8s %10u opcodes, %s, %u of %u bytes verified\n", script->GetName(), static_cast<unsigned>(script->executed),
+                script->ended ? "ended" : "running", static_cast<unsigned>(script->index.indexedBytes),
+                static_cast<unsigned>(script->GetCodeSize()));
+            executed += script->executed;
+        }
+        printf("%u frames, %u opcodes in %.3f s\n", static_cast<unsigned>(frames), static_cast<unsigned>(executed), time);
+    }
+    catch (const std::exception& e)
+    {
+        printf("error: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,10 @@
+#pragma once
+// MSVC's intrin.h for the portable tests
+#include <cpuid.h>
+#include <x86intrin.h>
+
+#undef __cpuid
+inline void __cpuid(int info[4], int function)
+{
+    __cpuid_count(function, 0, info[0], info[1], info[2], info[3]);
+}
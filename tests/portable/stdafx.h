@@ -0,0 +1,58 @@
+#pragma once
+// Stand-in for source/stdafx.h in the portable tests:
+// only the parts of windows.h the portable sources use, without the game and plugin-sdk headers.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <stdexcept>
+
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef int64_t LONGLONG;
+typedef void *HANDLE;
+
+#define INVALID_HANDLE_VALUE (reinterpret_cast<HANDLE>(static_cast<intptr_t>(-1)))
+#define GENERIC_READ 0
+#define FILE_SHARE_READ 0
+#define OPEN_EXISTING 0
+#define FILE_FLAG_SEQUENTIAL_SCAN 0
+#define PAGE_READONLY 0
+#define FILE_MAP_READ 0
+
+union LARGE_INTEGER
+{
+    struct
+    {
+        DWORD LowPart;
+        int32_t HighPart;
+    };
+    LONGLONG QuadPart;
+};
+
+// save files are tested in memory (CSaveFileReader::Parse), mapping of files is not available
+inline HANDLE CreateFile(const char *, DWORD, DWORD, void *, DWORD, DWORD, HANDLE) { return INVALID_HANDLE_VALUE; }
+inline bool GetFileSizeEx(HANDLE, LARGE_INTEGER *) { return false; }
+inline HANDLE CreateFileMapping(HANDLE, void *, DWORD, DWORD, DWORD, const char *) { return nullptr; }
+inline void *MapViewOfFile(HANDLE, DWORD, DWORD, DWORD, size_t) { return nullptr; }
+inline bool UnmapViewOfFile(const void *) { return true; }
+inline bool CloseHandle(HANDLE) { return true; }
+
+// the caller locks the file, characters are read without locking it again
+inline int _getc_nolock(FILE *file) { return getc_unlocked(file); }
+inline int _ungetc_nolock(int c, FILE *file) { return ungetc(c, file); }
+inline long _ftell_nolock(FILE *file) { return ftell(file); }
+inline int _fseek_nolock(FILE *file, long offset, int origin) { return fseek(file, offset, origin); }
+
+inline char *_itoa(int value, char *buf, int radix)
+{
+    sprintf(buf, radix == 16 ? "%x" : radix == 8 ? "%o" : "%d", value);
+    return buf;
+}
+
+#include "CTheScripts.h"